@@ -0,0 +1,257 @@
+/*
+ * Copyright 2010-2019 Thierry FOURNIER
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License.
+ */
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "stats.h"
+
+/* Render cache. An entry is a file of the cache directory named by the
+ * hash of the chart, it contains the output as written. The recency is
+ * the file mtime, touched on each hit; the least recently used entries
+ * are removed when the directory is over its size.
+ */
+
+#define FNV_PRIME 0x100000001b3ULL
+
+void cache_hash_init(struct cache_hash *h)
+{
+	h->a = 0xcbf29ce484222325ULL;
+	h->b = 0x84222325cbf29ce4ULL;
+}
+
+void cache_hash_bytes(struct cache_hash *h, const void *data, size_t len)
+{
+	const unsigned char *p = data;
+	size_t i;
+
+	for (i=0; i<len; i++) {
+		h->a = ( h->a ^ p[i] ) * FNV_PRIME;
+		h->b = ( h->b ^ p[i] ^ ( i & 0xff ) ) * FNV_PRIME;
+	}
+	/* mix the length, so "ab" "c" and "a" "bc" differ */
+	h->b ^= h->a >> 29;
+	h->a += len;
+}
+
+void cache_hash_int(struct cache_hash *h, long long v)
+{
+	cache_hash_bytes(h, &v, sizeof(v));
+}
+
+void cache_hash_double(struct cache_hash *h, double v)
+{
+	if (v == 0)
+		v = 0; /* -0 */
+	cache_hash_bytes(h, &v, sizeof(v));
+}
+
+void cache_hash_str(struct cache_hash *h, const char *s)
+{
+	if (s == NULL) {
+		cache_hash_int(h, -1);
+		return;
+	}
+	cache_hash_bytes(h, s, strlen(s));
+}
+
+void cache_hash_hex(struct cache_hash *h, char *key)
+{
+	snprintf(key, CACHE_KEY_LEN + 1, "%016llx%016llx",
+	         (unsigned long long)h->a, (unsigned long long)h->b);
+}
+
+/* copy the file <fd> to <out>, by sendfile() if the kernel can */
+static
+long long send_fd(int fd, FILE *out)
+{
+	char buf[65536];
+	long long total = 0;
+	ssize_t n;
+
+	fflush(out);
+	while (1) {
+		n = sendfile(fileno(out), fd, NULL, 1 << 30);
+		if (n < 0 && ( errno == EINVAL || errno == ENOSYS ))
+			break;
+		if (n < 0)
+			return -1;
+		if (n == 0)
+			return total;
+		total += n;
+	}
+
+	/* this output doesn't support sendfile */
+	while ((n = read(fd, buf, sizeof(buf))) > 0) {
+		if (fwrite(buf, 1, n, out) != (size_t)n)
+			return -1;
+		total += n;
+	}
+	return n < 0 ? -1 : total;
+}
+
+/* Write the entry <key> on <out>. Returns 0 if it is not in the cache,
+ * nothing is written then.
+ */
+int cache_send(const char *dir, const char *key, FILE *out)
+{
+	char path[4096];
+	long long n;
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, key);
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return 0;
+
+	/* most recently used */
+	futimens(fd, NULL);
+
+	n = send_fd(fd, out);
+	close(fd);
+	if (n < 0) {
+		fprintf(stderr, "can't write output file\n");
+		exit(1);
+	}
+	STATS_ADD(bytes, n);
+	return 1;
+}
+
+/* A temporary file of the cache directory for a new entry, its name is
+ * written in <tmp>. Returns NULL if the directory is not usable.
+ */
+FILE *cache_tmp(const char *dir, char *tmp, size_t len)
+{
+	FILE *f;
+	int fd;
+
+	mkdir(dir, 0755);
+	snprintf(tmp, len, "%s/.tmp-XXXXXX", dir);
+	fd = mkstemp(tmp);
+	if (fd < 0)
+		return NULL;
+	fchmod(fd, 0644);
+	f = fdopen(fd, "w");
+	if (f == NULL) {
+		close(fd);
+		unlink(tmp);
+	}
+	return f;
+}
+
+struct entry {
+	char name[CACHE_KEY_LEN + 1];
+	long long size;
+	struct timespec mtime; /* ns, several hits fall in one second */
+};
+
+static
+int cmp_entry(const void *a, const void *b)
+{
+	const struct entry *ea = a;
+	const struct entry *eb = b;
+
+	if (ea->mtime.tv_sec != eb->mtime.tv_sec)
+		return ea->mtime.tv_sec < eb->mtime.tv_sec ? -1 : 1;
+	if (ea->mtime.tv_nsec != eb->mtime.tv_nsec)
+		return ea->mtime.tv_nsec < eb->mtime.tv_nsec ? -1 : 1;
+	return strcmp(ea->name, eb->name);
+}
+
+/* remove the least recently used entries, except <keep>, until the
+ * directory holds at most <max> bytes
+ */
+static
+void cache_evict(const char *dir, const char *keep, long long max)
+{
+	struct entry *e = NULL;
+	struct dirent *de;
+	struct stat st;
+	char path[4096];
+	long long total = 0;
+	int size = 0;
+	int nb = 0;
+	int i;
+	DIR *d;
+
+	d = opendir(dir);
+	if (d == NULL)
+		return;
+
+	while ((de = readdir(d)) != NULL) {
+		if (strlen(de->d_name) != CACHE_KEY_LEN ||
+		    strspn(de->d_name, "0123456789abcdef") != CACHE_KEY_LEN)
+			continue;
+		snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+		if (stat(path, &st) != 0 || !S_ISREG(st.st_mode))
+			continue;
+		total += st.st_size;
+		if (strcmp(de->d_name, keep) == 0)
+			continue;
+		if (nb == size) {
+			size = size == 0 ? 64 : size * 2;
+			e = realloc(e, size * sizeof(struct entry));
+			if (e == NULL) {
+				fprintf(stderr, "Memory error\n");
+				exit(1);
+			}
+		}
+		memcpy(e[nb].name, de->d_name, CACHE_KEY_LEN + 1);
+		e[nb].size = st.st_size;
+		e[nb].mtime = st.st_mtim;
+		nb++;
+	}
+	closedir(d);
+
+	if (total > max) {
+		qsort(e, nb, sizeof(struct entry), cmp_entry);
+		for (i=0; i<nb && total > max; i++) {
+			snprintf(path, sizeof(path), "%s/%s", dir, e[i].name);
+			if (unlink(path) == 0)
+				total -= e[i].size;
+		}
+	}
+	free(e);
+}
+
+/* The temporary file <tmp> becomes the entry <key>, is written on <out>
+ * and the cache is trimmed to <max> bytes. The rename is atomic, an
+ * other process reads the old entry or the new one.
+ */
+void cache_put(const char *dir, const char *key, const char *tmp,
+               long long max, FILE *out)
+{
+	char path[4096];
+	int fd;
+
+	fd = open(tmp, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "can't read cache file %s\n", tmp);
+		exit(1);
+	}
+
+	snprintf(path, sizeof(path), "%s/%s", dir, key);
+	if (rename(tmp, path) != 0)
+		unlink(tmp);
+
+	if (send_fd(fd, out) < 0) {
+		fprintf(stderr, "can't write output file\n");
+		exit(1);
+	}
+	close(fd);
+
+	cache_evict(dir, key, max);
+}
@@ -0,0 +1,35 @@
+/*
+ * Copyright 2010-2019 Thierry FOURNIER
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License.
+ */
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* 128 bits key, two FNV-1a 64 with different bases */
+struct cache_hash {
+	uint64_t a;
+	uint64_t b;
+};
+
+#define CACHE_KEY_LEN 32 /* hexadecimal digits */
+
+void cache_hash_init(struct cache_hash *h);
+void cache_hash_bytes(struct cache_hash *h, const void *data, size_t len);
+void cache_hash_int(struct cache_hash *h, long long v);
+void cache_hash_double(struct cache_hash *h, double v);
+void cache_hash_str(struct cache_hash *h, const char *s);
+void cache_hash_hex(struct cache_hash *h, char *key);
+
+int cache_send(const char *dir, const char *key, FILE *out);
+FILE *cache_tmp(const char *dir, char *tmp, size_t len);
+void cache_put(const char *dir, const char *key, const char *tmp,
+               long long max, FILE *out);
+
+#endif /* __CACHE_H__ */
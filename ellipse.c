@@ -7,37 +7,174 @@
  * 2 of the License.
  */
 #include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <cairo.h>
 
 /*
  * x = h + a * cos(t);
  * y = k + b * sin(t);
  *
+ * The points of an arc are computed by a rotation of <step>: from
+ * cos(t) and sin(t), cos(t + step) and sin(t + step) cost four
+ * multiplications instead of a cos and a sin. The exact values are
+ * computed again every ARC_EXACT points, the error stays far below
+ * the pixel. The points are written in a path buffer given to cairo in
+ * one call.
  */
-void cairo_ellipse(cairo_t *c, double x, double y, double a, double b, double start, double stop)
+
+#define ARC_EXACT 256
+
+/* points of the path buffer on the stack, the larger arcs use the heap */
+#define ARC_STACK 512
+
+/* intermediate points between <start> and <stop>, at <step> */
+static inline
+int arc_count(double start, double stop, double step)
+{
+	double n;
+
+	n = ceil(( stop - start ) / step) - 1;
+	return n > 0 ? (int)n : 0;
+}
+
+static inline
+cairo_path_data_t *arc_buf(cairo_path_data_t *stack, int points)
+{
+	cairo_path_data_t *d;
+
+	if (points <= ARC_STACK)
+		return stack;
+	d = malloc(points * 2 * sizeof(cairo_path_data_t));
+	if (d == NULL) {
+		fprintf(stderr, "Memory error\n");
+		exit(1);
+	}
+	return d;
+}
+
+static inline
+void arc_point(cairo_path_data_t *d, cairo_path_data_type_t op, double x,
+               double y)
+{
+	d[0].header.type = op;
+	d[0].header.length = 2;
+	d[1].point.x = x;
+	d[1].point.y = y;
+}
+
+/* Write the <n> + 2 points of the arc from <start> to <stop> in <d>,
+ * the first one with <op>. <step> is negative for the arcs drawn
+ * backward.
+ */
+static
+void arc_fill(cairo_path_data_t *d, cairo_path_data_type_t op, double x,
+              double y, double a, double b, double start, double stop,
+              double step, int n)
+{
+	double cs = cos(step);
+	double sn = sin(step);
+	double co = 0;
+	double si = 0;
+	double t;
+	int k;
+
+	for (k=0; k<=n; k++) {
+		if (( k % ARC_EXACT ) == 0) {
+			co = cos(start + ( k * step ));
+			si = sin(start + ( k * step ));
+		}
+		arc_point(&d[k * 2], op, x + ( a * co ), y + ( b * si ));
+		op = CAIRO_PATH_LINE_TO;
+		t = ( co * cs ) - ( si * sn );
+		si = ( si * cs ) + ( co * sn );
+		co = t;
+	}
+	arc_point(&d[( n + 1 ) * 2], CAIRO_PATH_LINE_TO, x + ( a * cos(stop) ),
+	          y + ( b * sin(stop) ));
+}
+
+static
+void arc_append(cairo_t *c, cairo_path_data_t *d, int points)
+{
+	cairo_path_t path;
+
+	path.status = CAIRO_STATUS_SUCCESS;
+	path.data = d;
+	path.num_data = points * 2;
+	cairo_append_path(c, &path);
+}
+
+/* <step> is the angle between two points of the polyline. Returns the
+ * number of segments.
+ */
+int cairo_ellipse(cairo_t *c, double x, double y, double a, double b, double start, double stop,
+                   double step)
 {
-	double i;
+	cairo_path_data_t stack[ARC_STACK * 2];
+	cairo_path_data_t *d;
+	int n;
 
 	while (stop < start)
 		stop += 2.0f * M_PI;
 
-	cairo_line_to(c, x+(a*cos(start)), y+(b*sin(start)));
-	for (i=start; i<stop; i += 0.01f)
-		cairo_line_to(c, x+(a*cos(i)), y+(b*sin(i)));
-	cairo_line_to(c, x+(a*cos(stop)), y+(b*sin(stop)));
+	n = arc_count(start, stop, step);
+	d = arc_buf(stack, n + 2);
+	arc_fill(d, CAIRO_PATH_LINE_TO, x, y, a, b, start, stop, step, n);
+	arc_append(c, d, n + 2);
+	if (d != stack)
+		free(d);
+	return n + 2;
 }
 
-void cairo_ellipse_negative(cairo_t *c, double x, double y, double a, double b, double start, double stop)
+int cairo_ellipse_negative(cairo_t *c, double x, double y, double a, double b, double start, double stop,
+                            double step)
 {
-	double i;
+	cairo_path_data_t stack[ARC_STACK * 2];
+	cairo_path_data_t *d;
+	int n;
 
 	while (stop > start)
 		stop -= 2.0f * M_PI;
 
-	cairo_move_to(c, x+(a*cos(start)), y+(b*sin(start)));
-	for (i=start; i>stop; i -= 0.01f)
-		cairo_line_to(c, x+(a*cos(i)), y+(b*sin(i)));
-	cairo_line_to(c, x+(a*cos(stop)), y+(b*sin(stop)));
+	n = arc_count(stop, start, step);
+	d = arc_buf(stack, n + 2);
+	arc_fill(d, CAIRO_PATH_MOVE_TO, x, y, a, b, start, stop, -step, n);
+	arc_append(c, d, n + 2);
+	if (d != stack)
+		free(d);
+	return n + 2;
+}
+
+/* The band between the arc from <start> to <stop> and the same arc <dy>
+ * lower, drawn backward: the outline of a rounded face. The points of
+ * the lower arc are the ones of the upper arc, translated. Returns the
+ * number of segments.
+ */
+int cairo_ellipse_band(cairo_t *c, double x, double y, double a, double b,
+                       double start, double stop, double step, double dy)
+{
+	cairo_path_data_t stack[ARC_STACK * 2];
+	cairo_path_data_t *d;
+	int n;
+	int k;
+
+	while (stop < start)
+		stop += 2.0f * M_PI;
+
+	n = arc_count(start, stop, step);
+	d = arc_buf(stack, ( ( n + 2 ) * 2 ) + 1);
+	arc_fill(d, CAIRO_PATH_MOVE_TO, x, y, a, b, start, stop, step, n);
+	for (k=0; k<n+2; k++)
+		arc_point(&d[( n + 2 + k ) * 2], CAIRO_PATH_LINE_TO,
+		          d[( ( n + 1 - k ) * 2 ) + 1].point.x,
+		          d[( ( n + 1 - k ) * 2 ) + 1].point.y + dy);
+	arc_point(&d[( n + 2 ) * 4], CAIRO_PATH_LINE_TO, d[1].point.x,
+	          d[1].point.y);
+	arc_append(c, d, ( ( n + 2 ) * 2 ) + 1);
+	if (d != stack)
+		free(d);
+	return ( ( n + 2 ) * 2 ) + 1;
 }
 
 #if 0
@@ -52,13 +189,13 @@ int ____main(void) {
 	cairo_set_line_width(c, 1.0f);
 
 	cairo_move_to(c, 150, 150);
-	cairo_ellipse_negative(c, 150, 150, 100, 50, 0, M_PI/2);
+	cairo_ellipse_negative(c, 150, 150, 100, 50, 0, M_PI/2, 0.01f);
 	cairo_line_to(c, 150, 150);
 	cairo_fill(c);
 	cairo_stroke(c);
 
 	cairo_move_to(c, 160, 160);
-	cairo_ellipse(c, 160, 160, 100, 50, 0, M_PI/2);
+	cairo_ellipse(c, 160, 160, 100, 50, 0, M_PI/2, 0.01f);
 	cairo_line_to(c, 160, 160);
 	cairo_fill(c);
 	cairo_stroke(c);
@@ -11,11 +11,17 @@
 
 #include <cairo.h>
 
-void cairo_ellipse(cairo_t *c, double x, double y,
-                               double rayon_x, double rayon_y,
-                               double angle_start, double angle_stop);
-void cairo_ellipse_negative(cairo_t *c, double x, double y,
-                                        double rayon_x, double rayon_y,
-                                        double angle_start, double angle_stop);
+int cairo_ellipse(cairo_t *c, double x, double y,
+                  double rayon_x, double rayon_y,
+                  double angle_start, double angle_stop,
+                  double step);
+int cairo_ellipse_negative(cairo_t *c, double x, double y,
+                           double rayon_x, double rayon_y,
+                           double angle_start, double angle_stop,
+                           double step);
+int cairo_ellipse_band(cairo_t *c, double x, double y,
+                       double rayon_x, double rayon_y,
+                       double angle_start, double angle_stop,
+                       double step, double dy);
 
 #endif /* __ELLIPSE_H__ */
@@ -0,0 +1,352 @@
+/*
+ * Copyright 2010-2019 Thierry FOURNIER
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cairo.h>
+
+#include "encode.h"
+
+static inline
+void *row_buffer(size_t len)
+{
+	void *b;
+
+	b = malloc(len);
+	if (b == NULL) {
+		fprintf(stderr, "Memory error\n");
+		exit(1);
+	}
+	return b;
+}
+
+/* bytes per pixel in the surface memory */
+int format_bpp(cairo_format_t fmt)
+{
+	switch (fmt) {
+	case CAIRO_FORMAT_RGB16_565: return 2;
+	case CAIRO_FORMAT_A8:        return 1;
+	default:                     return 4;
+	}
+}
+
+/* channels kept by the encoders: RGBA, RGB or a gray level */
+int format_channels(cairo_format_t fmt)
+{
+	switch (fmt) {
+	case CAIRO_FORMAT_RGB24:
+	case CAIRO_FORMAT_RGB16_565: return 3;
+	case CAIRO_FORMAT_A8:        return 1;
+	default:                     return 4;
+	}
+}
+
+/* One line as straight RGBA, RGB or gray bytes. The gray level of an
+ * A8 surface is its alpha, so the mask is white where the chart is.
+ */
+void format_row(cairo_format_t fmt, const unsigned char *line, int w,
+                unsigned char *out)
+{
+	unsigned char px[4];
+	int x;
+
+	switch (fmt) {
+
+	case CAIRO_FORMAT_A8:
+		memcpy(out, line, w);
+		break;
+
+	case CAIRO_FORMAT_RGB24:
+	case CAIRO_FORMAT_RGB16_565:
+		for (x=0; x<w; x++) {
+			pixel_rgba(fmt, line, x, px);
+			memcpy(out + ( x * 3 ), px, 3);
+		}
+		break;
+
+	default:
+		for (x=0; x<w; x++)
+			unpremultiply(((const uint32_t *)line)[x], out + ( x * 4 ));
+		break;
+	}
+}
+
+/* The surface memory as is: native endian pixels of the surface
+ * format, no header. Without padding, the whole image is one write.
+ */
+void encode_raw(cairo_surface_t *s, cairo_write_func_t wr, void *arg)
+{
+	unsigned char *data;
+	int w;
+	int h;
+	int stride;
+	int y;
+
+	cairo_surface_flush(s);
+	data = cairo_image_surface_get_data(s);
+	w = cairo_image_surface_get_width(s);
+	h = cairo_image_surface_get_height(s);
+	stride = cairo_image_surface_get_stride(s);
+	w *= format_bpp(cairo_image_surface_get_format(s));
+
+	if (stride == w) {
+		wr(arg, data, stride * h);
+		return;
+	}
+	for (y=0; y<h; y++)
+		wr(arg, data + ( y * stride ), w);
+}
+
+/* Binary PPM, the alpha is dropped so the transparent areas are black.
+ * An A8 surface gives a PGM of its alpha.
+ */
+void encode_ppm(cairo_surface_t *s, cairo_write_func_t wr, void *arg)
+{
+	cairo_format_t fmt;
+	unsigned char *data;
+	unsigned char *row;
+	unsigned char *o;
+	uint32_t *px;
+	char head[64];
+	int w;
+	int h;
+	int stride;
+	int x;
+	int y;
+
+	cairo_surface_flush(s);
+	data = cairo_image_surface_get_data(s);
+	fmt = cairo_image_surface_get_format(s);
+	w = cairo_image_surface_get_width(s);
+	h = cairo_image_surface_get_height(s);
+	stride = cairo_image_surface_get_stride(s);
+
+	if (fmt == CAIRO_FORMAT_A8) {
+		wr(arg, (unsigned char *)head,
+		   snprintf(head, sizeof(head), "P5\n%d %d\n255\n", w, h));
+		for (y=0; y<h; y++)
+			wr(arg, data + ( y * stride ), w);
+		return;
+	}
+
+	wr(arg, (unsigned char *)head,
+	   snprintf(head, sizeof(head), "P6\n%d %d\n255\n", w, h));
+
+	row = row_buffer(w * 3);
+	for (y=0; y<h; y++) {
+		if (fmt == CAIRO_FORMAT_ARGB32) {
+			px = (uint32_t *)( data + ( y * stride ) );
+			o = row;
+			for (x=0; x<w; x++) {
+				*o++ = px[x] >> 16;
+				*o++ = px[x] >> 8;
+				*o++ = px[x];
+			}
+		}
+		else
+			format_row(fmt, data + ( y * stride ), w, row);
+		wr(arg, row, w * 3);
+	}
+	free(row);
+}
+
+/* PAM with straight alpha, RGB for the opaque formats and GRAYSCALE
+ * for A8.
+ */
+void encode_pam(cairo_surface_t *s, cairo_write_func_t wr, void *arg)
+{
+	static const char *tupltype[5] = { "", "GRAYSCALE", "", "RGB", "RGB_ALPHA" };
+	cairo_format_t fmt;
+	unsigned char *data;
+	unsigned char *row;
+	char head[128];
+	int w;
+	int h;
+	int stride;
+	int ch;
+	int y;
+
+	cairo_surface_flush(s);
+	data = cairo_image_surface_get_data(s);
+	fmt = cairo_image_surface_get_format(s);
+	w = cairo_image_surface_get_width(s);
+	h = cairo_image_surface_get_height(s);
+	stride = cairo_image_surface_get_stride(s);
+	ch = format_channels(fmt);
+
+	wr(arg, (unsigned char *)head,
+	   snprintf(head, sizeof(head),
+	            "P7\nWIDTH %d\nHEIGHT %d\nDEPTH %d\nMAXVAL 255\n"
+	            "TUPLTYPE %s\nENDHDR\n", w, h, ch, tupltype[ch]));
+
+	row = row_buffer(w * ch);
+	for (y=0; y<h; y++) {
+		format_row(fmt, data + ( y * stride ), w, row);
+		wr(arg, row, w * ch);
+	}
+	free(row);
+}
+
+/*
+ * QOI, "The Quite OK Image Format" (https://qoiformat.org/)
+ */
+
+#define QOI_OP_INDEX 0x00
+#define QOI_OP_DIFF  0x40
+#define QOI_OP_LUMA  0x80
+#define QOI_OP_RUN   0xc0
+#define QOI_OP_RGB   0xfe
+#define QOI_OP_RGBA  0xff
+
+#define QOI_HASH(p) ( ( p[0] * 3 + p[1] * 5 + p[2] * 7 + p[3] * 11 ) % 64 )
+
+/* the encoded stream goes out by blocks */
+#define QOI_BLOCK 65536
+
+static inline
+void be32(unsigned char *p, uint32_t v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+void encode_qoi(cairo_surface_t *s, cairo_write_func_t wr, void *arg)
+{
+	static const unsigned char end[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+	unsigned char index[64][4];
+	unsigned char prev[4];
+	unsigned char cur[4];
+	cairo_format_t fmt;
+	unsigned char *data;
+	unsigned char *b;
+	unsigned char *line;
+	int w;
+	int h;
+	int stride;
+	int x;
+	int y;
+	int run;
+	int len;
+	int k;
+	signed char vr;
+	signed char vg;
+	signed char vb;
+	signed char vg_r;
+	signed char vg_b;
+
+	cairo_surface_flush(s);
+	data = cairo_image_surface_get_data(s);
+	fmt = cairo_image_surface_get_format(s);
+	w = cairo_image_surface_get_width(s);
+	h = cairo_image_surface_get_height(s);
+	stride = cairo_image_surface_get_stride(s);
+
+	/* header */
+	b = row_buffer(QOI_BLOCK);
+	memcpy(b, "qoif", 4);
+	be32(b + 4, w);
+	be32(b + 8, h);
+	b[12] = format_channels(fmt) == 3 ? 3 : 4; /* channels */
+	b[13] = 0; /* sRGB with linear alpha */
+	len = 14;
+
+	memset(index, 0, sizeof(index));
+	prev[0] = 0;
+	prev[1] = 0;
+	prev[2] = 0;
+	prev[3] = 0xff;
+	run = 0;
+
+	for (y=0; y<h; y++) {
+		line = data + ( y * stride );
+		for (x=0; x<w; x++) {
+
+			/* room for the biggest op and a pending run */
+			if (len > QOI_BLOCK - 8) {
+				wr(arg, b, len);
+				len = 0;
+			}
+
+			pixel_rgba(fmt, line, x, cur);
+
+			if (memcmp(cur, prev, 4) == 0) {
+				run++;
+				if (run == 62) {
+					b[len++] = QOI_OP_RUN | ( run - 1 );
+					run = 0;
+				}
+				continue;
+			}
+
+			if (run > 0) {
+				b[len++] = QOI_OP_RUN | ( run - 1 );
+				run = 0;
+			}
+
+			k = QOI_HASH(cur);
+			if (memcmp(index[k], cur, 4) == 0)
+				b[len++] = QOI_OP_INDEX | k;
+
+			else {
+				memcpy(index[k], cur, 4);
+
+				if (cur[3] == prev[3]) {
+					vr = cur[0] - prev[0];
+					vg = cur[1] - prev[1];
+					vb = cur[2] - prev[2];
+					vg_r = vr - vg;
+					vg_b = vb - vg;
+
+					if (vr > -3 && vr < 2 && vg > -3 && vg < 2 &&
+					    vb > -3 && vb < 2)
+						b[len++] = QOI_OP_DIFF | ( ( vr + 2 ) << 4 ) |
+						           ( ( vg + 2 ) << 2 ) | ( vb + 2 );
+
+					else if (vg_r > -9 && vg_r < 8 && vg > -33 && vg < 32 &&
+					         vg_b > -9 && vg_b < 8) {
+						b[len++] = QOI_OP_LUMA | ( vg + 32 );
+						b[len++] = ( ( vg_r + 8 ) << 4 ) | ( vg_b + 8 );
+					}
+
+					else {
+						b[len++] = QOI_OP_RGB;
+						b[len++] = cur[0];
+						b[len++] = cur[1];
+						b[len++] = cur[2];
+					}
+				}
+
+				else {
+					b[len++] = QOI_OP_RGBA;
+					b[len++] = cur[0];
+					b[len++] = cur[1];
+					b[len++] = cur[2];
+					b[len++] = cur[3];
+				}
+			}
+
+			memcpy(prev, cur, 4);
+		}
+	}
+
+	if (len > QOI_BLOCK - 9) {
+		wr(arg, b, len);
+		len = 0;
+	}
+	if (run > 0)
+		b[len++] = QOI_OP_RUN | ( run - 1 );
+	memcpy(b + len, end, sizeof(end));
+	len += sizeof(end);
+	wr(arg, b, len);
+
+	free(b);
+}
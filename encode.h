@@ -0,0 +1,91 @@
+/*
+ * Copyright 2010-2019 Thierry FOURNIER
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License.
+ */
+#ifndef __ENCODE_H__
+#define __ENCODE_H__
+
+#include <stdint.h>
+
+#include <cairo.h>
+
+/* cairo ARGB32 pixels are native endian 32 bits words with premultiplied
+ * alpha. Most of the formats want straight RGBA bytes.
+ */
+static inline
+void unpremultiply(uint32_t px, unsigned char *out)
+{
+	unsigned int a;
+
+	a = px >> 24;
+	out[3] = a;
+	if (a == 0) {
+		out[0] = 0;
+		out[1] = 0;
+		out[2] = 0;
+	}
+	else if (a == 0xff) {
+		out[0] = px >> 16;
+		out[1] = px >> 8;
+		out[2] = px;
+	}
+	else {
+		out[0] = ( ( ( px >> 16 ) & 0xff ) * 255 + ( a / 2 ) ) / a;
+		out[1] = ( ( ( px >> 8 ) & 0xff ) * 255 + ( a / 2 ) ) / a;
+		out[2] = ( ( px & 0xff ) * 255 + ( a / 2 ) ) / a;
+	}
+}
+
+/* straight RGBA of the pixel <x> of a line of a <fmt> surface. RGB24
+ * and RGB16_565 are opaque, A8 is black with alpha.
+ */
+static inline
+void pixel_rgba(cairo_format_t fmt, const unsigned char *line, int x,
+                unsigned char *out)
+{
+	uint16_t v;
+
+	switch (fmt) {
+
+	case CAIRO_FORMAT_RGB24:
+		out[0] = ((const uint32_t *)line)[x] >> 16;
+		out[1] = ((const uint32_t *)line)[x] >> 8;
+		out[2] = ((const uint32_t *)line)[x];
+		out[3] = 0xff;
+		break;
+
+	case CAIRO_FORMAT_RGB16_565:
+		v = ((const uint16_t *)line)[x];
+		out[0] = ( ( v >> 11 ) << 3 ) | ( v >> 13 );
+		out[1] = ( ( ( v >> 5 ) & 0x3f ) << 2 ) | ( ( v >> 9 ) & 0x03 );
+		out[2] = ( ( v & 0x1f ) << 3 ) | ( ( v >> 2 ) & 0x07 );
+		out[3] = 0xff;
+		break;
+
+	case CAIRO_FORMAT_A8:
+		out[0] = 0;
+		out[1] = 0;
+		out[2] = 0;
+		out[3] = line[x];
+		break;
+
+	default:
+		unpremultiply(((const uint32_t *)line)[x], out);
+		break;
+	}
+}
+
+int format_bpp(cairo_format_t fmt);
+int format_channels(cairo_format_t fmt);
+void format_row(cairo_format_t fmt, const unsigned char *line, int w,
+                unsigned char *out);
+void encode_raw(cairo_surface_t *s, cairo_write_func_t wr, void *arg);
+void encode_ppm(cairo_surface_t *s, cairo_write_func_t wr, void *arg);
+void encode_pam(cairo_surface_t *s, cairo_write_func_t wr, void *arg);
+void encode_qoi(cairo_surface_t *s, cairo_write_func_t wr, void *arg);
+
+#endif /* __ENCODE_H__ */
@@ -6,9 +6,14 @@
  * as published by the Free Software Foundation; either version
  * 2 of the License.
  */
+#include <math.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
 
 #include "pie.h"
 
@@ -24,36 +29,143 @@ cairo_status_t wr(void *closure, const unsigned char *data, unsigned int length)
 void usage() {
 	printf(
 		"\n"
-		"Syntax: pie -o <file> [-b <hex>] [-c <float>] [-C <hex>] [-d <float>]\n"
-		"            [-e <float>] [-f <EPS|PNG|PDF|SVG>] [-h <integer>] [-i <file>]\n"
-		"            [-l <hex>] [-L <float>] [-m <float>] [-r <float>] [-s <size>]\n"
-		"            [-t <title>] [-T <hex>] [-w <float>] [val [val [val [...]]]]\n"
+		"Syntax: pie -o <file> [-a <integer>] [-b <hex>] [-B <integer>]\n"
+		"            [-c <float>] [-C <hex>] [-d <float>] [-D <integer>]\n"
+		"            [-e <float>] [-f <format>] [-g <integer>] [-F <filter>]\n"
+		"            [-h <integer>] [-H <file>] [-i <file>] [-I <float>]\n"
+		"            [-j <integer>] [-k <dir>] [-K <integer>] [-l <hex>]\n"
+		"            [-L <float>] [-m <float>] [-n <labels>] [-p <integer>]\n"
+		"            [-P] [-q <quality>] [-r <float>] [-R] [-s <size>]\n"
+		"            [-S <format>] [-t <title>] [-T <hex>]\n"
+		"            [-w <float>] [-W <float>] [-Y <file>] [-z <level>]\n"
+		"            [--stats[=json]]\n"
+		"            [--watch] [val [val [val [...]]]]\n"
 		"\n"
+		" -a <integer>         : APNG, frames interpolated between two\n"
+		"                        charts. Default is 0\n"
 		" -b <hex>             : Background color (ex: #ffffff). Default is\n"
 		"                        transparent\n"
+		" -B <integer>         : Band mode for large PNG. The image is drawn\n"
+		"                        and compressed by bands of <integer> lines,\n"
+		"                        0 chooses about 1MB per band. With -j, the\n"
+		"                        bands are drawn in parallel\n"
 		" -c <float>           : Pie line width. Default is 0\n"
 		" -C <hex>             : Pie line color. Default is black\n"
 		" -d <float>           : Percent explode.\n"
 		"                        Values must between 0 and 1. default is 0.1\n"
+		" -D <integer>         : APNG, delay of a frame in ms. Default is 100\n"
 		" -e <float>           : Percent extrusion (pie height).\n"
 		"                        Values must between 0 and 1. Default is 0.4\n"
-		" -f <EPS|PNG|PDF|SVG> : Choose output format. Default is PNG\n"
+		" -f <format>          : Choose output format: EPS, PNG, PNG8, APNG,\n"
+		"                        PDF, PS, SVG, RAW, PPM, PAM, QOI, GEOM,\n"
+		"                        GEOMBIN or RING. Default is PNG. PNG8 is a\n"
+		"                        PNG with at most 256 colours. APNG is an\n"
+		"                        animation, one frame per chart of the input\n"
+		"                        file, the frames are drawn in parallel with\n"
+		"                        -j. GEOM and GEOMBIN are the layout and the\n"
+		"                        painter order of the faces, as JSON or\n"
+		"                        binary, for a client which draws the chart\n"
+		"                        itself.\n"
+		"                        RAW is the native endian premultiplied\n"
+		"                        ARGB32 pixels without header. PPM has no\n"
+		"                        alpha, use -b. RING is the RAW pixels of\n"
+		"                        each chart in a ring of frames of the\n"
+		"                        output file, which the reader maps: use a\n"
+		"                        file of /dev/shm. The frames have sequence\n"
+		"                        numbers, see pie.h\n"
+		" -F <filter>          : PNG filter: none, sub, up, avg, paeth or\n"
+		"                        adaptive. Default is adaptive\n"
+		" -g <integer>         : Grid mode. Draw all the charts of the input\n"
+		"                        file on one sheet, <integer> charts per row.\n"
+		"                        -w and -h are the size of one chart\n"
 		" -h <integer>         : Height in pixel. Default is equal than -w. If\n"
 		"                        -h is not defined, is 400px\n"
+		" -H <file>            : Write the HTML image map <map name=\"pie\"> of\n"
+		"                        the chart, one area per visible face,\n"
+		"                        legend line and label\n"
 		" -i <file>            : Input data file\n"
+		" -I <float>           : Window mode, time between two charts in\n"
+		"                        seconds. Default is 1\n"
+	);
+	printf(
+		" -j <integer>         : Threads used for the PNG compression.\n"
+		"                        Default is 1\n"
+		" -k <dir>             : Render cache directory. A chart already\n"
+		"                        drawn with the same data and options is\n"
+		"                        copied from the cache\n"
+		" -K <integer>         : Cache size in MB, the least recently used\n"
+		"                        charts are removed. Default is 64\n"
 		" -l <hex>             : Legend color (ex: #ffffff). Default is black\n"
-		" -L <float>           : Legend size in px. Default is 10px\n"
+		" -L <float>           : Legend size in px. Default is 10px. The\n"
+		"                        legend takes at most half of the height, in\n"
+		"                        columns. The lines which don't fit are\n"
+		"                        replaced by a '+N more' line, the largest\n"
+		"                        slices are kept\n"
 		" -m <float>           : Margin in pixel. Deafult is 10px\n"
+		" -n <labels>          : Slice names beside the pie: outside or\n"
+		"                        inside. outside puts them in a column on\n"
+		"                        each side with a leader line, the largest\n"
+		"                        slices are kept if they don't fit. inside\n"
+		"                        writes a name on its slice when it fits in.\n"
+		"                        The font is the one of the legend\n"
 		" -o <file>            : Output file name. '-' is stdout\n"
+	);
+	printf(
+		" -p <integer>         : Legend page, when the legend doesn't show\n"
+		"                        all the slices: the next largest slices.\n"
+		"                        Default is 0\n"
+		" -P                   : Report mode. Draw all the charts of the\n"
+		"                        input file as pages of one PDF or PS file\n"
+		" -q <quality>         : fast, default or best. fast draws the\n"
+		"                        arcs with less points, without gradient\n"
+		"                        and with a fast antialiasing, best with\n"
+		"                        more points and the best antialiasing\n"
 		" -r <float>           : Ratio between height and width of pie.\n"
 		"                        Values must between 0 and 1. default is 0.5\n"
+		" -R                   : Legend on the right of the pie, in one\n"
+		"                        column\n"
 		" -s <size>            : Title size in px. Default is 15px\n"
+		" -S <format>          : Surface of the raster formats: ARGB32,\n"
+		"                        RGB24, RGB16_565 or A8. Default is ARGB32.\n"
+		"                        RGB24 and RGB16_565 are opaque, use -b.\n"
+		"                        A8 is a gray mask of the chart. PNG8\n"
+		"                        always uses ARGB32, APNG only takes\n"
+		"                        ARGB32\n"
 		" -t <title>           : Graph title. Default is empty\n"
 		" -T <hex>             : Title color (ex: #ffffff). Default is black\n"
 		" -w <float>           : Width in pixel. Default is equal than -h. If\n"
 		"                        -h is not defined, is 400px\n"
+		" -W <float>           : Window mode. The input lines are events\n"
+		"                        '<time> <value>', the time in seconds. At\n"
+		"                        each tick, the chart of the last <float>\n"
+		"                        seconds replaces the output if it changed,\n"
+		"                        or is added to the grid, the report or the\n"
+		"                        APNG drawn at the end of the input. The\n"
+		"                        ticks while the window stays empty are\n"
+		"                        skipped\n"
+		" -Y <file>            : Style file, lines '<key> <value>': width,\n"
+		"                        height, margin, background, line-width,\n"
+		"                        line-color, explode, extrusion, ratio,\n"
+		"                        title, title-size, title-color, legend\n"
+		"                        (none, under or right), legend-size,\n"
+		"                        legend-color, labels (none, outside or\n"
+		"                        inside) and quality. The options override\n"
+		"                        it\n"
+		" -z <level>           : PNG compression level, from 0 (fast) to 9\n"
+		"                        (small). Default is 6\n"
+		" --stats[=json]       : Print on stderr the time of each phase and\n"
+		"                        the counters of the drawing, as text or\n"
+		"                        JSON\n"
+		" --watch              : Draw again on each change of the input\n"
+		"                        file, only the appended lines are read if\n"
+		"                        possible. The output is replaced\n"
+		"                        atomically\n"
 		"\n"
 		"Values format is: value<float>#color<hex>:ratio_explode<float>:name\n"
+		"The color is rrggbb, or rrggbbaa with an alpha\n"
+		"\n"
+		"In the input file, a line '@title' starts a new chart with the same\n"
+		"options. The command line values go in the first chart.\n"
 		"\n"
 		"Exemple:\n"
 		"  pie -f PNG -w 400 -h 400 -o toto.png -l '#000000' -L 10 -t 'the title' \\\n"
@@ -65,6 +177,37 @@ void usage() {
 	exit(0);
 }
 
+static const char *phase_names[PIE_PHASES] = {
+	"parse", "measure", "layout", "sort", "paint", "encode"
+};
+
+static void print_stats(int json)
+{
+	const struct pie_stats *st;
+	int i;
+
+	st = pie_get_stats();
+
+	if (json) {
+		fprintf(stderr, "{\"ns\":{");
+		for (i=0; i<PIE_PHASES; i++)
+			fprintf(stderr, "%s\"%s\":%llu", i > 0 ? "," : "",
+			        phase_names[i], st->ns[i]);
+		fprintf(stderr, "},\"charts\":%llu,\"slices\":%llu,\"segments\":%llu,"
+		        "\"bytes\":%llu,\"allocs\":%llu}\n", st->charts, st->slices,
+		        st->segments, st->bytes, st->allocs);
+		return;
+	}
+
+	for (i=0; i<PIE_PHASES; i++)
+		fprintf(stderr, "%-10s %10.3f ms\n", phase_names[i], st->ns[i] / 1e6);
+	fprintf(stderr, "%-10s %10llu\n", "charts", st->charts);
+	fprintf(stderr, "%-10s %10llu\n", "slices", st->slices);
+	fprintf(stderr, "%-10s %10llu\n", "segments", st->segments);
+	fprintf(stderr, "%-10s %10llu\n", "bytes", st->bytes);
+	fprintf(stderr, "%-10s %10llu\n", "allocs", st->allocs);
+}
+
 static inline void get_one(int *nb, int argc)
 {
 	(*nb)++;
@@ -74,17 +217,15 @@ static inline void get_one(int *nb, int argc)
 	}
 }
 
-static inline void add_data(char *in, struct conf *co)
+/* <color> holds 9 chars: rrggbb or rrggbbaa */
+static inline void parse_data(char *in, double *value, char *color,
+                              double *extrude, char **name)
 {
-	double value;
-	double extrude;
-	char color[7];
-	char *name;
 	char *p;
 	int i;
 
 	/* first part: part of pie */
-	value = strtod(in, &p);
+	*value = strtod(in, &p);
 	if (*p != '#') {
 		fprintf(stderr, "invalid entry: bad value: \"%s\"\n", in);
 		exit(1);
@@ -92,7 +233,7 @@ static inline void add_data(char *in, struct conf *co)
 
 	/* color */
 	p++;
-	for(i=0; i<6; i++) {
+	for(i=0; i<8 && *p != ':'; i++) {
 		if ( ! (
 		          (*p >= 'a' && *p <= 'f') ||
 		          (*p >= 'A' && *p <= 'F') ||
@@ -105,16 +246,21 @@ static inline void add_data(char *in, struct conf *co)
 		color[i] = *p;
 		p++;
 	}
+	if (i != 6 && i != 8) {
+		fprintf(stderr, "invalid entry: bad color: \"%s\"\n", in);
+		exit(1);
+	}
 	if (*p != ':') {
 		fprintf(stderr, "invalid entry: bad format: \"%s\"\n", in);
 		exit(1);
 	}
-	color[6] = '\0';
+	color[i] = '\0';
 
 	/* extrude */
 	p++;
+	*extrude = 0;
 	if (*p != ':') {
-		extrude = strtod(p, &p);
+		*extrude = strtod(p, &p);
 		if (*p != ':') {
 			fprintf(stderr, "invalid entry: bad value: \"%s\"\n", in);
 			exit(1);
@@ -123,33 +269,48 @@ static inline void add_data(char *in, struct conf *co)
 
 	/* comment */
 	p++;
-	name = p;
+	*name = p;
+}
 
-	/* add */
+static inline void add_data(char *in, struct conf *co)
+{
+	double value;
+	double extrude;
+	char color[9];
+	char *name;
+
+	parse_data(in, &value, color, &extrude, &name);
 	pie_add(co, value, color, extrude, name);
 }
 
+/* all the charts, the first one gets the command line values */
+static struct conf **charts = NULL;
+static int nb_charts = 0;
+
+static inline struct conf *add_chart(struct conf *co)
+{
+	charts = realloc(charts, (nb_charts + 1) * sizeof(struct conf *));
+	if (charts == NULL) {
+		fprintf(stderr, "Memory error\n");
+		exit(1);
+	}
+	charts[nb_charts++] = co;
+	return co;
+}
+
 #define DLEN 128
 
-static inline void load_data(char *fn, struct conf *co)
+/* Read the lines of <f>, the values go in <co> or in the charts
+ * started by the '@' lines. Returns the chart of the last values. If
+ * <whole> is 0, a last line without end of line is left unread: it is
+ * still being written.
+ */
+static struct conf *load_stream(FILE *f, struct conf *co, int whole)
 {
-	FILE *f;
 	char b[DLEN];
 	char *start;
 	char *p;
-
-	/* if stdin */
-	if (strcmp(fn, "-") == 0)
-		f = stdin;
-
-	/* open file */
-	else {
-		f = fopen(fn, "r");
-		if (f == NULL) {
-			fprintf(stderr, "can't open input data file\n");
-			exit(1);
-		}
-	}
+	long pos;
 
 	while (1) {
 
@@ -158,7 +319,12 @@ static inline void load_data(char *fn, struct conf *co)
 
 		/* read line */
 		memset(b, 0, DLEN);
+		pos = ftell(f);
 		fgets(b, DLEN, f);
+		if (!whole && feof(f) && b[0] != '\0' && strchr(b, '\n') == NULL) {
+			fseek(f, pos, SEEK_SET);
+			break;
+		}
 
 		/* strip start spaces */
 		start = b;
@@ -182,29 +348,495 @@ static inline void load_data(char *fn, struct conf *co)
 		if (*start == '\0')
 			continue;
 
+		/* new chart */
+		if (*start == '@') {
+			co = add_chart(pie_new_from(charts[0]));
+			if (co == NULL) {
+				fprintf(stderr, "Memory error\n");
+				exit(1);
+			}
+			if (start[1] != '\0')
+				pie_set_title(co, start + 1);
+			continue;
+		}
+
 		/* load data */
 		add_data(start, co);
 	}
 
+	return co;
+}
+
+static inline void load_data(char *fn, struct conf *co)
+{
+	FILE *f;
+
+	/* if stdin */
+	if (strcmp(fn, "-") == 0)
+		f = stdin;
+
+	/* open file */
+	else {
+		f = fopen(fn, "r");
+		if (f == NULL) {
+			fprintf(stderr, "can't open input data file\n");
+			exit(1);
+		}
+	}
+
+	load_stream(f, co, 1);
 	fclose(f);
 }
 
+/* Watch mode. The input is read again on each change: only the new
+ * lines if the file grew and still ends with the bytes read last time,
+ * else from the start.
+ */
+#define WATCH_TAIL 64
+
+struct watch {
+	char *fn;
+	struct conf *model; /* options of the command line */
+	char **vals; /* values of the command line */
+	int nvals;
+
+	struct conf *cur; /* chart of the last values */
+	ino_t ino;
+	long off; /* end of the last line read */
+	unsigned char tail[WATCH_TAIL]; /* bytes before <off> */
+	int ntail;
+};
+
+static void watch_tail(struct watch *w, FILE *f)
+{
+	w->off = ftell(f);
+	w->ntail = w->off < WATCH_TAIL ? w->off : WATCH_TAIL;
+	fseek(f, w->off - w->ntail, SEEK_SET);
+	if (fread(w->tail, 1, w->ntail, f) != (size_t)w->ntail)
+		w->ntail = -1;
+}
+
+/* Returns 0 if the file didn't change */
+static int watch_load(struct watch *w)
+{
+	unsigned char tail[WATCH_TAIL];
+	struct stat st;
+	FILE *f;
+	long off;
+	int i;
+
+	f = fopen(w->fn, "r");
+	if (f == NULL) {
+		fprintf(stderr, "can't open input data file\n");
+		return 0;
+	}
+	fstat(fileno(f), &st);
+
+	/* appended lines */
+	if (w->cur != NULL && st.st_ino == w->ino && st.st_size >= w->off &&
+	    w->ntail >= 0 && fseek(f, w->off - w->ntail, SEEK_SET) == 0 &&
+	    fread(tail, 1, w->ntail, f) == (size_t)w->ntail &&
+	    memcmp(tail, w->tail, w->ntail) == 0) {
+		if (st.st_size == w->off) {
+			fclose(f);
+			return 0;
+		}
+		off = w->off;
+		w->cur = load_stream(f, w->cur, 0);
+		watch_tail(w, f);
+		fclose(f);
+		return w->off != off;
+	}
+
+	/* from the start, with the command line values */
+	for (i=0; i<nb_charts; i++)
+		pie_free(charts[i]);
+	nb_charts = 0;
+	w->cur = add_chart(pie_new_from(w->model));
+	if (w->cur == NULL) {
+		fprintf(stderr, "Memory error\n");
+		exit(1);
+	}
+	for (i=0; i<w->nvals; i++)
+		add_data(w->vals[i], w->cur);
+
+	rewind(f);
+	w->ino = st.st_ino;
+	w->cur = load_stream(f, w->cur, 0);
+	watch_tail(w, f);
+	fclose(f);
+	return 1;
+}
+
+/* output options */
+struct output {
+	int mode;
+	int grid;
+	int report;
+	int band;
+	int tween;
+	int delay;
+	int argb; /* the -S surface is ARGB32 */
+	char *map; /* HTML image map, or NULL */
+	char *file;
+	int stats;
+	struct pie_ring *ring; /* opened on the first draw */
+};
+
+/* each chart is a frame of the ring, the slots are sized for the
+ * largest chart of the first draw
+ */
+static void draw_ring(struct output *o, const char *file_out)
+{
+	size_t room = 0;
+	int i;
+
+	if (o->ring == NULL) {
+		for (i=0; i<nb_charts; i++)
+			if (room < pie_raw_size(charts[i]))
+				room = pie_raw_size(charts[i]);
+		o->ring = pie_ring_open(file_out, PIE_RING_SLOTS, room);
+		if (o->ring == NULL)
+			exit(1);
+	}
+	for (i=0; i<nb_charts; i++)
+		pie_draw_ring(charts[i], o->ring);
+}
+
+static void draw(struct output *o, const char *file_out)
+{
+	if (o->map != NULL && ( o->grid > 0 || o->report || o->mode == PIE_APNG ||
+	                        nb_charts > 1 )) {
+		fprintf(stderr, "image map needs one chart\n");
+		exit(1);
+	}
+
+	/* create image */
+	if (o->band != 0 && ( o->mode != PIE_PNG || o->grid > 0 || o->report )) {
+		fprintf(stderr, "band mode needs one PNG chart\n");
+		exit(1);
+	}
+
+	else if (o->grid > 0 && o->report) {
+		fprintf(stderr, "grid and report modes are exclusive\n");
+		exit(1);
+	}
+
+	else if (( o->mode == PIE_GEOM || o->mode == PIE_GEOM_BIN ) &&
+	         ( o->grid > 0 || o->report )) {
+		fprintf(stderr, "GEOM can't be used with the grid or report mode\n");
+		exit(1);
+	}
+
+	else if (o->mode == PIE_RING) {
+		if (o->grid > 0 || o->report) {
+			fprintf(stderr, "RING can't be used with the grid or report mode\n");
+			exit(1);
+		}
+		draw_ring(o, file_out);
+	}
+
+	else if (o->mode == PIE_APNG) {
+		if (o->grid > 0 || o->report) {
+			fprintf(stderr, "APNG can't be used with the grid or report mode\n");
+			exit(1);
+		}
+		if (!o->argb) {
+			fprintf(stderr, "APNG frames need the ARGB32 surface\n");
+			exit(1);
+		}
+		pie_draw_anim(charts, nb_charts, o->tween, o->delay, file_out);
+	}
+
+	else if (o->grid > 0)
+		pie_draw_grid(charts, nb_charts, o->grid, o->mode, file_out);
+
+	else if (o->report)
+		pie_draw_report(charts, nb_charts, o->mode, file_out);
+
+	else if (nb_charts > 1) {
+		fprintf(stderr, "multiple charts need the grid or report mode\n");
+		exit(1);
+	}
+
+	else {
+		pie_draw(charts[0], o->mode, file_out);
+		if (o->map != NULL)
+			pie_draw_map(charts[0], "pie", o->map);
+	}
+}
+
+/* the readers of the output see the old image or the new one */
+static void draw_atomic(struct output *o)
+{
+	char tmp[4096];
+
+	/* the ring has its own sequence numbers */
+	if (o->mode == PIE_RING) {
+		draw(o, o->file);
+		return;
+	}
+
+	snprintf(tmp, sizeof(tmp), "%s.%d.tmp", o->file, (int)getpid());
+	draw(o, tmp);
+	if (rename(tmp, o->file) != 0) {
+		fprintf(stderr, "can't rename %s\n", tmp);
+		unlink(tmp);
+	}
+}
+
+/* time to wait for the end of a burst of writes, in ms */
+#define WATCH_DELAY 50
+
+/* The directory of the input is watched rather than the file: the
+ * editors often write a new file and rename it.
+ */
+static void watch_loop(struct watch *w, struct output *o)
+{
+	char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+	const struct inotify_event *ev;
+	struct pollfd pfd;
+	char dir[4096];
+	const char *base;
+	char *p;
+	unsigned long long t;
+	ssize_t len;
+	int changed;
+	int fd;
+
+	snprintf(dir, sizeof(dir), "%s", w->fn);
+	p = strrchr(dir, '/');
+	if (p == NULL) {
+		strcpy(dir, ".");
+		base = w->fn;
+	}
+	else {
+		base = w->fn + ( p - dir ) + 1;
+		if (p == dir)
+			p++;
+		*p = '\0';
+	}
+
+	fd = inotify_init1(IN_CLOEXEC);
+	if (fd < 0 || inotify_add_watch(fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO |
+	                                IN_MODIFY | IN_CREATE) < 0) {
+		fprintf(stderr, "can't watch %s\n", dir);
+		exit(1);
+	}
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+
+	while (1) {
+		len = read(fd, buf, sizeof(buf));
+		if (len <= 0) {
+			fprintf(stderr, "can't watch %s\n", dir);
+			exit(1);
+		}
+
+		changed = 0;
+		for (p=buf; p<buf+len; p+=sizeof(struct inotify_event)+ev->len) {
+			ev = (const struct inotify_event *)p;
+			if (ev->len > 0 && strcmp(ev->name, base) == 0)
+				changed = 1;
+		}
+		if (!changed)
+			continue;
+
+		/* the file is often written in several times */
+		while (poll(&pfd, 1, WATCH_DELAY) > 0)
+			if (read(fd, buf, sizeof(buf)) <= 0)
+				break;
+
+		if (o->stats >= 0)
+			pie_stats_reset();
+		t = pie_stats_clock();
+		if (!watch_load(w))
+			continue;
+		if (o->stats >= 0)
+			pie_stats_phase(PIE_PHASE_PARSE, t);
+
+		draw_atomic(o);
+
+		if (o->stats >= 0)
+			print_stats(o->stats);
+	}
+}
+
+/* Window mode. The input lines are events '<time> <value>', the time
+ * in seconds. At each tick, the chart of the last <span> seconds is
+ * added to the series drawn at the end (grid, report or APNG), or
+ * replaces the output if it changed.
+ */
+struct series {
+	struct pie_window *win;
+	struct output *o;
+	double tick;
+	double next; /* time of the next tick, -1 before the first event */
+	int changed; /* events added or expired since the last chart */
+	int keep; /* the charts go in the series */
+	unsigned long long t;
+};
+
+static void series_tick(struct series *se)
+{
+	struct conf *co;
+
+	if (pie_window_expire(se->win, se->next) > 0)
+		se->changed = 1;
+
+	if (se->changed || se->keep) {
+		co = pie_window_chart(se->win);
+		if (co == NULL) {
+			fprintf(stderr, "Memory error\n");
+			exit(1);
+		}
+		add_chart(co);
+
+		if (!se->keep) {
+			if (se->o->stats >= 0)
+				pie_stats_phase(PIE_PHASE_PARSE, se->t);
+			draw_atomic(se->o);
+			if (se->o->stats >= 0) {
+				print_stats(se->o->stats);
+				pie_stats_reset();
+			}
+			pie_free(co);
+			nb_charts = 0;
+			se->t = pie_stats_clock();
+		}
+	}
+
+	se->changed = 0;
+	se->next += se->tick;
+}
+
+static void series_stream(FILE *f, struct series *se)
+{
+	char b[DLEN];
+	char color[9];
+	char *start;
+	char *name;
+	char *p;
+	double value;
+	double extrude;
+	double t;
+
+	while (fgets(b, DLEN, f) != NULL) {
+
+		/* strip spaces and comments */
+		start = b;
+		while (*start == ' ' || *start == '\t')
+			start++;
+		if (*start == '#')
+			continue;
+		p = start + strlen(start);
+		while (p > start && ( p[-1] == '\n' || p[-1] == '\r' ||
+		                      p[-1] == ' ' || p[-1] == '\t' ))
+			p--;
+		*p = '\0';
+		if (*start == '\0')
+			continue;
+
+		/* time */
+		t = strtod(start, &p);
+		if (p == start || ( *p != ' ' && *p != '\t' )) {
+			fprintf(stderr, "invalid event: bad time: \"%s\"\n", start);
+			exit(1);
+		}
+		while (*p == ' ' || *p == '\t')
+			p++;
+		parse_data(p, &value, color, &extrude, &name);
+
+		/* the ticks passed before this event */
+		if (se->next < 0)
+			se->next = ( floor(t / se->tick) + 1 ) * se->tick;
+		while (t >= se->next) {
+			series_tick(se);
+			/* once the window is empty, the ticks until this event
+			 * would all be the same empty chart
+			 */
+			if (t >= se->next && pie_window_events(se->win) == 0)
+				se->next = ( floor(t / se->tick) + 1 ) * se->tick;
+		}
+
+		pie_window_add(se->win, t, value, color, extrude, name);
+		se->changed = 1;
+	}
+
+	/* the last tick, with the end of the stream */
+	if (se->next >= 0)
+		series_tick(se);
+}
+
 int main(int argc, char *argv[])
 {
 	struct conf *co;
 	int nb;
 	char *f_in = NULL;
 	double ratio;
-	int mode;
-	char *file_out;
+	int mode = PIE_PNG;
+	char *file_out = NULL;
 	int img_w;
 	int img_h;
+	int grid = 0;
+	int report = 0;
+	int legend = 0;
+	int band = 0;
+	int tween = 0;
+	int delay = PIE_DELAY;
+	int argb = 1;
+	int stats = -1;
+	int watch = 0;
+	double span = 0;
+	double tick = 1;
+	struct watch w;
+	struct series se;
+	FILE *f;
+	struct output o;
+	char *cache_dir = NULL;
+	char *map = NULL;
+	struct pie_style *style = NULL;
+	long long cache_max = PIE_CACHE_SIZE;
+	unsigned long long t;
 
-	co = pie_new();
+	/* the stats are enabled before any allocation, the style is loaded
+	 * before the options which override it
+	 */
+	for (nb=1; nb<argc; nb++) {
+		if (strcmp(argv[nb], "--") == 0)
+			break;
+		if (strcmp(argv[nb], "--stats") == 0)
+			stats = 0;
+		else if (strcmp(argv[nb], "--stats=json") == 0)
+			stats = 1;
+	}
+	if (stats >= 0)
+		pie_stats_enable(1);
+	t = pie_stats_clock();
+
+	for (nb=1; nb<argc-1; nb++) {
+		if (strcmp(argv[nb], "--") == 0)
+			break;
+		if (strcmp(argv[nb], "-Y") == 0) {
+			if (style != NULL)
+				pie_style_free(style);
+			style = pie_style_load(argv[++nb]);
+			if (style == NULL)
+				exit(1);
+		}
+	}
+
+	if (style != NULL) {
+		co = pie_new_style(style);
+		pie_style_free(style);
+	}
+	else
+		co = pie_new();
 	if (co == NULL) {
 		fprintf(stderr, "Memory error\n");
 		exit(1);
 	}
+	add_chart(co);
 
 	if (argc == 1)
 		usage();
@@ -216,6 +848,21 @@ int main(int argc, char *argv[])
 		if (argv[nb][0] != '-')
 			goto parsing_end;
 
+		/* watch mode */
+		if (strcmp(argv[nb], "--watch") == 0) {
+			watch = 1;
+			continue;
+		}
+
+		/* already read */
+		if (strncmp(argv[nb], "--stats", 7) == 0) {
+			if (stats < 0) {
+				fprintf(stderr, "unknown option %s\n", argv[nb]);
+				exit(1);
+			}
+			continue;
+		}
+
 		switch (argv[nb][1]) {
 
 		/* fini */
@@ -224,6 +871,16 @@ int main(int argc, char *argv[])
 			goto parsing_end;
 			break;
 
+		/* APNG interpolated frames */
+		case 'a':
+			get_one(&nb, argc);
+			tween = atoi(argv[nb]);
+			if (tween < 0) {
+				fprintf(stderr, "interpolated frames must be >= 0\n");
+				exit(1);
+			}
+			break;
+
 		/* background color */
 		case 'b':
 			get_one(&nb, argc);
@@ -231,6 +888,17 @@ int main(int argc, char *argv[])
 			pie_set_back_color(co, argv[nb]);
 			break;
 
+		/* band mode */
+		case 'B':
+			get_one(&nb, argc);
+			if (atoi(argv[nb]) < 0) {
+				fprintf(stderr, "band lines must be >= 0\n");
+				exit(1);
+			}
+			band = atoi(argv[nb]) == 0 ? PIE_BAND_AUTO : atoi(argv[nb]);
+			pie_set_band(co, band);
+			break;
+
 		/* line width */
 		case 'c':
 			get_one(&nb, argc);
@@ -249,6 +917,17 @@ int main(int argc, char *argv[])
 			pie_set_decal(co, atof(argv[nb]));
 			break;
 
+		/* APNG frame delay */
+		case 'D':
+			get_one(&nb, argc);
+			delay = atoi(argv[nb]);
+			if (delay < 0 || delay > PIE_DELAY_MAX) {
+				fprintf(stderr, "delay must be between 0 and %d\n",
+				        PIE_DELAY_MAX);
+				exit(1);
+			}
+			break;
+
 		/* decal */
 		case 'e':
 			get_one(&nb, argc);
@@ -259,19 +938,76 @@ int main(int argc, char *argv[])
 		case 'f':
 			get_one(&nb, argc);
 			/**/ if (strcmp(argv[nb], "PNG") == 0)
-				mode = 1;
+				mode = PIE_PNG;
+			else if (strcmp(argv[nb], "PNG8") == 0)
+				mode = PIE_PNG8;
+			else if (strcmp(argv[nb], "APNG") == 0)
+				mode = PIE_APNG;
+			else if (strcmp(argv[nb], "GEOM") == 0)
+				mode = PIE_GEOM;
+			else if (strcmp(argv[nb], "GEOMBIN") == 0)
+				mode = PIE_GEOM_BIN;
+			else if (strcmp(argv[nb], "RING") == 0)
+				mode = PIE_RING;
 			else if (strcmp(argv[nb], "EPS") == 0)
-				mode = 2;
+				mode = PIE_EPS;
 			else if (strcmp(argv[nb], "SVG") == 0)
-				mode = 3;
+				mode = PIE_SVG;
 			else if (strcmp(argv[nb], "PDF") == 0)
-				mode = 4;
+				mode = PIE_PDF;
+			else if (strcmp(argv[nb], "PS") == 0)
+				mode = PIE_PS;
+			else if (strcmp(argv[nb], "RAW") == 0)
+				mode = PIE_RAW;
+			else if (strcmp(argv[nb], "PPM") == 0)
+				mode = PIE_PPM;
+			else if (strcmp(argv[nb], "PAM") == 0)
+				mode = PIE_PAM;
+			else if (strcmp(argv[nb], "QOI") == 0)
+				mode = PIE_QOI;
 			else {
 				fprintf(stderr, "unknown format %s\n", argv[nb]);
 				exit(1);
 			}
 			break;
 
+		/* PNG filter */
+		case 'F':
+			get_one(&nb, argc);
+			/**/ if (strcmp(argv[nb], "none") == 0)
+				pie_set_filter(co, PIE_FILTER_NONE);
+			else if (strcmp(argv[nb], "sub") == 0)
+				pie_set_filter(co, PIE_FILTER_SUB);
+			else if (strcmp(argv[nb], "up") == 0)
+				pie_set_filter(co, PIE_FILTER_UP);
+			else if (strcmp(argv[nb], "avg") == 0)
+				pie_set_filter(co, PIE_FILTER_AVG);
+			else if (strcmp(argv[nb], "paeth") == 0)
+				pie_set_filter(co, PIE_FILTER_PAETH);
+			else if (strcmp(argv[nb], "adaptive") == 0)
+				pie_set_filter(co, PIE_FILTER_ADAPTIVE);
+			else {
+				fprintf(stderr, "unknown filter %s\n", argv[nb]);
+				exit(1);
+			}
+			break;
+
+		/* grid */
+		case 'g':
+			get_one(&nb, argc);
+			grid = atoi(argv[nb]);
+			if (grid < 1) {
+				fprintf(stderr, "grid must be >= 1\n");
+				exit(1);
+			}
+			break;
+
+		/* image map */
+		case 'H':
+			get_one(&nb, argc);
+			map = argv[nb];
+			break;
+
 		/* height */
 		case 'h':
 			get_one(&nb, argc);
@@ -285,17 +1021,57 @@ int main(int argc, char *argv[])
 			f_in = argv[nb];
 			break;
 
+		/* window mode tick */
+		case 'I':
+			get_one(&nb, argc);
+			tick = atof(argv[nb]);
+			if (tick <= 0) {
+				fprintf(stderr, "tick must be > 0\n");
+				exit(1);
+			}
+			break;
+
+		/* threads */
+		case 'j':
+			get_one(&nb, argc);
+			if (atoi(argv[nb]) < 1) {
+				fprintf(stderr, "threads must be >= 1\n");
+				exit(1);
+			}
+			pie_set_threads(co, atoi(argv[nb]));
+			break;
+
+		/* cache directory */
+		case 'k':
+			get_one(&nb, argc);
+			cache_dir = argv[nb];
+			break;
+
+		/* cache size */
+		case 'K':
+			get_one(&nb, argc);
+			if (atoi(argv[nb]) < 1) {
+				fprintf(stderr, "cache size must be >= 1\n");
+				exit(1);
+			}
+			cache_max = atoll(argv[nb]) * 1024 * 1024;
+			break;
+
 		/* legend color */
 		case 'l':
 			get_one(&nb, argc);
-			pie_set_do_legend(co, 1);
+			if (legend == 0)
+				legend = 1;
+			pie_set_do_legend(co, legend);
 			pie_set_legend_color(co, argv[nb]);
 			break;
 
 		/* legend size */
 		case 'L':
 			get_one(&nb, argc);
-			pie_set_do_legend(co, 1);
+			if (legend == 0)
+				legend = 1;
+			pie_set_do_legend(co, legend);
 			pie_set_legend_size(co, atof(argv[nb]));
 			break;
 
@@ -305,12 +1081,55 @@ int main(int argc, char *argv[])
 			pie_set_margin(co, atof(argv[nb]));
 			break;
 
+		/* slice labels */
+		case 'n':
+			get_one(&nb, argc);
+			/**/ if (strcmp(argv[nb], "outside") == 0)
+				pie_set_do_labels(co, PIE_LABELS_OUTSIDE);
+			else if (strcmp(argv[nb], "inside") == 0)
+				pie_set_do_labels(co, PIE_LABELS_INSIDE);
+			else {
+				fprintf(stderr, "unknown labels %s\n", argv[nb]);
+				exit(1);
+			}
+			break;
+
 		/* output */
 		case 'o':
 			get_one(&nb, argc);
 			file_out = argv[nb];
 			break;
 
+		/* legend page */
+		case 'p':
+			get_one(&nb, argc);
+			if (atoi(argv[nb]) < 0) {
+				fprintf(stderr, "legend page must be >= 0\n");
+				exit(1);
+			}
+			pie_set_legend_page(co, atoi(argv[nb]));
+			break;
+
+		/* report */
+		case 'P':
+			report = 1;
+			break;
+
+		/* quality */
+		case 'q':
+			get_one(&nb, argc);
+			/**/ if (strcmp(argv[nb], "fast") == 0)
+				pie_set_quality(co, PIE_QUALITY_FAST);
+			else if (strcmp(argv[nb], "default") == 0)
+				pie_set_quality(co, PIE_QUALITY_DEFAULT);
+			else if (strcmp(argv[nb], "best") == 0)
+				pie_set_quality(co, PIE_QUALITY_BEST);
+			else {
+				fprintf(stderr, "unknown quality %s\n", argv[nb]);
+				exit(1);
+			}
+			break;
+
 		/* ratio */
 		case 'r':
 			get_one(&nb, argc);
@@ -322,12 +1141,41 @@ int main(int argc, char *argv[])
 			pie_set_ratio(co, ratio);
 			break;
 
+		/* style, already loaded */
+		case 'Y':
+			get_one(&nb, argc);
+			break;
+
+		/* legend on the right */
+		case 'R':
+			legend = 2;
+			pie_set_do_legend(co, legend);
+			break;
+
 		/* title size */
 		case 's':
 			get_one(&nb, argc);
 			pie_set_title_size(co, atoi(argv[nb]));
 			break;
 
+		/* surface format */
+		case 'S':
+			get_one(&nb, argc);
+			argb = strcmp(argv[nb], "ARGB32") == 0;
+			/**/ if (strcmp(argv[nb], "ARGB32") == 0)
+				pie_set_format(co, CAIRO_FORMAT_ARGB32);
+			else if (strcmp(argv[nb], "RGB24") == 0)
+				pie_set_format(co, CAIRO_FORMAT_RGB24);
+			else if (strcmp(argv[nb], "RGB16_565") == 0)
+				pie_set_format(co, CAIRO_FORMAT_RGB16_565);
+			else if (strcmp(argv[nb], "A8") == 0)
+				pie_set_format(co, CAIRO_FORMAT_A8);
+			else {
+				fprintf(stderr, "unknown surface format %s\n", argv[nb]);
+				exit(1);
+			}
+			break;
+
 		/* title */
 		case 't':
 			get_one(&nb, argc);
@@ -346,6 +1194,26 @@ int main(int argc, char *argv[])
 			img_w = atoi(argv[nb]);
 			pie_set_img_w(co, img_w);
 			break;
+
+		/* window mode */
+		case 'W':
+			get_one(&nb, argc);
+			span = atof(argv[nb]);
+			if (span <= 0) {
+				fprintf(stderr, "window must be > 0\n");
+				exit(1);
+			}
+			break;
+
+		/* compression level */
+		case 'z':
+			get_one(&nb, argc);
+			if (atoi(argv[nb]) < 0 || atoi(argv[nb]) > 9) {
+				fprintf(stderr, "compression level must be >= 0 and <= 9\n");
+				exit(1);
+			}
+			pie_set_compression(co, atoi(argv[nb]));
+			break;
 		}
 	}
 
@@ -357,6 +1225,101 @@ parsing_end:
 		exit(1);
 	}
 
+	if (watch && ( f_in == NULL || strcmp(f_in, "-") == 0 ||
+	               strcmp(file_out, "-") == 0 )) {
+		fprintf(stderr, "watch mode needs an input file and an output file\n");
+		exit(1);
+	}
+
+	if (cache_dir != NULL)
+		pie_set_cache(co, cache_dir, cache_max);
+
+	o.mode = mode;
+	o.grid = grid;
+	o.report = report;
+	o.band = band;
+	o.tween = tween;
+	o.delay = delay;
+	o.argb = argb;
+	o.map = map;
+	o.file = file_out;
+	o.stats = stats;
+	o.ring = NULL;
+
+	if (mode == PIE_RING && strcmp(file_out, "-") == 0) {
+		fprintf(stderr, "RING needs an output file\n");
+		exit(1);
+	}
+
+	if (span > 0) {
+		se.keep = grid > 0 || report || mode == PIE_APNG;
+		if (f_in == NULL || nb < argc || watch ||
+		    ( !se.keep && strcmp(file_out, "-") == 0 )) {
+			fprintf(stderr, "window mode needs an input file of events and no "
+			        "values, and an output file or the grid, report or APNG "
+			        "mode\n");
+			exit(1);
+		}
+
+		se.win = pie_window_new(co, span);
+		if (se.win == NULL) {
+			fprintf(stderr, "Memory error\n");
+			exit(1);
+		}
+		pie_free(co);
+		nb_charts = 0;
+		se.o = &o;
+		se.tick = tick;
+		se.next = -1;
+		se.changed = 0;
+		se.t = t;
+
+		if (strcmp(f_in, "-") == 0)
+			f = stdin;
+		else {
+			f = fopen(f_in, "r");
+			if (f == NULL) {
+				fprintf(stderr, "can't open input data file\n");
+				exit(1);
+			}
+		}
+		series_stream(f, &se);
+		fclose(f);
+		pie_window_free(se.win);
+
+		if (se.keep) {
+			if (nb_charts == 0) {
+				fprintf(stderr, "no event\n");
+				exit(1);
+			}
+			if (stats >= 0)
+				pie_stats_phase(PIE_PHASE_PARSE, se.t);
+			draw(&o, file_out);
+			if (stats >= 0)
+				print_stats(stats);
+		}
+		return 0;
+	}
+
+	if (watch) {
+		w.fn = f_in;
+		w.model = pie_new_from(co);
+		w.vals = &argv[nb];
+		w.nvals = argc - nb;
+		w.cur = NULL;
+		if (w.model == NULL) {
+			fprintf(stderr, "Memory error\n");
+			exit(1);
+		}
+		watch_load(&w);
+		if (stats >= 0)
+			pie_stats_phase(PIE_PHASE_PARSE, t);
+		draw_atomic(&o);
+		if (stats >= 0)
+			print_stats(stats);
+		watch_loop(&w, &o);
+	}
+
 	/* load data */
 	for (; nb<argc; nb++)
 		add_data(argv[nb], co);
@@ -364,9 +1327,13 @@ parsing_end:
 	/* load data from file */
 	if (f_in != NULL)
 		load_data(f_in, co);
+	if (stats >= 0)
+		pie_stats_phase(PIE_PHASE_PARSE, t);
 
-	/* create image */
-	pie_draw(co, mode, file_out);
+	draw(&o, file_out);
+
+	if (stats >= 0)
+		print_stats(stats);
 
 	return 0;
 }
@@ -7,6 +7,7 @@
  * 2 of the License.
  */
 #include <math.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -19,6 +20,11 @@
 
 #include "pie.h"
 #include "ellipse.h"
+#include "encode.h"
+#include "png.h"
+#include "stats.h"
+#include "cache.h"
+#include "ring.h"
 
 struct color {
 	double r;
@@ -61,6 +67,9 @@ struct conf {
 	char draw_leg;
 	double leg_size;
 	struct color leg_color;
+	int leg_page;
+
+	char draw_lab; /* PIE_LABELS_* */
 
 	/* data */
 	int nb;
@@ -72,6 +81,30 @@ struct conf {
 	/* output */
 	pie_write_cb cb;
 	void *arg;
+	int z_level;
+	int z_filter;
+	int threads;
+	int band;
+	cairo_format_t format;
+
+	/* quality */
+	int quality;
+	double arc_step;
+
+	/* render cache */
+	char *cache_dir;
+	long long cache_max;
+
+	/* style of the chart, its strings are shared until they are set */
+	struct pie_style *style;
+};
+
+/* An immutable set of options, the charts made from it share its
+ * strings. It is freed with its last chart.
+ */
+struct pie_style {
+	struct conf co; /* without data */
+	int ref;
 };
 
 struct coord {
@@ -99,16 +132,78 @@ struct portion {
 
 	double ca_strt;
 	double ca_stop;
+};
+
+/* The legend lines, only read to draw the legend: they are kept out of
+ * struct portion, which the sort and the culling go through.
+ */
+struct legend {
+	char *text;
+	cairo_text_extents_t exts;
+	int slice; /* -1 for the "+N more" line */
+	double x; /* top left of the line */
+	double y;
+};
+
+/* The legend lines are in columns of <rows> lines, from <x> <y>. A line
+ * is <dec> high, a column <w> wide with the gap before the next one.
+ */
+struct legend_box {
+	struct legend *line; /* NULL without legend */
+	int nb;
+	int rows;
+	double dec;
+	double w;
+	double x;
+	double y;
+};
+
+/* swatch of a legend line, in a square of <dec> */
+#define DECFAC 0.15f
+
+/* room for the text of the "+N more" line */
+#define LEG_MORE 32
+
+/* The name of a slice beside it, the leader line goes from <anchor> on
+ * the border of the top to <elbow> then <end>, or on the slice without
+ * leader line.
+ */
+struct label {
+	struct coord anchor;
+	struct coord elbow;
+	struct coord end;
+	double x; /* text origin */
+	double y;
+	double bx; /* box of the text */
+	double by;
+	double bw;
+	double bh;
+	int slice;
+	int inside;
+};
 
-	char *legend;
-	cairo_text_extents_t legend_exts;
+/* distance from a leader line of a point which hits it */
+#define LAB_HIT 1.0
+
+/* the labels, <dec> is the distance between two lines */
+struct label_box {
+	struct label *lab; /* NULL without labels */
+	int nb;
+	double dec;
+};
 
-	double tmp;
+/* sort key of a portion */
+struct sort_key {
+	double key;
+	int i;
 };
 
 static inline
 void convert_rgba_hex(char *hex, unsigned char alpha, struct color *out);
 
+/* font shared by all the charts, so cairo resolves it only once */
+static cairo_font_face_t *sans = NULL;
+
 struct conf *pie_new(void)
 {
 	struct conf *co;
@@ -116,6 +211,7 @@ struct conf *pie_new(void)
 	co = malloc(sizeof(struct conf));
 	if (co == NULL)
 		return NULL;
+	STATS_ADD(allocs, 1);
 
 	/* init cof */
 	co->out           = NULL;
@@ -132,6 +228,8 @@ struct conf *pie_new(void)
 	co->leg_color.g   = 0x00;
 	co->leg_color.b   = 0x00;
 	co->leg_color.a   = 0xff;
+	co->leg_page      = 0;
+	co->draw_lab      = PIE_LABELS_NONE;
 	co->title         = NULL;
 	co->title_size    = 15;
 	co->title_color.r = 0x00;
@@ -148,10 +246,148 @@ struct conf *pie_new(void)
 	co->extract       = NULL;
 	co->name          = NULL;
 	co->nb            = 0;
+	co->z_level       = 6;
+	co->z_filter      = PIE_FILTER_ADAPTIVE;
+	co->threads       = 1;
+	co->band          = 0;
+	co->format        = CAIRO_FORMAT_ARGB32;
+	co->quality       = PIE_QUALITY_DEFAULT;
+	co->cache_dir     = NULL;
+	co->cache_max     = PIE_CACHE_SIZE;
+	co->style         = NULL;
+
+	if (sans == NULL)
+		sans = cairo_toy_font_face_create("Sans", CAIRO_FONT_SLANT_NORMAL,
+		                                  CAIRO_FONT_WEIGHT_NORMAL);
+
+	return co;
+}
+
+/* true if the string <s> of <co> belongs to its style */
+static inline
+int style_shares(struct conf *co, char *s)
+{
+	return co->style != NULL && s != NULL &&
+	       ( s == co->style->co.title || s == co->style->co.cache_dir );
+}
+
+/* a copy of the string <s> of <model>, or the string itself if the
+ * style of <model> owns it
+ */
+static inline
+char *style_str(struct conf *model, char *s)
+{
+	char *d;
+
+	if (s == NULL || style_shares(model, s))
+		return s;
+	d = strdup(s);
+	if (d == NULL) {
+		fprintf(stderr, "Memory error\n");
+		exit(1);
+	}
+	STATS_ADD(allocs, 1);
+	return d;
+}
+
+/* new chart with the same options than <model>, but without data */
+struct conf *pie_new_from(struct conf *model)
+{
+	struct conf *co;
+
+	co = malloc(sizeof(struct conf));
+	if (co == NULL)
+		return NULL;
+	STATS_ADD(allocs, 1);
+
+	memcpy(co, model, sizeof(struct conf));
+	co->title = style_str(model, model->title);
+	co->cache_dir = style_str(model, model->cache_dir);
+	if (co->style != NULL)
+		__sync_fetch_and_add(&co->style->ref, 1);
+	co->part          = NULL;
+	co->color         = NULL;
+	co->extract       = NULL;
+	co->name          = NULL;
+	co->nb            = 0;
+
+	return co;
+}
+
+void pie_free(struct conf *co)
+{
+	int i;
+
+	for (i=0; i<co->nb; i++) {
+		free(co->color[i]);
+		free(co->name[i]);
+	}
+	free(co->part);
+	free(co->color);
+	free(co->extract);
+	free(co->name);
+	if (!style_shares(co, co->title))
+		free(co->title);
+	if (!style_shares(co, co->cache_dir))
+		free(co->cache_dir);
+	if (co->style != NULL)
+		pie_style_free(co->style);
+	free(co);
+}
+
+/* A style with the options of <co>, its data is not kept. The changes
+ * of <co> don't change the style.
+ */
+struct pie_style *pie_style_from(struct conf *co)
+{
+	struct pie_style *st;
+
+	st = malloc(sizeof(struct pie_style));
+	if (st == NULL)
+		return NULL;
+	STATS_ADD(allocs, 1);
+
+	memcpy(&st->co, co, sizeof(struct conf));
+	st->co.style = NULL;
+	st->co.title = style_str(&st->co, co->title);
+	st->co.cache_dir = style_str(&st->co, co->cache_dir);
+	st->co.part    = NULL;
+	st->co.color   = NULL;
+	st->co.extract = NULL;
+	st->co.name    = NULL;
+	st->co.nb      = 0;
+	st->ref = 1;
+	return st;
+}
+
+/* New chart of the style <st>: a copy of the options, the strings are
+ * shared until a setter replaces them.
+ */
+struct conf *pie_new_style(struct pie_style *st)
+{
+	struct conf *co;
+
+	co = malloc(sizeof(struct conf));
+	if (co == NULL)
+		return NULL;
+	STATS_ADD(allocs, 1);
 
+	memcpy(co, &st->co, sizeof(struct conf));
+	co->style = st;
+	__sync_fetch_and_add(&st->ref, 1);
 	return co;
 }
 
+/* Release <st>, it is freed with the last of its charts. */
+void pie_style_free(struct pie_style *st)
+{
+	if (__sync_sub_and_fetch(&st->ref, 1) > 0)
+		return;
+	free(st->co.title);
+	free(st->co.cache_dir);
+	free(st);
+}
+
 void pie_set_do_back(struct conf *co, int do_back) {
 	co->do_back = do_back;
 }
@@ -185,6 +421,12 @@ void pie_set_legend_color(struct conf *co, char *color) {
 void pie_set_legend_size(struct conf *co, double size) {
 	co->leg_size = size;
 }
+void pie_set_legend_page(struct conf *co, int page) {
+	co->leg_page = page;
+}
+void pie_set_do_labels(struct conf *co, int mode) {
+	co->draw_lab = mode;
+}
 void pie_set_margin(struct conf *co, int size) {
 	co->margin = size;
 }
@@ -195,12 +437,38 @@ void pie_set_title_size(struct conf *co, int size) {
 	co->title_size = size;
 }
 void pie_set_title(struct conf *co, char *title) {
-	free(co->title);
+	if (!style_shares(co, co->title))
+		free(co->title);
 	co->title = strdup(title);
+	STATS_ADD(allocs, 1);
 }
 void pie_set_title_color(struct conf *co, char *color) {
 	convert_rgba_hex(color, 0xff, &co->title_color);
 }
+void pie_set_compression(struct conf *co, int level) {
+	co->z_level = level;
+}
+void pie_set_filter(struct conf *co, int filter) {
+	co->z_filter = filter;
+}
+void pie_set_threads(struct conf *co, int threads) {
+	co->threads = threads;
+}
+void pie_set_band(struct conf *co, int lines) {
+	co->band = lines;
+}
+void pie_set_format(struct conf *co, cairo_format_t format) {
+	co->format = format;
+}
+void pie_set_quality(struct conf *co, int quality) {
+	co->quality = quality;
+}
+void pie_set_cache(struct conf *co, char *dir, long long max) {
+	if (!style_shares(co, co->cache_dir))
+		free(co->cache_dir);
+	co->cache_dir = dir != NULL ? strdup(dir) : NULL;
+	co->cache_max = max;
+}
 int pie_add(struct conf *co, double value, char *color, double extrude, char *name)
 {
 	int i;
@@ -217,6 +485,8 @@ int pie_add(struct conf *co, double value, char *color, double extrude, char *na
 	co->color[i]   = strdup(color);
 	co->extract[i] = extrude;
 	co->name[i]    = strdup(name);
+	STATS_ADD(allocs, 6);
+	STATS_ADD(slices, 1);
 
 	return 1;
 }
@@ -233,6 +503,7 @@ int hex_to_int(char c)
 	return 0;
 }
 
+/* "rrggbb" with the alpha <alpha>, or "rrggbbaa" */
 static
 void convert_rgba_hex(char *hex, unsigned char alpha, struct color *out)
 {
@@ -242,7 +513,9 @@ void convert_rgba_hex(char *hex, unsigned char alpha, struct color *out)
 	if (hex[0] == '#')
 		hex++;
 
-	if (strlen(hex) != 6) {
+	if (strlen(hex) == 8)
+		alpha = ( hex_to_int(hex[6]) * 16 ) + hex_to_int(hex[7]);
+	else if (strlen(hex) != 6) {
 		out->r = 0;
 		out->g = 0;
 		out->b = 0;
@@ -267,6 +540,13 @@ void cairo_set_source_col(cairo_t *c, const struct color *col)
 	cairo_set_source_rgba(c, col->r, col->g, col->b, col->a);
 }
 
+static inline
+void cairo_set_font(cairo_t *c, double size)
+{
+	cairo_set_font_face(c, sans);
+	cairo_set_font_size(c, size);
+}
+
 static inline void col_dark(struct color *in, struct color *out, double dark) {
 	out->r = in->r * dark;
 	out->g = in->g * dark;
@@ -296,6 +576,7 @@ void draw_face_start(cairo_t *c, struct portion *p)
 	cairo_line_to(c, p->b_strt.x, p->b_strt.y);
 	cairo_line_to(c, p->b_cent.x, p->b_cent.y);
 	cairo_line_to(c, p->t_cent.x, p->t_cent.y);
+	STATS_ADD(segments, 4);
 
 	/* trace filled */
 	cairo_set_line_width(c, 0.0); /* set line */
@@ -318,6 +599,7 @@ void draw_face_stop(cairo_t *c, struct portion *p)
 	cairo_line_to(c, p->b_stop.x, p->b_stop.y);
 	cairo_line_to(c, p->b_cent.x, p->b_cent.y);
 	cairo_line_to(c, p->t_cent.x, p->t_cent.y);
+	STATS_ADD(segments, 4);
 
 	/* trace filled */
 	cairo_set_line_width(c, 0.0); /* set line */
@@ -330,61 +612,73 @@ void draw_face_stop(cairo_t *c, struct portion *p)
 	cairo_stroke(c);
 }
 
+/* The visible part of the rounded face: the part of the arc in the
+ * lower half of the ellipse.
+ */
 static inline
-void draw_face_rounded(cairo_t *c, struct conf *co, struct portion *p)
+void rounded_ends(struct conf *co, struct portion *p, double *strt,
+                  double *stop, struct coord *tstrt, struct coord *bstop)
 {
-	cairo_pattern_t *pat;
-	struct coord tstrt;
-	struct coord bstop;
-	double strt;
-	double stop;
-
-	/* set line */
-	cairo_set_line_width(c, 0.0);
-
-	/* set dark color */
-	cairo_set_source_col(c, &p->dark);
-
 	/* on arrange le start */
 	if (p->ca_strt >= M_PI &&  p->ca_strt < 2.0 * M_PI) {
-		strt = 2.0 * M_PI;
-		tstrt.x = ( co->rx * cos(strt) ) + p->t_cent.x;
-		tstrt.y = ( co->ry * sin(strt) ) + p->t_cent.y;
+		*strt = 2.0 * M_PI;
+		tstrt->x = ( co->rx * cos(*strt) ) + p->t_cent.x;
+		tstrt->y = ( co->ry * sin(*strt) ) + p->t_cent.y;
 	}
 
 	else {
-		strt = p->ang_strt;
-		tstrt.x = p->t_strt.x;
-		tstrt.y = p->t_strt.y;
+		*strt = p->ang_strt;
+		tstrt->x = p->t_strt.x;
+		tstrt->y = p->t_strt.y;
 	}
 
 	/* on arrange le stop */
 	if (p->ca_stop > M_PI) {
-		stop = M_PI;
-		bstop.x = ( co->rx * cos(M_PI) ) + p->t_cent.x;
-		bstop.y = ( co->rx * sin(M_PI) ) + p->t_cent.y + ( co->height * co->ry );
+		*stop = M_PI;
+		bstop->x = ( co->rx * cos(M_PI) ) + p->t_cent.x;
+		bstop->y = ( co->rx * sin(M_PI) ) + p->t_cent.y + ( co->height * co->ry );
 	}
 
 	else {
-		stop = p->ang_stop;
-		bstop.x = p->b_stop.x;
-		bstop.y = p->b_stop.y;
+		*stop = p->ang_stop;
+		bstop->x = p->b_stop.x;
+		bstop->y = p->b_stop.y;
 	}
+}
+
+static inline
+void draw_face_rounded(cairo_t *c, struct conf *co, struct portion *p)
+{
+	cairo_pattern_t *pat;
+	struct coord tstrt;
+	struct coord bstop;
+	double strt;
+	double stop;
+	int n;
+
+	/* set line */
+	cairo_set_line_width(c, 0.0);
+
+	/* set dark color */
+	cairo_set_source_col(c, &p->dark);
+
+	rounded_ends(co, p, &strt, &stop, &tstrt, &bstop);
 
 	/* face arrondie */
 	cairo_new_path(c);
-	cairo_move_to(c, tstrt.x, tstrt.y);
-	cairo_ellipse(c, p->t_cent.x, p->t_cent.y, co->rx, co->ry, strt, stop);
-	cairo_line_to(c, bstop.x, bstop.y);
-	cairo_ellipse_negative(c, p->b_cent.x, p->b_cent.y, co->rx, co->ry, stop, strt);
-	cairo_line_to(c, tstrt.x, tstrt.y);
+	n = cairo_ellipse_band(c, p->t_cent.x, p->t_cent.y, co->rx, co->ry, strt,
+	                       stop, co->arc_step, p->b_cent.y - p->t_cent.y);
+	STATS_ADD(segments, n);
 
-	/* trace filled */
+	/* trace filled, flat dark color in fast quality */
 	cairo_set_line_width(c, 0.0);
-	pat = cairo_pattern_create_linear(co->margin, 0.0, co->margin + co->pie_w, 256.0);
-	cairo_pattern_add_color_stop_rgba(pat, 1, p->light.r, p->light.g, p->light.b, 1);
-	cairo_pattern_add_color_stop_rgba(pat, 0, p->dark_deg.r, p->dark_deg.g, p->dark_deg.b, 1);
-	cairo_set_source (c, pat);
+	if (co->quality != PIE_QUALITY_FAST) {
+		pat = cairo_pattern_create_linear(co->margin, 0.0, co->margin + co->pie_w, 256.0);
+		cairo_pattern_add_color_stop_rgba(pat, 1, p->light.r, p->light.g, p->light.b, p->light.a);
+		cairo_pattern_add_color_stop_rgba(pat, 0, p->dark_deg.r, p->dark_deg.g, p->dark_deg.b, p->dark_deg.a);
+		cairo_set_source (c, pat);
+		cairo_pattern_destroy(pat);
+	}
 	cairo_fill_preserve(c);
 
 	/* trace line */
@@ -396,11 +690,15 @@ void draw_face_rounded(cairo_t *c, struct conf *co, struct portion *p)
 static inline
 void draw_face_top(cairo_t *c, struct conf *co, struct portion *p)
 {
+	int n;
+
 	/* Le toit */
 	cairo_new_path(c);
 	cairo_move_to(c, p->t_cent.x, p->t_cent.y);
-	cairo_ellipse(c, p->t_cent.x, p->t_cent.y, co->rx, co->ry, p->ang_strt, p->ang_stop);
+	n = cairo_ellipse(c, p->t_cent.x, p->t_cent.y, co->rx, co->ry, p->ang_strt, p->ang_stop,
+	                  co->arc_step);
 	cairo_line_to(c, p->t_cent.x, p->t_cent.y);
+	STATS_ADD(segments, n + 1);
 
 	/* trace filled */
 	cairo_set_line_width(c, 0.0); /* set line */
@@ -419,211 +717,978 @@ void draw_face_top(cairo_t *c, struct conf *co, struct portion *p)
  *  - stop     partie droite du hat vers le bas (a l'endroit)
  *  - rounded  commence ou termine dans la partie basse
  */
+/* The equal keys stay in the portion order, as a stable sort would
+ * leave them.
+ */
+static
+int key_asc(const void *a, const void *b)
+{
+	const struct sort_key *ka = a;
+	const struct sort_key *kb = b;
+
+	if (ka->key != kb->key)
+		return ka->key < kb->key ? -1 : 1;
+	return ka->i - kb->i;
+}
+
+static
+int key_desc(const void *a, const void *b)
+{
+	const struct sort_key *ka = a;
+	const struct sort_key *kb = b;
+
+	if (ka->key != kb->key)
+		return ka->key > kb->key ? -1 : 1;
+	return ka->i - kb->i;
+}
+
+/* sort the <n> keys and write the portions in this order in <ps> */
+static inline
+void sort_keys(struct sort_key *k, int n, int desc, struct portion *p,
+               struct portion **ps)
+{
+	int i;
+
+	qsort(k, n, sizeof(struct sort_key), desc ? key_desc : key_asc);
+	for (i=0; i<n; i++)
+		ps[i] = &p[k[i].i];
+}
+
 static inline
-void sort_start(struct portion *p, int pnb, struct portion **ps, int *psnb)
+void sort_start(struct portion *p, int pnb, struct sort_key *k,
+                struct portion **ps, int *psnb)
 {
 	int i;
 	int j;
-	struct portion *swap;
 
 	/* extrait les valeurs */
 	j = 0;
-	for (i=0; i<pnb; i++)
-		if (p[i].ca_strt > M_PI/2.0f && p[i].ca_strt < (3.0f*M_PI)/2.0f)
-			ps[j++] = &p[i];
+	for (i=0; i<pnb; i++) {
+		if (p[i].ca_strt > M_PI/2.0f && p[i].ca_strt < (3.0f*M_PI)/2.0f) {
+			k[j].key = p[i].ca_strt;
+			k[j++].i = i;
+		}
+	}
 	*psnb = j;
 
 	/* tri du plus grand vers le plus petit */
-	for (i=0; i<*psnb; i++) {
-		for (j=(*psnb)-1; j>i; j--) {
-			if (ps[j]->ca_strt > ps[j-1]->ca_strt) {
-				swap = ps[j];
-				ps[j] = ps[j-1];
-				ps[j-1] = swap;
-			}
-		}
-	}
+	sort_keys(k, *psnb, 1, p, ps);
 }
 
 static inline
-void sort_stop(struct portion *p, int pnb, struct portion **ps, int *psnb)
+void sort_stop(struct portion *p, int pnb, struct sort_key *k,
+               struct portion **ps, int *psnb)
 {
 	int i;
 	int j;
-	struct portion *swap;
 
 	/* extrait les valeurs */
 	j = 0;
 	for (i=0; i<pnb; i++) {
 		if (p[i].ca_stop > (3.0f*M_PI)/2.0f && p[i].ca_stop <= 2.0f*M_PI) {
-			p[i].tmp = p[i].ca_stop;
-			ps[j++] = &p[i];
+			k[j].key = p[i].ca_stop;
+			k[j++].i = i;
 		}
 
 		if (p[i].ca_stop >= 0.0f && p[i].ca_stop < M_PI/2.0f) {
-			p[i].tmp = p[i].ca_stop + 2.0f*M_PI; /* update angle value for sort */
-			ps[j++] = &p[i];
+			k[j].key = p[i].ca_stop + 2.0f*M_PI; /* update angle value for sort */
+			k[j++].i = i;
 		}
 	}
 	*psnb = j;
 
-	/* tri du plus grand vers le plus petit */
-	for (i=0; i<*psnb; i++) {
-		for (j=(*psnb)-1; j>i; j--) {
-			if (ps[j]->tmp < ps[j-1]->tmp) {
-				swap = ps[j];
-				ps[j] = ps[j-1];
-				ps[j-1] = swap;
-			}
-		}
-	}
+	/* tri du plus petit vers le plus grand */
+	sort_keys(k, *psnb, 0, p, ps);
 }
 
 static inline
-void sort_rounded(struct portion *p, int pnb, struct portion **ps, int *psnb)
+void sort_rounded(struct portion *p, int pnb, struct sort_key *k,
+                  struct portion **ps, int *psnb)
 {
 	int i;
 	int j;
 	int inter;
-	struct portion *swap;
 
 	/* extrait rounded qui commence ou termine dans le bas */
 	j = 0;
-	for (i=0; i<pnb; i++)
-		if ( p[i].ca_stop > 0.0f && p[i].ca_stop <= M_PI/2.0f )
-			ps[j++] = &p[i];
+	for (i=0; i<pnb; i++) {
+		if ( p[i].ca_stop > 0.0f && p[i].ca_stop <= M_PI/2.0f ) {
+			k[j].key = p[i].ca_stop;
+			k[j++].i = i;
+		}
+	}
 	inter = j;
 
 	/* tri du plus petit vers le plus grand */
-	for (i=0; i<inter; i++) {
-		for (j=inter-1; j>i; j--) {
-			if (ps[j]->ca_stop < ps[j-1]->ca_stop) {
-				swap = ps[j];
-				ps[j] = ps[j-1];
-				ps[j-1] = swap;
-			}
-		}
-	}
+	sort_keys(k, inter, 0, p, ps);
 
 	/* extrait rounded qui commence ou termine dans le bas */
-	j = inter;
-	for (i=0; i<pnb; i++)
+	j = 0;
+	for (i=0; i<pnb; i++) {
 		if (p[i].ca_strt >= 0.0f && p[i].ca_strt < M_PI &&
-		    p[i].ca_stop > M_PI/2.0f )
-			ps[j++] = &p[i];
-	*psnb = j;
-
-	/* tri du plus grand vers le plus petit */
-	for (i=inter; i<*psnb; i++) {
-		for (j=(*psnb)-1; j>i; j--) {
-			if (ps[j]->ca_strt > ps[j-1]->ca_strt) {
-				swap = ps[j];
-				ps[j] = ps[j-1];
-				ps[j-1] = swap;
-			}
+		    p[i].ca_stop > M_PI/2.0f ) {
+			k[j].key = p[i].ca_strt;
+			k[j++].i = i;
 		}
 	}
-}
-
-void pie_cairo_draw(cairo_t *c, struct conf *co) {
-	double y;
-	double dec = 0.0f;
-	double total = 0;
-	double last = 0;
-	int i;
-	struct portion *p;
-	struct portion **ps;
-	int psnb;
-	double hauteur;
-	double height_leg;
-	double width_leg;
-	struct coord a1;
-	struct coord a2;
+	*psnb = inter + j;
 
-	/* default co->fig */
-	if (co->ratio == -1)
-		co->ratio = 0.5f;
+	/* tri du plus grand vers le plus petit */
+	sort_keys(k, j, 1, p, ps + inter);
+}
 
-	if (co->img_w != -1 && co->img_h == -1)
-		co->img_h = co->img_w;
+/* La portion qui contient l'angle <a> (0 <= a < 2*PI). Les portions
+ * sont triees par angle de depart, on fait une recherche dichotomique.
+ */
+static inline
+int portion_at(struct portion *p, int pnb, double a)
+{
+	int lo;
+	int hi;
+	int mid;
+
+	lo = 0;
+	hi = pnb - 1;
+	while (lo < hi) {
+		mid = (lo + hi + 1) / 2;
+		if (p[mid].ang_strt <= a)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+	return lo;
+}
 
-	else if (co->img_w == -1 && co->img_h != -1)
-		co->img_w = co->img_h;
+/* return true if the point is painted by the top of the portion */
+static inline
+int top_covers(struct conf *co, struct portion *p, double x, double y,
+               double eps)
+{
+	double dx;
+	double dy;
+	double d;
+	double a;
 
-	else if (co->img_w == -1 && co->img_h == -1) {
-		co->img_w = 400;
-		co->img_h = 400;
+	dx = x - p->t_cent.x;
+	dy = y - p->t_cent.y;
+
+	d = sqrt((dx * dx) + (dy * dy));
+	if (d <= eps)
+		return 1;
+	if ((dx / co->rx) * (dx / co->rx) + (dy / co->ry) * (dy / co->ry) <=
+	    (1.0 + eps / co->ry) * (1.0 + eps / co->ry)) {
+		a = atan2(dy / co->ry, dx / co->rx) - p->ang_strt;
+		while (a < 0)
+			a += 2.0 * M_PI;
+		if (a <= p->ang_stop - p->ang_strt + (eps / d) ||
+		    a >= (2.0 * M_PI) - (eps / d))
+			return 1;
 	}
+	return 0;
+}
 
-	if (co->decal == -1)
-		co->decal = 0.1;
+/* return true if the point is painted by the rounded face of the
+ * portion, same selection and bounds than sort_rounded() and
+ * draw_face_rounded()
+ */
+static inline
+int rounded_covers(struct conf *co, struct portion *p, double x, double y,
+                   double eps)
+{
+	double dx;
+	double dy;
+	double a;
+	double strt;
+	double stop;
+	double ytop;
+
+	dx = x - p->t_cent.x;
+	dy = y - p->t_cent.y;
+
+	if (!(p->ca_stop > 0.0f && p->ca_stop <= M_PI/2.0f) &&
+	    !(p->ca_strt >= 0.0f && p->ca_strt < M_PI && p->ca_stop > M_PI/2.0f))
+		return 0;
+	strt = p->ca_strt >= M_PI ? 0.0 : p->ca_strt;
+	stop = p->ca_stop > M_PI ? M_PI : p->ca_stop;
+	if (stop <= strt)
+		return 0;
+	if (dx < (co->rx * cos(stop)) - eps || dx > (co->rx * cos(strt)) + eps)
+		return 0;
+	a = dx / co->rx;
+	if (a > 1.0)
+		a = 1.0;
+	if (a < -1.0)
+		a = -1.0;
+	a = acos(a);
+	if (a < strt)
+		a = strt;
+	if (a > stop)
+		a = stop;
+	ytop = co->ry * sin(a);
+	return dy >= ytop - eps && dy <= ytop + ( co->height * co->ry ) + eps;
+}
 
-	if (co->height == -1)
-		co->height = 0.4;
+/* distance from the point (dx, dy) to the ray from the origin towards
+ * the border of the ellipse at the angle <a>
+ */
+static inline
+double ray_dist(struct conf *co, double dx, double dy, double a)
+{
+	double ux;
+	double uy;
+	double l;
+
+	ux = co->rx * cos(a);
+	uy = co->ry * sin(a);
+	l = sqrt((ux * ux) + (uy * uy));
+	if ((dx * ux) + (dy * uy) <= 0)
+		return sqrt((dx * dx) + (dy * dy));
+	return fabs((dx * uy) - (dy * ux)) / l;
+}
 
-	if(co->margin == -1)
-		co->margin = 10;
+/* return true if the disc of radius <m> around the point is painted by
+ * the top of the portion: the point is in the ellipse shrunk by <m> and
+ * at least <m> away from both edges.
+ */
+static inline
+int top_inside(struct conf *co, struct portion *p, double x, double y,
+               double m)
+{
+	double dx;
+	double dy;
+	double s;
+	double a;
 
-	/* build values total */
-	total = 0.0f;
-	for (i=0; i<co->nb; i++)
-		total += co->part[i];
+	/* a translucent top shows what is under it */
+	if (p->light.a < 1.0)
+		return 0;
+
+	dx = x - p->t_cent.x;
+	dy = y - p->t_cent.y;
+
+	s = 1.0 - ( m / ( co->rx < co->ry ? co->rx : co->ry ) );
+	if (s <= 0.0 ||
+	    (dx / co->rx) * (dx / co->rx) + (dy / co->ry) * (dy / co->ry) > s * s)
+		return 0;
+
+	/* a single portion is the whole ellipse */
+	if (p->ang_stop - p->ang_strt >= 2.0 * M_PI)
+		return 1;
+
+	a = atan2(dy / co->ry, dx / co->rx) - p->ang_strt;
+	while (a < 0)
+		a += 2.0 * M_PI;
+	if (a > p->ang_stop - p->ang_strt)
+		return 0;
+	return ray_dist(co, dx, dy, p->ang_strt) >= m &&
+	       ray_dist(co, dx, dy, p->ang_stop) >= m;
+}
 
-	/* memory used */
-	p = malloc(sizeof(struct portion) * co->nb);
-	ps = malloc(sizeof(struct portion *) * co->nb);
+/* height of the top arc of the rounded face over its centre at <dx> */
+static inline
+double rounded_arc(struct conf *co, double dx, double strt, double stop)
+{
+	double a;
 
-	/* title height */
-	cairo_select_font_face (c, "Sans", CAIRO_FONT_SLANT_NORMAL,
-	                        CAIRO_FONT_WEIGHT_NORMAL);
-	cairo_set_font_size (c, co->title_size);
-	cairo_text_extents (c, co->title, &co->title_exts);
+	a = dx / co->rx;
+	if (a > 1.0)
+		a = 1.0;
+	if (a < -1.0)
+		a = -1.0;
+	a = acos(a);
+	if (a < strt)
+		a = strt;
+	if (a > stop)
+		a = stop;
+	return co->ry * sin(a);
+}
 
-	/* build legend mode 1 */
-	if (co->draw_leg == 1) {
-		cairo_select_font_face (c, "Sans", CAIRO_FONT_SLANT_NORMAL,
-		                        CAIRO_FONT_WEIGHT_NORMAL);
-		cairo_set_font_size (c, co->leg_size);
-		dec = 0;
-		for (i=0; i<co->nb; i++) {
-			p[i].legend = co->name[i];
-			cairo_text_extents (c, p[i].legend, &p[i].legend_exts);
-			if (dec < p[i].legend_exts.height)
-				dec = p[i].legend_exts.height;
-		}
-		height_leg = dec * (double)co->nb;
-		width_leg = 0;
-	}
-
-	/* build legend mode 2 */
-	else if (co->draw_leg == 2) {
-		cairo_select_font_face (c, "Sans", CAIRO_FONT_SLANT_NORMAL,
-		                        CAIRO_FONT_WEIGHT_NORMAL);
-		cairo_set_font_size (c, co->leg_size);
-		dec = 0;
-		for (i=0; i<co->nb; i++) {
-			p[i].legend = co->name[i];
-			cairo_text_extents (c, p[i].legend, &p[i].legend_exts);
-			if (dec < p[i].legend_exts.width)
-				dec = p[i].legend_exts.width;
-		}
-		width_leg = dec;
-		height_leg = 0;
-	}
-
-	/* no legend */
-	else {
-		height_leg = 0;
-		width_leg = 0;
-		dec = 0;
-	}
+/* return true if the disc of radius <m> around the point is painted by
+ * the rounded face of the portion: the arcs over [x - m, x + m] stay
+ * more than <m> above and under the point.
+ */
+static inline
+int rounded_inside(struct conf *co, struct portion *p, double x, double y,
+                   double m)
+{
+	double dx;
+	double dy;
+	double strt;
+	double stop;
+	double hi;
+	double lo;
+	double v;
+
+	if (p->light.a < 1.0)
+		return 0;
+
+	dx = x - p->t_cent.x;
+	dy = y - p->t_cent.y;
+
+	if (!(p->ca_stop > 0.0f && p->ca_stop <= M_PI/2.0f) &&
+	    !(p->ca_strt >= 0.0f && p->ca_strt < M_PI && p->ca_stop > M_PI/2.0f))
+		return 0;
+	strt = p->ca_strt >= M_PI ? 0.0 : p->ca_strt;
+	stop = p->ca_stop > M_PI ? M_PI : p->ca_stop;
+	if (stop <= strt)
+		return 0;
+	if (dx - m < co->rx * cos(stop) || dx + m > co->rx * cos(strt))
+		return 0;
+
+	/* the arc is concave: its extrema are at the ends of the interval
+	 * or at its top
+	 */
+	hi = rounded_arc(co, dx - m, strt, stop);
+	lo = hi;
+	v = rounded_arc(co, dx + m, strt, stop);
+	if (v > hi)
+		hi = v;
+	if (v < lo)
+		lo = v;
+	if (dx - m <= 0 && dx + m >= 0)
+		hi = rounded_arc(co, 0, strt, stop);
+	return dy - m >= hi && dy + m <= lo + ( co->height * co->ry );
+}
 
-	/* pie draw utility surface */
-	co->pie_w  = co->img_w - ( ( 2.0 * co->margin ) + ( 2.0 * width_leg ) );
-	co->pie_h  = co->img_h - ( ( 2.0 * co->margin ) + co->title_exts.height +
-	                         height_leg );
+/* return true if the disc of radius <m> around the point is painted by
+ * the top or the rounded face of the portion. These faces are drawn
+ * after all the side faces, so everything they cover is hidden.
+ */
+static inline
+int portion_covers(struct conf *co, struct portion *p, double x, double y,
+                   double m)
+{
+	return top_inside(co, p, x, y, m) || rounded_inside(co, p, x, y, m);
+}
 
-	/*               pie_w
+/* Only the portions around the point can cover it: the one under the
+ * point on the top ellipse, the one under the point on the rounded
+ * face, the face owner and their neighbours. A miss is conservative:
+ * the face is kept.
+ */
+static inline
+int point_covered(struct conf *co, struct portion *p, int pnb, int own,
+                  double x, double y, double m)
+{
+	static const int near[3] = { 0, 1, -1 };
+	int cand[3];
+	double a;
+	int i;
+	int j;
+
+	a = atan2((y - co->cy) / co->ry, (x - co->cx) / co->rx);
+	if (a < 0)
+		a += 2.0 * M_PI;
+	cand[0] = portion_at(p, pnb, a);
+
+	a = (x - co->cx) / co->rx;
+	if (a > 1.0)
+		a = 1.0;
+	if (a < -1.0)
+		a = -1.0;
+	cand[1] = portion_at(p, pnb, acos(a));
+
+	cand[2] = own;
+
+	for (i=0; i<3; i++)
+		for (j=0; j<3; j++)
+			if (portion_covers(co, &p[(cand[j] + near[i] + pnb) % pnb],
+			                   x, y, m))
+				return 1;
+	return 0;
+}
+
+#define FACE_SAMPLES 64
+#define FACE_GRID 8
+
+/* a pixel is fully painted by a face if the face covers every point at
+ * most a diagonal away from its centre
+ */
+#define FACE_AA 1.5
+
+/* A side face is the quad a (top centre), b (top border), c (bottom
+ * border), d (bottom centre). It is hidden if samples taken along its
+ * border are all covered: the gaps between the portions run to the pie
+ * border, so they cross the face border. A coarse grid over the surface
+ * catches the remaining holes.
+ *
+ * A sample is covered if one portion alone paints the disc of radius
+ * <m> around it, plus half the gap to the next sample. Two portions
+ * which only meet at the sample don't hide it: the antialiased pixels
+ * of their common edge are partly transparent.
+ */
+static inline
+int face_hidden(struct conf *co, struct portion *p, int pnb, int own,
+                struct coord *a, struct coord *b, struct coord *c,
+                struct coord *d, double m)
+{
+	double eps;
+	double len;
+	double s;
+	double t;
+	double x;
+	double y;
+	int n;
+	int i;
+	int j;
+
+	len = hypot(b->x - a->x, b->y - a->y);
+	if (len < d->y - a->y)
+		len = d->y - a->y;
+	n = ceil(len);
+	if (n > FACE_SAMPLES)
+		n = FACE_SAMPLES;
+	if (n < 1)
+		n = 1;
+	eps = m + ( len / ( 2.0 * n ) );
+
+	/* border */
+	for (i=0; i<=n; i++) {
+		s = (double)i / (double)n;
+		if (!point_covered(co, p, pnb, own, a->x + (b->x - a->x) * s,
+		                   a->y + (b->y - a->y) * s, eps) ||
+		    !point_covered(co, p, pnb, own, b->x + (c->x - b->x) * s,
+		                   b->y + (c->y - b->y) * s, eps) ||
+		    !point_covered(co, p, pnb, own, c->x + (d->x - c->x) * s,
+		                   c->y + (d->y - c->y) * s, eps) ||
+		    !point_covered(co, p, pnb, own, d->x + (a->x - d->x) * s,
+		                   d->y + (a->y - d->y) * s, eps))
+			return 0;
+	}
+
+	/* surface */
+	for (i=1; i<FACE_GRID; i++) {
+		s = (double)i / (double)FACE_GRID;
+		for (j=1; j<FACE_GRID; j++) {
+			t = (double)j / (double)FACE_GRID;
+			x = ( a->x + (b->x - a->x) * s ) * (1.0 - t) +
+			    ( d->x + (c->x - d->x) * s ) * t;
+			y = ( a->y + (b->y - a->y) * s ) * (1.0 - t) +
+			    ( d->y + (c->y - d->y) * s ) * t;
+			if (!point_covered(co, p, pnb, own, x, y, eps))
+				return 0;
+		}
+	}
+
+	return 1;
+}
+
+/* retire de la liste les faces start (ou stop) completement cachees
+ * par les toits et les faces arrondies dessines ensuite. <m> est la
+ * marge de l'antialiasing, dans l'unite du dessin.
+ */
+static inline
+void cull_faces(struct conf *co, struct portion *p, int pnb,
+                struct portion **ps, int *psnb, int start, double m)
+{
+	int i;
+	int j;
+
+	if (co->rx <= 0.0 || co->ry <= 0.0)
+		return;
+
+	j = 0;
+	for (i=0; i<*psnb; i++) {
+		if (start) {
+			if (face_hidden(co, p, pnb, ps[i] - p, &ps[i]->t_cent,
+			                &ps[i]->t_strt, &ps[i]->b_strt, &ps[i]->b_cent, m))
+				continue;
+		}
+		else {
+			if (face_hidden(co, p, pnb, ps[i] - p, &ps[i]->t_cent,
+			                &ps[i]->t_stop, &ps[i]->b_stop, &ps[i]->b_cent, m))
+				continue;
+		}
+		ps[j++] = ps[i];
+	}
+	*psnb = j;
+}
+
+/* default co->fig */
+static
+void pie_defaults(struct conf *co)
+{
+	if (co->ratio == -1)
+		co->ratio = 0.5f;
+
+	if (co->img_w != -1 && co->img_h == -1)
+		co->img_h = co->img_w;
+
+	else if (co->img_w == -1 && co->img_h != -1)
+		co->img_w = co->img_h;
+
+	else if (co->img_w == -1 && co->img_h == -1) {
+		co->img_w = 400;
+		co->img_h = 400;
+	}
+
+	if (co->decal == -1)
+		co->decal = 0.1;
+
+	if (co->height == -1)
+		co->height = 0.4;
+
+	if(co->margin == -1)
+		co->margin = 10;
+}
+
+/* Choose the columns of the legend from the measured names <ex>.
+ * Under the pie, the legend takes at most half of the height: it is
+ * one column while it fits, else the fewest columns which hold all the
+ * lines, else as many lines as the columns hold, the last one being
+ * "+N more". On the right side, it is one column of the height. The
+ * lines kept are the largest slices, from the page <leg_page>, in the
+ * slices order. The room taken under or beside the pie goes in
+ * <height_leg> and <width_leg>.
+ */
+static
+void legend_measure(cairo_t *c, struct conf *co, cairo_text_extents_t *ex,
+                    struct legend_box *lb, double *height_leg,
+                    double *width_leg)
+{
+	struct sort_key *k;
+	struct legend *l;
+	double wmax = 0;
+	double avail;
+	int nb = co->nb;
+	int shown;
+	int first;
+	int cols;
+	int cap;
+	int i;
+	int j;
+
+	l = malloc(( sizeof(struct legend) * ( nb + 1 ) ) + LEG_MORE);
+	if (l == NULL) {
+		fprintf(stderr, "Memory error\n");
+		exit(1);
+	}
+	STATS_ADD(allocs, 1);
+
+	lb->dec = 0;
+	for (i=0; i<nb; i++) {
+		l[i].text = co->name[i];
+		l[i].slice = i;
+		l[i].exts = ex[i];
+		if (lb->dec < l[i].exts.height)
+			lb->dec = l[i].exts.height;
+		if (wmax < l[i].exts.width)
+			wmax = l[i].exts.width;
+	}
+	lb->w = ( lb->dec * 1.3f ) + wmax + lb->dec;
+
+	avail = co->img_h - ( 2.0 * co->margin ) - co->title_exts.height;
+	if (co->draw_leg == 1)
+		avail /= 2.0;
+	cap = lb->dec > 0 ? (int)( avail / lb->dec ) : nb;
+	if (cap < 1)
+		cap = 1;
+	cols = 1;
+	if (co->draw_leg == 1 && lb->w > 0) {
+		cols = (int)( ( co->img_w - ( 2.0 * co->margin ) + lb->dec ) / lb->w );
+		if (cols < 1)
+			cols = 1;
+	}
+
+	shown = nb;
+	if (nb <= cap)
+		lb->rows = nb;
+	else if (( nb + cap - 1 ) / cap <= cols) {
+		cols = ( nb + cap - 1 ) / cap;
+		lb->rows = ( nb + cols - 1 ) / cols;
+	}
+	else {
+		lb->rows = cap;
+		shown = ( cap * cols ) - 1;
+	}
+
+	lb->nb = nb;
+	if (shown < nb) {
+		if (shown > 0) {
+			k = malloc(sizeof(struct sort_key) * nb);
+			if (k == NULL) {
+				fprintf(stderr, "Memory error\n");
+				exit(1);
+			}
+			STATS_ADD(allocs, 1);
+			for (i=0; i<nb; i++) {
+				k[i].key = co->part[i];
+				k[i].i = i;
+				l[i].slice = -1;
+			}
+			qsort(k, nb, sizeof(struct sort_key), key_desc);
+
+			/* the last page is full */
+			first = co->leg_page * shown;
+			if (first > nb - shown || first < 0)
+				first = nb - shown;
+			for (i=first; i<first+shown; i++)
+				l[k[i].i].slice = k[i].i;
+			free(k);
+
+			for (i=0, j=0; i<nb; i++)
+				if (l[i].slice >= 0)
+					l[j++] = l[i];
+		}
+
+		l[shown].text = (char *)&l[nb + 1];
+		snprintf(l[shown].text, LEG_MORE, "+%d more", nb - shown);
+		cairo_text_extents (c, l[shown].text, &l[shown].exts);
+		l[shown].slice = -1;
+		lb->nb = shown + 1;
+	}
+	lb->line = l;
+
+	if (co->draw_leg == 1) {
+		*height_leg = lb->dec * (double)lb->rows;
+		*width_leg = 0;
+	}
+	else {
+		*height_leg = 0;
+		*width_leg = lb->w - lb->dec;
+	}
+}
+
+/* position of the legend lines, once the pie size is known */
+static
+void legend_place(struct conf *co, struct legend_box *lb)
+{
+	int i;
+
+	if (co->draw_leg == 1) {
+		lb->x = co->margin;
+		lb->y = co->margin + co->title_exts.height + co->pie_h;
+	}
+	else {
+		lb->x = co->img_w - co->margin - ( lb->w - lb->dec );
+		lb->y = co->margin + co->title_exts.height;
+	}
+	for (i=0; i<lb->nb; i++) {
+		lb->line[i].x = lb->x + ( ( i / lb->rows ) * lb->w );
+		lb->line[i].y = lb->y + ( ( i % lb->rows ) * lb->dec );
+	}
+}
+
+/* the extents of the slice names, measured once for the legend and the
+ * labels
+ */
+static
+cairo_text_extents_t *measure_names(cairo_t *c, struct conf *co)
+{
+	cairo_text_extents_t *ex;
+	int i;
+
+	ex = malloc(sizeof(cairo_text_extents_t) * ( co->nb > 0 ? co->nb : 1 ));
+	if (ex == NULL) {
+		fprintf(stderr, "Memory error\n");
+		exit(1);
+	}
+	STATS_ADD(allocs, 1);
+
+	cairo_set_font(c, co->leg_size);
+	for (i=0; i<co->nb; i++)
+		cairo_text_extents (c, co->name[i], &ex[i]);
+	return ex;
+}
+
+/* the room taken by the labels on each side of the pie */
+static
+void labels_measure(struct conf *co, cairo_text_extents_t *ex,
+                    struct label_box *lab, double *width_lab)
+{
+	double wmax = 0;
+	int i;
+
+	lab->dec = 0;
+	for (i=0; i<co->nb; i++) {
+		if (lab->dec < ex[i].height)
+			lab->dec = ex[i].height;
+		if (wmax < ex[i].width)
+			wmax = ex[i].width;
+	}
+	lab->dec *= 1.2f;
+	*width_lab = wmax + ( lab->dec * 1.3f );
+
+	lab->lab = malloc(sizeof(struct label) * ( co->nb > 0 ? co->nb : 1 ));
+	if (lab->lab == NULL) {
+		fprintf(stderr, "Memory error\n");
+		exit(1);
+	}
+	STATS_ADD(allocs, 1);
+}
+
+/* true if the border of the top of <p> at the angle <a>, from the
+ * centre to the ellipse, crosses the box <x> <y> <w> <h>
+ */
+static inline
+int ray_crosses(struct conf *co, struct portion *p, double a,
+                double x, double y, double w, double h)
+{
+	double dx = co->rx * cos(a);
+	double dy = co->ry * sin(a);
+	double t0 = 0;
+	double t1 = 1;
+	double ta;
+	double tb;
+	double t;
+
+	/* clip the segment by the two slabs of the box */
+	if (dx == 0) {
+		if (p->t_cent.x < x || p->t_cent.x > x + w)
+			return 0;
+	}
+	else {
+		ta = ( x - p->t_cent.x ) / dx;
+		tb = ( x + w - p->t_cent.x ) / dx;
+		if (ta > tb) {
+			t = ta;
+			ta = tb;
+			tb = t;
+		}
+		t0 = ta > t0 ? ta : t0;
+		t1 = tb < t1 ? tb : t1;
+	}
+	if (dy == 0) {
+		if (p->t_cent.y < y || p->t_cent.y > y + h)
+			return 0;
+	}
+	else {
+		ta = ( y - p->t_cent.y ) / dy;
+		tb = ( y + h - p->t_cent.y ) / dy;
+		if (ta > tb) {
+			t = ta;
+			ta = tb;
+			tb = t;
+		}
+		t0 = ta > t0 ? ta : t0;
+		t1 = tb < t1 ? tb : t1;
+	}
+	return t0 <= t1;
+}
+
+/* true if the name <ex> fits in the top of <p>, centred at 0.6 of its
+ * radius; the text origin goes in <l>. A top wider than pi is not
+ * convex: the corners may be in it while the box spans the missing
+ * wedge, so its two borders must not cross the box.
+ */
+static inline
+int label_fits(struct conf *co, struct portion *p, cairo_text_extents_t *ex,
+               struct label *l)
+{
+	double m = ( p->ang_strt + p->ang_stop ) / 2.0;
+	double x = p->t_cent.x + ( 0.6 * co->rx * cos(m) ) - ( ex->width / 2.0 );
+	double y = p->t_cent.y + ( 0.6 * co->ry * sin(m) ) - ( ex->height / 2.0 );
+
+	if (!top_covers(co, p, x, y, 0) ||
+	    !top_covers(co, p, x + ex->width, y, 0) ||
+	    !top_covers(co, p, x, y + ex->height, 0) ||
+	    !top_covers(co, p, x + ex->width, y + ex->height, 0))
+		return 0;
+	if (p->ang_stop - p->ang_strt > M_PI &&
+	    ( ray_crosses(co, p, p->ang_strt, x, y, ex->width, ex->height) ||
+	      ray_crosses(co, p, p->ang_stop, x, y, ex->width, ex->height) ))
+		return 0;
+	memset(l, 0, sizeof(struct label));
+	l->x = x - ex->x_bearing;
+	l->y = y - ex->y_bearing;
+	l->bx = x;
+	l->by = y;
+	l->bw = ex->width;
+	l->bh = ex->height;
+	return 1;
+}
+
+/* Place the <n> labels of the keys <k> in the column of the side <side>
+ * of the pie, 1 right or -1 left. The largest slices are kept while
+ * the lines fit in the height. Then a sweep in the order of the wanted
+ * heights pushes each line below the previous one, and a sweep upward
+ * pulls the lines back over the bottom: no two lines overlap, and the
+ * cost is the sort.
+ */
+static
+void labels_side(struct conf *co, struct portion *p, cairo_text_extents_t *ex,
+                 struct label_box *lab, struct sort_key *k, int n, int side)
+{
+	struct label *l;
+	double ext;
+	double top;
+	double bottom;
+	double h = lab->dec;
+	double m;
+	double y;
+	int cap;
+	int i;
+	int j;
+
+	ext = co->rx * ( 1.0f + co->decal + max(co->extract, co->nb) );
+	top = co->margin + co->title_exts.height;
+	bottom = top + co->pie_h;
+	cap = h > 0 ? (int)( ( bottom - top ) / h ) : n;
+
+	qsort(k, n, sizeof(struct sort_key), key_desc);
+	if (n > cap)
+		n = cap;
+
+	/* top of the line, in front of the middle of the arc */
+	for (j=0; j<n; j++) {
+		i = k[j].i;
+		m = ( p[i].ang_strt + p[i].ang_stop ) / 2.0;
+		k[j].key = p[i].t_cent.y + ( co->ry * sin(m) ) - ( h / 2.0 );
+	}
+	qsort(k, n, sizeof(struct sort_key), key_asc);
+
+	y = top;
+	for (j=0; j<n; j++) {
+		if (k[j].key < y)
+			k[j].key = y;
+		y = k[j].key + h;
+	}
+	y = bottom;
+	for (j=n-1; j>=0; j--) {
+		if (k[j].key + h > y)
+			k[j].key = y - h;
+		y = k[j].key;
+	}
+
+	for (j=0; j<n; j++) {
+		i = k[j].i;
+		m = ( p[i].ang_strt + p[i].ang_stop ) / 2.0;
+		y = k[j].key + ( h / 2.0 );
+		l = &lab->lab[lab->nb++];
+		l->slice = i;
+		l->inside = 0;
+		l->anchor.x = p[i].t_cent.x + ( co->rx * cos(m) );
+		l->anchor.y = p[i].t_cent.y + ( co->ry * sin(m) );
+		l->elbow.x = co->cx + ( side * ( ext + ( h * 0.5f ) ) );
+		l->elbow.y = y;
+		l->end.x = co->cx + ( side * ( ext + h ) );
+		l->end.y = y;
+		if (side > 0)
+			l->x = l->end.x + ( h * 0.3f ) - ex[i].x_bearing;
+		else
+			l->x = l->end.x - ( h * 0.3f ) - ex[i].width - ex[i].x_bearing;
+		l->y = y - ( ex[i].height / 2.0 ) - ex[i].y_bearing;
+		l->bx = l->x + ex[i].x_bearing;
+		l->by = l->y + ex[i].y_bearing;
+		l->bw = ex[i].width;
+		l->bh = ex[i].height;
+	}
+}
+
+/* The labels, once the portions are placed. With PIE_LABELS_INSIDE, a
+ * name which fits in its top is written on it. The others go on the
+ * side of the middle of their arc.
+ */
+static
+void labels_place(struct conf *co, struct portion *p, cairo_text_extents_t *ex,
+                  struct label_box *lab)
+{
+	struct sort_key *k;
+	double m;
+	int nr = 0;
+	int nl = 0;
+	int nb = co->nb;
+	int i;
+
+	k = malloc(sizeof(struct sort_key) * ( nb > 0 ? nb : 1 ));
+	if (k == NULL) {
+		fprintf(stderr, "Memory error\n");
+		exit(1);
+	}
+	STATS_ADD(allocs, 1);
+
+	/* the right side from the start of <k>, the left one from its end */
+	lab->nb = 0;
+	for (i=0; i<nb; i++) {
+		if (co->draw_lab == PIE_LABELS_INSIDE &&
+		    label_fits(co, &p[i], &ex[i], &lab->lab[lab->nb])) {
+			lab->lab[lab->nb].slice = i;
+			lab->lab[lab->nb++].inside = 1;
+			continue;
+		}
+		m = ( p[i].ang_strt + p[i].ang_stop ) / 2.0;
+		if (cos(m) >= 0) {
+			k[nr].key = co->part[i];
+			k[nr++].i = i;
+		}
+		else {
+			k[nb - 1 - nl].key = co->part[i];
+			k[nb - 1 - nl++].i = i;
+		}
+	}
+	labels_side(co, p, ex, lab, k, nr, 1);
+	labels_side(co, p, ex, lab, k + nb - nl, nl, -1);
+	free(k);
+}
+
+/* Compute the layout of the chart: the sizes, the legend, the labels
+ * and the geometry and colours of each portion. <c> is only used to
+ * measure the texts. The legend goes in <lb>, the labels in <lab>.
+ */
+static
+struct portion *pie_layout(cairo_t *c, struct conf *co, struct legend_box *lb,
+                           struct label_box *lab)
+{
+	double total = 0;
+	double last = 0;
+	int i;
+	struct portion *p;
+	cairo_text_extents_t *ex = NULL;
+	double hauteur;
+	double height_leg;
+	double width_leg;
+	double width_lab;
+	unsigned long long t;
+
+	t = stats_start();
+	pie_defaults(co);
+
+	/* build values total */
+	total = 0.0f;
+	for (i=0; i<co->nb; i++)
+		total += co->part[i];
+
+	/* memory used */
+	p = malloc(sizeof(struct portion) * co->nb);
+	if (p == NULL) {
+		fprintf(stderr, "Memory error\n");
+		exit(1);
+	}
+	STATS_ADD(allocs, 1);
+	STATS_PHASE(PIE_PHASE_LAYOUT, t);
+
+	/* title height */
+	t = stats_start();
+	cairo_set_font(c, co->title_size);
+	cairo_text_extents (c, co->title, &co->title_exts);
+
+	if (co->draw_leg == 1 || co->draw_leg == 2 ||
+	    co->draw_lab != PIE_LABELS_NONE)
+		ex = measure_names(c, co);
+
+	/* legend, mode 1 under the pie, mode 2 on its right */
+	memset(lb, 0, sizeof(struct legend_box));
+	height_leg = 0;
+	width_leg = 0;
+	if (co->draw_leg == 1 || co->draw_leg == 2)
+		legend_measure(c, co, ex, lb, &height_leg, &width_leg);
+
+	/* labels, on both sides of the pie */
+	memset(lab, 0, sizeof(struct label_box));
+	width_lab = 0;
+	if (co->draw_lab != PIE_LABELS_NONE)
+		labels_measure(co, ex, lab, &width_lab);
+
+	STATS_PHASE(PIE_PHASE_MEASURE, t);
+	t = stats_start();
+
+	/* pie draw utility surface */
+	co->pie_w  = co->img_w - ( ( 2.0 * co->margin ) + ( 2.0 * width_leg ) +
+	                         ( 2.0 * width_lab ) );
+	co->pie_h  = co->img_h - ( ( 2.0 * co->margin ) + co->title_exts.height +
+	                         height_leg );
+
+	/*               pie_w
 	 * <-------------------------------->
 	 *
 	 *  rx
@@ -652,6 +1717,24 @@ void pie_cairo_draw(cairo_t *c, struct conf *co) {
 		co->ry *= (double)co->pie_h / hauteur;
 	}
 
+	/* arc step: a chord of angle <a> is at most rx * a^2 / 8 away from
+	 * the ellipse, the fast and best qualities keep this error below
+	 * half a pixel and a fiftieth of pixel.
+	 */
+	co->arc_step = 0.01f;
+	if (co->quality == PIE_QUALITY_FAST && co->rx > 0) {
+		co->arc_step = sqrt(4.0f / co->rx);
+		if (co->arc_step > 0.25f)
+			co->arc_step = 0.25f;
+		if (co->arc_step < 0.01f)
+			co->arc_step = 0.01f;
+	}
+	else if (co->quality == PIE_QUALITY_BEST && co->rx > 0) {
+		co->arc_step = sqrt(0.16f / co->rx);
+		if (co->arc_step > 0.01f)
+			co->arc_step = 0.01f;
+	}
+
 	/* --- center y --- */
 
 	/*
@@ -700,10 +1783,13 @@ void pie_cairo_draw(cairo_t *c, struct conf *co) {
 	 *               2
 	 */
 
-	co->cx = ( co->pie_w / 2.0f ) + co->margin + width_leg;
+	co->cx = ( co->pie_w / 2.0f ) + co->margin + width_leg + width_lab;
 	co->cy = ( ( co->pie_h - ( co->height * co->ry ) ) / 2.0f ) +
 	          co->margin + co->title_exts.height;
 
+	if (lb->nb > 0)
+		legend_place(co, lb);
+
 	/* build coordinates */
 	last = 0;
 	for (i=0; i<co->nb; i++) {
@@ -760,116 +1846,264 @@ void pie_cairo_draw(cairo_t *c, struct conf *co) {
 		p[i].line_width = co->line_width;
 	}
 
-	/* draw backgroud */
+	if (lab->lab != NULL)
+		labels_place(co, p, ex, lab);
+	free(ex);
 
-	if (co->do_back) {
-		cairo_new_path(c);
-		cairo_rectangle(c, -1, -1, co->img_w+1, co->img_h+1);
-		cairo_set_source_col(c, &co->back);
-		cairo_fill(c);
-		cairo_stroke(c);
-	}
+	STATS_PHASE(PIE_PHASE_LAYOUT, t);
+	return p;
+}
 
-	/* draw title */
-	if (co->title) {
-		cairo_new_path(c);
-		cairo_select_font_face (c, "Sans", CAIRO_FONT_SLANT_NORMAL,
-		                        CAIRO_FONT_WEIGHT_NORMAL);
+/* A chart ready to draw: its layout and the visible side faces in
+ * painter order. It can be drawn several times, once per band for
+ * example.
+ */
+struct scene {
+	struct conf *co;
+	struct portion *p;
+	struct legend_box leg;
+	struct label_box lab;
+
+	struct portion **start;
+	int nstart;
+	struct portion **stop;
+	int nstop;
+	struct portion **round;
+	int nround;
+};
 
-		cairo_set_font_size (c, co->title_size);
-		cairo_set_source_col(c, &co->title_color);
-		cairo_set_line_width(c, 6.0);
-		cairo_move_to(c, (co->img_w / 2) - (co->title_exts.width / 2),
-		                 co->title_exts.height);
-		cairo_show_text(c, co->title);
-		cairo_fill (c);
-		cairo_stroke(c);
+static
+void scene_build(cairo_t *c, struct conf *co, struct scene *sc)
+{
+	struct sort_key *k;
+	unsigned long long t;
+	double mx;
+	double my;
+	double m;
+
+	sc->co = co;
+	sc->p = pie_layout(c, co, &sc->leg, &sc->lab);
+	sc->start = malloc(sizeof(struct portion *) * co->nb);
+	sc->stop = malloc(sizeof(struct portion *) * co->nb);
+	sc->round = malloc(sizeof(struct portion *) * co->nb);
+	k = malloc(sizeof(struct sort_key) * co->nb);
+	if (sc->start == NULL || sc->stop == NULL || sc->round == NULL ||
+	    k == NULL) {
+		fprintf(stderr, "Memory error\n");
+		exit(1);
 	}
+	STATS_ADD(allocs, 4);
 
-	/* draw legend */
-	if (co->draw_leg == 1) {
-
-		cairo_select_font_face (c, "Sans", CAIRO_FONT_SLANT_NORMAL,
-		                        CAIRO_FONT_WEIGHT_NORMAL);
-		cairo_set_font_size (c, co->leg_size);
-
-		y = co->margin + co->title_exts.height + co->pie_h;
+	/* on ne dessine pas les faces caches
+	 *
+	 *  - rounded  haut gauche et haut droit
+	 *  - stop     bas gauce et haut gauche
+	 *  - start    haut droit et bas droit
+	 */
 
-#define DECFAC 0.15f
-
-		a1.x = co->margin + ( dec * DECFAC );
-		a1.y = dec * DECFAC;
-		a2.x = co->margin + ( dec * (1.0f-DECFAC) );
-		a2.y = dec * (1.0f-DECFAC);
+	/* on dessine en premier els piece qui se font ecraser
+	 *
+	 *  - start    partie gauche du haut vers le bas (a l'envers)
+	 *  - stop     partie droite du hat vers le bas (a l'endroit)
+	 *  - rounded  commence ou termine dans la partie basse
+	 */
 
-		for (i=0; i<co->nb; i++) {
+	/* the margin of the culling: the antialiased pixels in the unit of
+	 * the drawing, the chords of the arcs under the ellipse and the
+	 * half line painted out of the faces
+	 */
+	mx = FACE_AA;
+	my = 0;
+	cairo_device_to_user_distance(c, &mx, &my);
+	m = hypot(mx, my);
+	mx = 0;
+	my = FACE_AA;
+	cairo_device_to_user_distance(c, &mx, &my);
+	if (m < hypot(mx, my))
+		m = hypot(mx, my);
+	m += ( co->rx * co->arc_step * co->arc_step / 8.0 ) +
+	     ( co->line_width / 2.0 );
+
+	t = stats_start();
+	sc->nstart = 0;
+	sc->nstop = 0;
+	sc->nround = 0;
+	if (co->height > 0.0f) {
+		sort_start(sc->p, co->nb, k, sc->start, &sc->nstart);
+		cull_faces(co, sc->p, co->nb, sc->start, &sc->nstart, 1, m);
+		sort_stop(sc->p, co->nb, k, sc->stop, &sc->nstop);
+		cull_faces(co, sc->p, co->nb, sc->stop, &sc->nstop, 0, m);
+		sort_rounded(sc->p, co->nb, k, sc->round, &sc->nround);
+	}
+	free(k);
+	STATS_PHASE(PIE_PHASE_SORT, t);
+}
 
-			cairo_new_path(c);
-			cairo_move_to(c, a1.x, a1.y+y);
-			cairo_line_to(c, a2.x, a1.y+y);
-			cairo_line_to(c, a2.x, a2.y+y);
-			cairo_line_to(c, a1.x, a2.y+y);
-			cairo_line_to(c, a1.x, a1.y+y);
-			//cairo_rectangle(c, a1.x, a1.y+y, a2.x, a2.y+y);
+static
+void scene_free(struct scene *sc)
+{
+	free(sc->p);
+	free(sc->leg.line);
+	free(sc->lab.lab);
+	free(sc->start);
+	free(sc->stop);
+	free(sc->round);
+}
 
-			/* fill */
-			cairo_set_line_width(c, 0.0);
-			cairo_set_source_col(c, &p[i].light);
-			cairo_fill_preserve(c);
+static inline
+void legend_swatch(cairo_t *c, struct legend *l, double dec)
+{
+	double x1 = l->x + ( dec * DECFAC );
+	double y1 = l->y + ( dec * DECFAC );
+	double x2 = l->x + ( dec * (1.0f-DECFAC) );
+	double y2 = l->y + ( dec * (1.0f-DECFAC) );
+
+	cairo_move_to(c, x1, y1);
+	cairo_line_to(c, x2, y1);
+	cairo_line_to(c, x2, y2);
+	cairo_line_to(c, x1, y2);
+	cairo_line_to(c, x1, y1);
+	STATS_ADD(segments, 4);
+}
 
-			/* trace line */
-			cairo_set_line_width(c, 1.0f);
-			cairo_set_source_rgba(c, 0,0,0,1);
-			cairo_stroke(c);
+static
+void scene_draw(cairo_t *c, struct scene *sc)
+{
+	struct conf *co = sc->co;
+	struct portion *p = sc->p;
+	struct legend_box *lb = &sc->leg;
+	struct legend *l = lb->line;
+	struct label *lab = sc->lab.lab;
+	struct color *col;
+	int i;
+	unsigned long long t;
 
-			/* draw text */
-			cairo_new_path(c);
-			cairo_move_to(c, co->margin + dec + ( dec * 0.3f ),
-			                 y - p[i].legend_exts.y_bearing);
-			cairo_set_source_col(c, &co->leg_color);
-			cairo_show_text(c, p[i].legend);
-			cairo_fill (c);
-			cairo_stroke(c);
+	t = stats_start();
 
-			y += dec;
+	/* the default quality keeps the settings of <c> */
+	if (co->quality != PIE_QUALITY_DEFAULT) {
+		cairo_save(c);
+		if (co->quality == PIE_QUALITY_FAST) {
+			cairo_set_antialias(c, CAIRO_ANTIALIAS_FAST);
+			cairo_set_tolerance(c, 0.5);
+		}
+		else {
+			cairo_set_antialias(c, CAIRO_ANTIALIAS_BEST);
+			cairo_set_tolerance(c, 0.05);
 		}
 	}
 
-	/* draw pie */
+	/* draw backgroud */
 
-	/* on ne dessine pas les faces caches
-	 *
-	 *  - rounded  haut gauche et haut droit
-	 *  - stop     bas gauce et haut gauche
-	 *  - start    haut droit et bas droit
-	 */
+	if (co->do_back) {
+		cairo_new_path(c);
+		cairo_rectangle(c, -1, -1, co->img_w+1, co->img_h+1);
+		STATS_ADD(segments, 4);
+		cairo_set_source_col(c, &co->back);
+		cairo_fill(c);
+		cairo_stroke(c);
+	}
 
-	/* on dessine en premier els piece qui se font ecraser
-	 *
-	 *  - start    partie gauche du haut vers le bas (a l'envers)
-	 *  - stop     partie droite du hat vers le bas (a l'endroit)
-	 *  - rounded  commence ou termine dans la partie basse
+	/* draw title */
+	if (co->title) {
+		cairo_new_path(c);
+		cairo_set_font(c, co->title_size);
+		cairo_set_source_col(c, &co->title_color);
+		cairo_set_line_width(c, 6.0);
+		cairo_move_to(c, (co->img_w / 2) - (co->title_exts.width / 2),
+		                 co->title_exts.height);
+		cairo_show_text(c, co->title);
+		cairo_fill (c);
+		cairo_stroke(c);
+	}
+
+	/* draw legend: the swatches of a same colour are filled by one
+	 * path, all the outlines are stroked by one path
 	 */
+	if (lb->nb > 0) {
+		col = NULL;
+		cairo_new_path(c);
+		for (i=0; i<lb->nb; i++) {
+			if (l[i].slice < 0)
+				continue;
+			if (col != NULL &&
+			    memcmp(col, &p[l[i].slice].light, sizeof(struct color)) != 0) {
+				cairo_set_source_col(c, col);
+				cairo_fill(c);
+			}
+			col = &p[l[i].slice].light;
+			legend_swatch(c, &l[i], lb->dec);
+		}
+		if (col != NULL) {
+			cairo_set_source_col(c, col);
+			cairo_fill(c);
 
-	if (co->height > 0.0f) {
+			for (i=0; i<lb->nb; i++)
+				if (l[i].slice >= 0)
+					legend_swatch(c, &l[i], lb->dec);
+			cairo_set_line_width(c, 1.0f);
+			cairo_set_source_rgba(c, 0,0,0,1);
+			cairo_stroke(c);
+		}
 
-		sort_start(p, co->nb, ps, &psnb);
-		for (i=0; i<psnb; i++)
-			draw_face_start(c, ps[i]);
+		/* draw text */
+		cairo_set_font(c, co->leg_size);
+		cairo_set_source_col(c, &co->leg_color);
+		for (i=0; i<lb->nb; i++) {
+			cairo_move_to(c, l[i].x + lb->dec + ( lb->dec * 0.3f ),
+			                 l[i].y - l[i].exts.y_bearing);
+			cairo_show_text(c, l[i].text);
+		}
+	}
 
-		sort_stop(p, co->nb, ps, &psnb);
-		for (i=0; i<psnb; i++)
-			draw_face_stop(c, ps[i]);
+	/* draw pie */
+	for (i=0; i<sc->nstart; i++)
+		draw_face_start(c, sc->start[i]);
 
-		sort_rounded(p, co->nb, ps, &psnb);
-		for (i=0; i<psnb; i++)
-			draw_face_rounded(c, co, ps[i]);
+	for (i=0; i<sc->nstop; i++)
+		draw_face_stop(c, sc->stop[i]);
 
-	}
+	for (i=0; i<sc->nround; i++)
+		draw_face_rounded(c, co, sc->round[i]);
 
 	/*tous les tops */
 	for (i=0; i<co->nb; i++)
 		draw_face_top(c, co, &p[i]);
+
+	/* labels, all the leader lines by one path */
+	if (sc->lab.nb > 0) {
+		cairo_new_path(c);
+		for (i=0; i<sc->lab.nb; i++) {
+			if (lab[i].inside)
+				continue;
+			cairo_move_to(c, lab[i].anchor.x, lab[i].anchor.y);
+			cairo_line_to(c, lab[i].elbow.x, lab[i].elbow.y);
+			cairo_line_to(c, lab[i].end.x, lab[i].end.y);
+			STATS_ADD(segments, 2);
+		}
+		cairo_set_line_width(c, 1.0f);
+		cairo_set_source_col(c, &co->leg_color);
+		cairo_stroke(c);
+
+		cairo_set_font(c, co->leg_size);
+		for (i=0; i<sc->lab.nb; i++) {
+			cairo_move_to(c, lab[i].x, lab[i].y);
+			cairo_show_text(c, co->name[lab[i].slice]);
+		}
+	}
+
+	if (co->quality != PIE_QUALITY_DEFAULT)
+		cairo_restore(c);
+
+	STATS_PHASE(PIE_PHASE_PAINT, t);
+}
+
+void pie_cairo_draw(cairo_t *c, struct conf *co) {
+	struct scene sc;
+
+	scene_build(c, co, &sc);
+	scene_draw(c, &sc);
+	scene_free(&sc);
 }
 
 static
@@ -878,52 +2112,64 @@ cairo_status_t cairo_wr(void *closure, const unsigned char *data, unsigned int l
 	FILE *out = closure;
 
 	fwrite(data, 1, length, out);
+	STATS_ADD(bytes, length);
 
 	return CAIRO_STATUS_SUCCESS;
 }
 
 
-void pie_draw(struct conf *co, int mode, const char *file_out)
+static
+FILE *open_output(const char *file_out)
 {
-	cairo_surface_t *s;
-	cairo_t *c;
 	FILE *out;
 
-	/* open output file */
 	if (strcmp(file_out, "-") == 0)
-		out = stdout;
+		return stdout;
 
-	else {
-		out = fopen(file_out, "w");
-		if (out == NULL) {
-			fprintf(stderr, "can't open output file\n");
-			exit(1);
-		}
+	out = fopen(file_out, "w");
+	if (out == NULL) {
+		fprintf(stderr, "can't open output file\n");
+		exit(1);
 	}
+	return out;
+}
 
-	/* create image */
+static
+cairo_surface_t *create_surface(int mode, cairo_format_t fmt, FILE *out,
+                                double w, double h)
+{
+	cairo_surface_t *s;
 
 	switch (mode) {
 
-	/* PNG */
-	case 1:
-		s = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, co->img_w, co->img_h);
+	/* the palette is built from the ARGB32 pixels */
+	case PIE_PNG8:
+		s = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, w, h);
+		break;
+
+	case PIE_PNG:
+	case PIE_RAW:
+	case PIE_PPM:
+	case PIE_PAM:
+	case PIE_QOI:
+		s = cairo_image_surface_create(fmt, w, h);
 		break;
 
-	/* EPS */
-	case 2:
-		s = cairo_ps_surface_create_for_stream(cairo_wr, out, co->img_w, co->img_h);
+	case PIE_EPS:
+		s = cairo_ps_surface_create_for_stream(cairo_wr, out, w, h);
 		cairo_ps_surface_set_eps(s, 1);
 		break;
 
-	/* SVG */
-	case 3:
-		s = cairo_svg_surface_create_for_stream(cairo_wr, out, co->img_w, co->img_h);
+	case PIE_SVG:
+		s = cairo_svg_surface_create_for_stream(cairo_wr, out, w, h);
+		break;
+
+	case PIE_PDF:
+		s = cairo_pdf_surface_create_for_stream(cairo_wr, out, w, h);
 		break;
 
-	/* PDF */
-	case 4:
-		s = cairo_pdf_surface_create_for_stream(cairo_wr, out, co->img_w, co->img_h);
+	case PIE_PS:
+		s = cairo_ps_surface_create_for_stream(cairo_wr, out, w, h);
 		break;
 
 	default:
@@ -931,27 +2177,1971 @@ void pie_draw(struct conf *co, int mode, const char *file_out)
 		exit(1);
 	}
 
-	/* create cairo */
-	c = cairo_create(s);
+	return s;
+}
 
-	/* trace path */
-	pie_cairo_draw(c, co);
-	cairo_close_path(c);
-	cairo_show_page(c);
+static inline
+void seed_col(unsigned char *seed, const struct color *col, double dark)
+{
+	seed[0] = ( col->r * dark * 255 ) + 0.5;
+	seed[1] = ( col->g * dark * 255 ) + 0.5;
+	seed[2] = ( col->b * dark * 255 ) + 0.5;
+	seed[3] = ( col->a * 255 ) + 0.5;
+}
+
+/* The colours the chart draws without antialiasing: the faces, the
+ * ends of the gradients, the lines, the texts and the background.
+ */
+static
+unsigned char (*palette_seeds(struct conf *co, int *nb))[4]
+{
+	unsigned char (*seeds)[4];
+	struct color col;
+	int n = 0;
+	int i;
+
+	seeds = malloc(( ( co->nb * 3 ) + 5 ) * sizeof(*seeds));
+	if (seeds == NULL) {
+		fprintf(stderr, "Memory error\n");
+		exit(1);
+	}
+	STATS_ADD(allocs, 1);
+
+	memset(seeds[n++], 0, 4);
+	if (co->do_back)
+		seed_col(seeds[n++], &co->back, 1);
+	seed_col(seeds[n++], &co->line_color, 1);
+	if (co->title != NULL)
+		seed_col(seeds[n++], &co->title_color, 1);
+	if (co->draw_leg || co->draw_lab)
+		seed_col(seeds[n++], &co->leg_color, 1);
+	for (i=0; i<co->nb; i++) {
+		convert_rgba_hex(co->color[i], 0xff, &col);
+		seed_col(seeds[n++], &col, 1);
+		seed_col(seeds[n++], &col, 0.5);
+		seed_col(seeds[n++], &col, 0.1);
+	}
+
+	*nb = n;
+	return seeds;
+}
+
+static
+void write_surface(struct conf *co, cairo_surface_t *s, cairo_t *c, int mode,
+                   FILE *out)
+{
+	unsigned char (*seeds)[4];
+	int nseeds;
+	unsigned long long t;
 
 	/* write image */
-	if (mode == 1)
-		cairo_surface_write_to_png_stream(s, cairo_wr, out);
+	t = stats_start();
+	switch (mode) {
+
+	case PIE_PNG:
+		encode_png(s, co->z_level, co->z_filter, co->threads, cairo_wr, out);
+		break;
+
+	case PIE_PNG8:
+		seeds = palette_seeds(co, &nseeds);
+		encode_png8(s, (const unsigned char (*)[4])seeds, nseeds,
+		            co->z_level, co->threads, cairo_wr, out);
+		free(seeds);
+		break;
+
+	case PIE_RAW:
+		encode_raw(s, cairo_wr, out);
+		break;
+
+	case PIE_PPM:
+		encode_ppm(s, cairo_wr, out);
+		break;
+
+	case PIE_PAM:
+		encode_pam(s, cairo_wr, out);
+		break;
+
+	case PIE_QOI:
+		encode_qoi(s, cairo_wr, out);
+		break;
 
 	/* general vectoriel */
-	else {
+	default:
 		cairo_surface_flush(s);
 		cairo_surface_finish(s);
-		cairo_surface_destroy(s);
-		cairo_destroy(c);
+		break;
 	}
+	cairo_destroy(c);
+	cairo_surface_destroy(s);
 
 	/* end */
 	fflush(out);
 	fclose(out);
+	STATS_PHASE(PIE_PHASE_ENCODE, t);
+}
+
+/* Native SVG output. It is written from the layout of the chart
+ * instead of the cairo paths: the ellipses are true arcs, the numbers
+ * have two decimals and the gradients are shared by colour.
+ */
+
+/* <v> with <prec> decimals, without the trailing zeros */
+static
+void num_out(FILE *out, double v, int prec)
+{
+	char b[32];
+	int l;
+
+	l = snprintf(b, sizeof(b), "%.*f", prec, v);
+	while (prec > 0 && b[l - 1] == '0')
+		l--;
+	if (b[l - 1] == '.')
+		l--;
+	b[l] = '\0';
+	if (strcmp(b, "-0") == 0)
+		fputc('0', out);
+	else
+		fputs(b, out);
+}
+
+static inline
+void svg_num(FILE *out, double v)
+{
+	num_out(out, v, 2);
+}
+
+static inline
+void svg_pt(FILE *out, char cmd, double x, double y)
+{
+	fputc(cmd, out);
+	svg_num(out, x);
+	fputc(' ', out);
+	svg_num(out, y);
+}
+
+static
+void svg_col(FILE *out, const char *attr, const struct color *col)
+{
+	fprintf(out, " %s=\"#%02x%02x%02x\"", attr,
+	        (int)( ( col->r * 255 ) + 0.5 ), (int)( ( col->g * 255 ) + 0.5 ),
+	        (int)( ( col->b * 255 ) + 0.5 ));
+	/* fill-opacity, stroke-opacity, but stop-opacity */
+	if (col->a < 1) {
+		if (strcmp(attr, "stop-color") == 0)
+			fputs(" stop-opacity=\"", out);
+		else
+			fprintf(out, " %s-opacity=\"", attr);
+		svg_num(out, col->a);
+		fputc('"', out);
+	}
+}
+
+static
+void svg_text(FILE *out, const char *txt)
+{
+	for (; *txt != '\0'; txt++) {
+		switch (*txt) {
+		case '&': fputs("&amp;", out); break;
+		case '<': fputs("&lt;", out); break;
+		case '>': fputs("&gt;", out); break;
+		default:  fputc(*txt, out); break;
+		}
+	}
+}
+
+/* Elliptic arc from the angle <a0> (the current point) to <a1>, in
+ * pieces of less than a half turn so the large arc flag is always 0.
+ */
+static
+void svg_arc(FILE *out, struct conf *co, struct coord *cent,
+             double a0, double a1)
+{
+	double step;
+	double a;
+	int n;
+	int i;
+
+	n = ( fabs(a1 - a0) / M_PI ) + 1;
+	step = ( a1 - a0 ) / n;
+	for (i=1; i<=n; i++) {
+		a = a0 + ( step * i );
+		fputc('A', out);
+		svg_num(out, co->rx);
+		fputc(' ', out);
+		svg_num(out, co->ry);
+		fputs(a1 > a0 ? " 0 0 1 " : " 0 0 0 ", out);
+		svg_num(out, ( co->rx * cos(a) ) + cent->x);
+		fputc(' ', out);
+		svg_num(out, ( co->ry * sin(a) ) + cent->y);
+	}
+}
+
+static
+void svg_side(FILE *out, struct portion *p, struct coord *t, struct coord *b)
+{
+	fputs("<path d=\"", out);
+	svg_pt(out, 'M', p->t_cent.x, p->t_cent.y);
+	svg_pt(out, 'L', t->x, t->y);
+	svg_pt(out, 'L', b->x, b->y);
+	svg_pt(out, 'L', p->b_cent.x, p->b_cent.y);
+	fputs("Z\"", out);
+	svg_col(out, "fill", &p->dark);
+	fputs("/>\n", out);
+}
+
+static
+void svg_rounded(FILE *out, struct conf *co, struct portion *p, int grad)
+{
+	struct coord tstrt;
+	struct coord bstop;
+	double strt;
+	double stop;
+
+	rounded_ends(co, p, &strt, &stop, &tstrt, &bstop);
+
+	fputs("<path d=\"", out);
+	svg_pt(out, 'M', tstrt.x, tstrt.y);
+	svg_arc(out, co, &p->t_cent, strt, stop);
+	svg_pt(out, 'L', bstop.x, bstop.y);
+	svg_arc(out, co, &p->b_cent, stop, strt);
+	if (grad < 0) {
+		fputs("Z\"", out);
+		svg_col(out, "fill", &p->dark);
+		fputs("/>\n", out);
+	}
+	else
+		fprintf(out, "Z\" fill=\"url(#g%d)\"/>\n", grad);
+}
+
+static
+void svg_top(FILE *out, struct conf *co, struct portion *p)
+{
+	fputs("<path d=\"", out);
+	svg_pt(out, 'M', p->t_cent.x, p->t_cent.y);
+	svg_pt(out, 'L', p->t_strt.x, p->t_strt.y);
+	svg_arc(out, co, &p->t_cent, p->ang_strt, p->ang_stop);
+	fputs("Z\"", out);
+	svg_col(out, "fill", &p->light);
+	fputs("/>\n", out);
+}
+
+/* The scene of the outputs written without cairo surface: the texts
+ * are measured with a cairo context on a 1x1 image.
+ */
+static
+void scene_measure(struct conf *co, struct scene *sc)
+{
+	cairo_surface_t *s;
+	cairo_t *c;
+
+	s = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, 1, 1);
+	c = cairo_create(s);
+	scene_build(c, co, sc);
+	cairo_destroy(c);
+	cairo_surface_destroy(s);
+}
+
+static
+void pie_svg_draw(struct conf *co, FILE *out)
+{
+	struct scene sc;
+	struct portion *p;
+	struct portion **pr;
+	struct legend *l;
+	struct label *lab;
+	int *grad;
+	double dec;
+	int prnb;
+	int ndefs;
+	int ngrad;
+	int i;
+	int j;
+	long pos;
+	unsigned long long t;
+
+	scene_measure(co, &sc);
+
+	p = sc.p;
+	dec = sc.leg.dec;
+	pr = sc.round;
+	prnb = sc.nround;
+	grad = malloc(sizeof(int) * co->nb);
+	if (grad == NULL) {
+		fprintf(stderr, "Memory error\n");
+		exit(1);
+	}
+	STATS_ADD(allocs, 1);
+
+	/* the document is written directly, it is the encode phase */
+	t = stats_start();
+	pos = ftell(out);
+
+	fputs("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n", out);
+	fputs("<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"", out);
+	svg_num(out, co->img_w);
+	fputs("\" height=\"", out);
+	svg_num(out, co->img_h);
+	fputs("\" viewBox=\"0 0 ", out);
+	svg_num(out, co->img_w);
+	fputc(' ', out);
+	svg_num(out, co->img_h);
+	fputs("\" font-family=\"sans-serif\">\n", out);
+
+	/* one gradient per colour of the visible rounded faces, none in
+	 * fast quality
+	 */
+	if (co->quality == PIE_QUALITY_FAST) {
+		for (i=0; i<prnb; i++)
+			grad[pr[i] - p] = -1;
+		ndefs = 0;
+	}
+	else
+		ndefs = prnb;
+	if (ndefs > 0)
+		fputs("<defs>\n", out);
+	ngrad = 0;
+	for (i=0; i<ndefs; i++) {
+		for (j=0; j<i; j++) {
+			if (memcmp(&pr[j]->light, &pr[i]->light, sizeof(struct color)) == 0)
+				break;
+		}
+		if (j < i) {
+			grad[pr[i] - p] = grad[pr[j] - p];
+			continue;
+		}
+		grad[pr[i] - p] = ngrad;
+		fprintf(out, "<linearGradient id=\"g%d\" gradientUnits=\"userSpaceOnUse\" x1=\"", ngrad);
+		svg_num(out, co->margin);
+		fputs("\" y1=\"0\" x2=\"", out);
+		svg_num(out, co->margin + co->pie_w);
+		fputs("\" y2=\"256\"><stop", out);
+		svg_col(out, "stop-color", &pr[i]->dark_deg);
+		fputs("/><stop offset=\"1\"", out);
+		svg_col(out, "stop-color", &pr[i]->light);
+		fputs("/></linearGradient>\n", out);
+		ngrad++;
+	}
+	if (ndefs > 0)
+		fputs("</defs>\n", out);
+
+	/* background */
+	if (co->do_back) {
+		fputs("<rect width=\"100%\" height=\"100%\"", out);
+		svg_col(out, "fill", &co->back);
+		fputs("/>\n", out);
+	}
+
+	/* title */
+	if (co->title) {
+		fputs("<text x=\"", out);
+		svg_num(out, (co->img_w / 2) - (co->title_exts.width / 2));
+		fputs("\" y=\"", out);
+		svg_num(out, co->title_exts.height);
+		fputs("\" font-size=\"", out);
+		svg_num(out, co->title_size);
+		fputc('"', out);
+		svg_col(out, "fill", &co->title_color);
+		fputc('>', out);
+		svg_text(out, co->title);
+		fputs("</text>\n", out);
+	}
+
+	/* legend */
+	if (sc.leg.nb > 0) {
+		fputs("<g font-size=\"", out);
+		svg_num(out, co->leg_size);
+		fputc('"', out);
+		svg_col(out, "fill", &co->leg_color);
+		fputs(">\n", out);
+		for (i=0; i<sc.leg.nb; i++) {
+			l = &sc.leg.line[i];
+			if (l->slice >= 0) {
+				fputs("<rect x=\"", out);
+				svg_num(out, l->x + ( dec * DECFAC ));
+				fputs("\" y=\"", out);
+				svg_num(out, l->y + ( dec * DECFAC ));
+				fputs("\" width=\"", out);
+				svg_num(out, dec * ( 1.0f - ( 2.0f * DECFAC ) ));
+				fputs("\" height=\"", out);
+				svg_num(out, dec * ( 1.0f - ( 2.0f * DECFAC ) ));
+				fputc('"', out);
+				svg_col(out, "fill", &p[l->slice].light);
+				fputs(" stroke=\"#000000\"/>\n", out);
+			}
+			fputs("<text x=\"", out);
+			svg_num(out, l->x + dec + ( dec * 0.3f ));
+			fputs("\" y=\"", out);
+			svg_num(out, l->y - l->exts.y_bearing);
+			fputs("\">", out);
+			svg_text(out, l->text);
+			fputs("</text>\n", out);
+		}
+		fputs("</g>\n", out);
+	}
+
+	/* pie, in the same order than pie_cairo_draw() */
+	if (co->line_width > 0) {
+		fputs("<g", out);
+		svg_col(out, "stroke", &co->line_color);
+		fputs(" stroke-width=\"", out);
+		svg_num(out, co->line_width);
+		fputs("\">\n", out);
+	}
+
+	for (i=0; i<sc.nstart; i++)
+		svg_side(out, sc.start[i], &sc.start[i]->t_strt, &sc.start[i]->b_strt);
+
+	for (i=0; i<sc.nstop; i++)
+		svg_side(out, sc.stop[i], &sc.stop[i]->t_stop, &sc.stop[i]->b_stop);
+
+	for (i=0; i<prnb; i++)
+		svg_rounded(out, co, pr[i], grad[pr[i] - p]);
+
+	for (i=0; i<co->nb; i++)
+		svg_top(out, co, &p[i]);
+
+	if (co->line_width > 0)
+		fputs("</g>\n", out);
+
+	/* labels */
+	if (sc.lab.nb > 0) {
+		fputs("<path fill=\"none\" stroke-width=\"1\"", out);
+		svg_col(out, "stroke", &co->leg_color);
+		fputs(" d=\"", out);
+		for (i=0; i<sc.lab.nb; i++) {
+			lab = &sc.lab.lab[i];
+			if (lab->inside)
+				continue;
+			svg_pt(out, 'M', lab->anchor.x, lab->anchor.y);
+			svg_pt(out, 'L', lab->elbow.x, lab->elbow.y);
+			svg_pt(out, 'L', lab->end.x, lab->end.y);
+		}
+		fputs("\"/>\n<g font-size=\"", out);
+		svg_num(out, co->leg_size);
+		fputc('"', out);
+		svg_col(out, "fill", &co->leg_color);
+		fputs(">\n", out);
+		for (i=0; i<sc.lab.nb; i++) {
+			lab = &sc.lab.lab[i];
+			fputs("<text x=\"", out);
+			svg_num(out, lab->x);
+			fputs("\" y=\"", out);
+			svg_num(out, lab->y);
+			fputs("\">", out);
+			svg_text(out, co->name[lab->slice]);
+			fputs("</text>\n", out);
+		}
+		fputs("</g>\n", out);
+	}
+	fputs("</svg>\n", out);
+
+	/* the bytes are known only if the output is a file */
+	if (pos >= 0 && ftell(out) >= pos)
+		STATS_ADD(bytes, ftell(out) - pos);
+	STATS_PHASE(PIE_PHASE_ENCODE, t);
+
+	scene_free(&sc);
+	free(grad);
+}
+
+/* Geometry export: the layout and the painter order, for a client
+ * which draws the chart itself. The faces are drawn in this order: the
+ * start faces, the stop faces, the rounded faces, then the tops of all
+ * the slices. A slice is the top ellipse sector of centre <c> from <a0>
+ * to <a1>, the bottom is <depth> lower. Only the visible start and stop
+ * faces are listed. A rounded face is the band under the arc from its
+ * own <a0> to <a1>.
+ *
+ * The binary form is little endian, u32 integers and f32 reals, colours
+ * as 4 bytes r g b a, strings as an u32 length and the bytes:
+ *
+ *   "PIEG" u32 version
+ *   u32 w h nb nstart nstop nround
+ *   f32 rx ry cx cy depth line_width, colour line
+ *   nb * ( f32 a0 a1 x y value, colour light dark grad )
+ *   nstart * u32 slice, nstop * u32 slice
+ *   nround * ( u32 slice, f32 a0 a1 )
+ *   string title, f32 x y size, colour title
+ *   u32 nleg, f32 size dec w, colour legend
+ *   nleg * ( i32 slice, f32 x y ), string more
+ *   u32 nlab, f32 size, colour label
+ *   nlab * ( u32 slice inside, f32 x y, f32 box x y w h,
+ *            f32 anchor x y elbow x y end x y )
+ *   nb * string name
+ *
+ * The legend lines are <dec> high, in columns <w> wide, a line of the
+ * slice -1 is the "+N more" line of the text <more>. A label is the
+ * name of its slice at the text origin <x> <y>, in its <box>. The
+ * leader line of a label beside the pie goes from <anchor> to <elbow>
+ * then <end>, the labels inside their top have none.
+ *
+ * The JSON colours are "#rrggbb", or "#rrggbbaa" when translucent.
+ */
+#define GEOM_VERSION 3
+
+static
+void geom_str(FILE *out, const char *txt)
+{
+	fputc('"', out);
+	for (; *txt != '\0'; txt++) {
+		if (*txt == '"' || *txt == '\\')
+			fprintf(out, "\\%c", *txt);
+		else if ((unsigned char)*txt < 0x20)
+			fprintf(out, "\\u%04x", (unsigned char)*txt);
+		else
+			fputc(*txt, out);
+	}
+	fputc('"', out);
+}
+
+static
+void geom_col(FILE *out, const char *key, const struct color *col)
+{
+	fprintf(out, ",\"%s\":\"#%02x%02x%02x", key,
+	        (int)( ( col->r * 255 ) + 0.5 ), (int)( ( col->g * 255 ) + 0.5 ),
+	        (int)( ( col->b * 255 ) + 0.5 ));
+	if (col->a < 1)
+		fprintf(out, "%02x", (int)( ( col->a * 255 ) + 0.5 ));
+	fputc('"', out);
+}
+
+static inline
+void geom_num(FILE *out, const char *key, double v)
+{
+	fprintf(out, ",\"%s\":", key);
+	num_out(out, v, 2);
+}
+
+static
+void geom_json(FILE *out, struct scene *sc)
+{
+	struct conf *co = sc->co;
+	struct portion *p = sc->p;
+	struct legend *l;
+	struct label *lab;
+	struct coord tstrt;
+	struct coord bstop;
+	double strt;
+	double stop;
+	int i;
+
+	fputs("{\"w\":", out);
+	num_out(out, co->img_w, 0);
+	geom_num(out, "h", co->img_h);
+	geom_num(out, "rx", co->rx);
+	geom_num(out, "ry", co->ry);
+	geom_num(out, "cx", co->cx);
+	geom_num(out, "cy", co->cy);
+	geom_num(out, "depth", co->height * co->ry);
+	geom_num(out, "line_width", co->line_width);
+	geom_col(out, "line", &co->line_color);
+
+	fputs(",\"title\":", out);
+	if (co->title) {
+		fputs("{\"text\":", out);
+		geom_str(out, co->title);
+		geom_num(out, "x", (co->img_w / 2) - (co->title_exts.width / 2));
+		geom_num(out, "y", co->title_exts.height);
+		geom_num(out, "size", co->title_size);
+		geom_col(out, "color", &co->title_color);
+		fputc('}', out);
+	}
+	else
+		fputs("null", out);
+
+	fputs(",\"legend\":", out);
+	if (sc->leg.nb > 0) {
+		fputs("{\"size\":", out);
+		num_out(out, co->leg_size, 2);
+		geom_num(out, "dec", sc->leg.dec);
+		geom_num(out, "w", sc->leg.w);
+		geom_col(out, "color", &co->leg_color);
+		fputs(",\"lines\":[", out);
+		for (i=0; i<sc->leg.nb; i++) {
+			l = &sc->leg.line[i];
+			fprintf(out, i > 0 ? ",{\"slice\":%d" : "{\"slice\":%d", l->slice);
+			geom_num(out, "x", l->x);
+			geom_num(out, "y", l->y);
+			if (l->slice < 0) {
+				fputs(",\"text\":", out);
+				geom_str(out, l->text);
+			}
+			fputc('}', out);
+		}
+		fputs("]}", out);
+	}
+	else
+		fputs("null", out);
+
+	fputs(",\"labels\":", out);
+	if (sc->lab.nb > 0) {
+		fputs("{\"size\":", out);
+		num_out(out, co->leg_size, 2);
+		geom_col(out, "color", &co->leg_color);
+		fputs(",\"lines\":[", out);
+		for (i=0; i<sc->lab.nb; i++) {
+			lab = &sc->lab.lab[i];
+			fprintf(out, i > 0 ? ",{\"slice\":%d" : "{\"slice\":%d",
+			        lab->slice);
+			geom_num(out, "x", lab->x);
+			geom_num(out, "y", lab->y);
+			fputs(",\"box\":[", out);
+			num_out(out, lab->bx, 2);
+			fputc(',', out);
+			num_out(out, lab->by, 2);
+			fputc(',', out);
+			num_out(out, lab->bw, 2);
+			fputc(',', out);
+			num_out(out, lab->bh, 2);
+			fputc(']', out);
+			if (!lab->inside) {
+				fputs(",\"leader\":[", out);
+				num_out(out, lab->anchor.x, 2);
+				fputc(',', out);
+				num_out(out, lab->anchor.y, 2);
+				fputc(',', out);
+				num_out(out, lab->elbow.x, 2);
+				fputc(',', out);
+				num_out(out, lab->elbow.y, 2);
+				fputc(',', out);
+				num_out(out, lab->end.x, 2);
+				fputc(',', out);
+				num_out(out, lab->end.y, 2);
+				fputc(']', out);
+			}
+			fputc('}', out);
+		}
+		fputs("]}", out);
+	}
+	else
+		fputs("null", out);
+
+	fputs(",\"slices\":[", out);
+	for (i=0; i<co->nb; i++) {
+		fputs(i > 0 ? ",{\"name\":" : "{\"name\":", out);
+		geom_str(out, co->name[i]);
+		fputs(",\"value\":", out);
+		num_out(out, co->part[i], 6);
+		fputs(",\"a0\":", out);
+		num_out(out, p[i].ang_strt, 6);
+		fputs(",\"a1\":", out);
+		num_out(out, p[i].ang_stop, 6);
+		fputs(",\"c\":[", out);
+		num_out(out, p[i].t_cent.x, 2);
+		fputc(',', out);
+		num_out(out, p[i].t_cent.y, 2);
+		fputc(']', out);
+		geom_col(out, "light", &p[i].light);
+		geom_col(out, "dark", &p[i].dark);
+		geom_col(out, "grad", &p[i].dark_deg);
+		fputc('}', out);
+	}
+
+	fputs("],\"start\":[", out);
+	for (i=0; i<sc->nstart; i++)
+		fprintf(out, i > 0 ? ",%d" : "%d", (int)( sc->start[i] - p ));
+
+	fputs("],\"stop\":[", out);
+	for (i=0; i<sc->nstop; i++)
+		fprintf(out, i > 0 ? ",%d" : "%d", (int)( sc->stop[i] - p ));
+
+	fputs("],\"rounded\":[", out);
+	for (i=0; i<sc->nround; i++) {
+		rounded_ends(co, sc->round[i], &strt, &stop, &tstrt, &bstop);
+		fprintf(out, i > 0 ? ",[%d," : "[%d,", (int)( sc->round[i] - p ));
+		num_out(out, strt, 6);
+		fputc(',', out);
+		num_out(out, stop, 6);
+		fputc(']', out);
+	}
+	fputs("]}\n", out);
+}
+
+static
+void geom_u32(FILE *out, unsigned int v)
+{
+	unsigned char b[4];
+
+	b[0] = v;
+	b[1] = v >> 8;
+	b[2] = v >> 16;
+	b[3] = v >> 24;
+	fwrite(b, 1, 4, out);
+}
+
+static
+void geom_f32(FILE *out, double v)
+{
+	unsigned int u;
+	float f = v;
+
+	memcpy(&u, &f, 4);
+	geom_u32(out, u);
+}
+
+/* the default colours have an alpha of 255, cairo clamps it to 1 */
+static inline
+int geom_byte(double v)
+{
+	if (v > 1)
+		v = 1;
+	if (v < 0)
+		v = 0;
+	return (int)( ( v * 255 ) + 0.5 );
+}
+
+static
+void geom_rgba(FILE *out, const struct color *col)
+{
+	fputc(geom_byte(col->r), out);
+	fputc(geom_byte(col->g), out);
+	fputc(geom_byte(col->b), out);
+	fputc(geom_byte(col->a), out);
+}
+
+static
+void geom_bstr(FILE *out, const char *txt)
+{
+	geom_u32(out, txt == NULL ? 0 : strlen(txt));
+	if (txt != NULL)
+		fputs(txt, out);
+}
+
+static
+void geom_bin(FILE *out, struct scene *sc)
+{
+	struct conf *co = sc->co;
+	struct portion *p = sc->p;
+	struct legend *l;
+	struct label *lab;
+	struct coord tstrt;
+	struct coord bstop;
+	char *more;
+	double strt;
+	double stop;
+	int i;
+
+	fputs("PIEG", out);
+	geom_u32(out, GEOM_VERSION);
+	geom_u32(out, co->img_w);
+	geom_u32(out, co->img_h);
+	geom_u32(out, co->nb);
+	geom_u32(out, sc->nstart);
+	geom_u32(out, sc->nstop);
+	geom_u32(out, sc->nround);
+	geom_f32(out, co->rx);
+	geom_f32(out, co->ry);
+	geom_f32(out, co->cx);
+	geom_f32(out, co->cy);
+	geom_f32(out, co->height * co->ry);
+	geom_f32(out, co->line_width);
+	geom_rgba(out, &co->line_color);
+
+	for (i=0; i<co->nb; i++) {
+		geom_f32(out, p[i].ang_strt);
+		geom_f32(out, p[i].ang_stop);
+		geom_f32(out, p[i].t_cent.x);
+		geom_f32(out, p[i].t_cent.y);
+		geom_f32(out, co->part[i]);
+		geom_rgba(out, &p[i].light);
+		geom_rgba(out, &p[i].dark);
+		geom_rgba(out, &p[i].dark_deg);
+	}
+
+	for (i=0; i<sc->nstart; i++)
+		geom_u32(out, sc->start[i] - p);
+	for (i=0; i<sc->nstop; i++)
+		geom_u32(out, sc->stop[i] - p);
+	for (i=0; i<sc->nround; i++) {
+		rounded_ends(co, sc->round[i], &strt, &stop, &tstrt, &bstop);
+		geom_u32(out, sc->round[i] - p);
+		geom_f32(out, strt);
+		geom_f32(out, stop);
+	}
+
+	geom_bstr(out, co->title);
+	geom_f32(out, (co->img_w / 2) - (co->title_exts.width / 2));
+	geom_f32(out, co->title_exts.height);
+	geom_f32(out, co->title_size);
+	geom_rgba(out, &co->title_color);
+
+	geom_u32(out, sc->leg.nb);
+	geom_f32(out, co->leg_size);
+	geom_f32(out, sc->leg.dec);
+	geom_f32(out, sc->leg.w);
+	geom_rgba(out, &co->leg_color);
+	more = "";
+	for (i=0; i<sc->leg.nb; i++) {
+		l = &sc->leg.line[i];
+		geom_u32(out, (unsigned int)l->slice);
+		geom_f32(out, l->x);
+		geom_f32(out, l->y);
+		if (l->slice < 0)
+			more = l->text;
+	}
+	geom_bstr(out, more);
+
+	geom_u32(out, sc->lab.nb);
+	geom_f32(out, co->leg_size);
+	geom_rgba(out, &co->leg_color);
+	for (i=0; i<sc->lab.nb; i++) {
+		lab = &sc->lab.lab[i];
+		geom_u32(out, lab->slice);
+		geom_u32(out, lab->inside);
+		geom_f32(out, lab->x);
+		geom_f32(out, lab->y);
+		geom_f32(out, lab->bx);
+		geom_f32(out, lab->by);
+		geom_f32(out, lab->bw);
+		geom_f32(out, lab->bh);
+		geom_f32(out, lab->anchor.x);
+		geom_f32(out, lab->anchor.y);
+		geom_f32(out, lab->elbow.x);
+		geom_f32(out, lab->elbow.y);
+		geom_f32(out, lab->end.x);
+		geom_f32(out, lab->end.y);
+	}
+
+	for (i=0; i<co->nb; i++)
+		geom_bstr(out, co->name[i]);
+}
+
+static
+void pie_geom_draw(struct conf *co, int mode, FILE *out)
+{
+	struct scene sc;
+	unsigned long long t;
+	long pos;
+
+	scene_measure(co, &sc);
+
+	t = stats_start();
+	pos = ftell(out);
+	if (mode == PIE_GEOM_BIN)
+		geom_bin(out, &sc);
+	else
+		geom_json(out, &sc);
+	if (pos >= 0 && ftell(out) >= pos)
+		STATS_ADD(bytes, ftell(out) - pos);
+	STATS_PHASE(PIE_PHASE_ENCODE, t);
+
+	scene_free(&sc);
+}
+
+/* Hit test: the slice painted at a point of the image. The layout is
+ * computed once; a point is tested against the portions found by a
+ * binary search on the angles, and their neighbours, as the culling
+ * does. The faces are tested in the reverse painter order: the labels,
+ * the tops, the rounded faces, the stop faces then the start faces.
+ * The labels are indexed by rows of one text line: a row lists the
+ * labels whose text or leader line crosses it.
+ */
+struct pie_hit {
+	struct conf co; /* copy of the chart, only its geometry is read */
+	struct portion *p;
+	int *rank; /* painter rank of the start, stop and rounded faces */
+	int big; /* the portion of more than a half turn, or -1 */
+	struct legend_box leg;
+	struct label_box lab;
+	int *lab_row; /* first entry of each row in <lab_idx>, nrow + 1 */
+	int *lab_idx;
+	int nrow;
+};
+
+/* the rows of the labels index crossed by the label <l> */
+static inline
+void hit_label_rows(struct pie_hit *h, struct label *l, int *r0, int *r1)
+{
+	double y0 = l->by;
+	double y1 = l->by + l->bh;
+
+	/* the end is at the height of the elbow */
+	if (!l->inside) {
+		if (y0 > l->anchor.y - LAB_HIT)
+			y0 = l->anchor.y - LAB_HIT;
+		if (y0 > l->elbow.y - LAB_HIT)
+			y0 = l->elbow.y - LAB_HIT;
+		if (y1 < l->anchor.y + LAB_HIT)
+			y1 = l->anchor.y + LAB_HIT;
+		if (y1 < l->elbow.y + LAB_HIT)
+			y1 = l->elbow.y + LAB_HIT;
+	}
+	*r0 = (int)floor(y0 / h->lab.dec);
+	*r1 = (int)floor(y1 / h->lab.dec);
+	if (*r0 < 0)
+		*r0 = 0;
+	if (*r1 > h->nrow - 1)
+		*r1 = h->nrow - 1;
+}
+
+static
+void hit_label_index(struct pie_hit *h)
+{
+	int r0;
+	int r1;
+	int i;
+	int r;
+
+	h->lab_row = NULL;
+	h->lab_idx = NULL;
+	h->nrow = 0;
+	if (h->lab.nb == 0 || h->lab.dec <= 0)
+		return;
+
+	h->nrow = (int)( h->co.img_h / h->lab.dec ) + 1;
+	h->lab_row = calloc(h->nrow + 1, sizeof(int));
+	if (h->lab_row == NULL) {
+		fprintf(stderr, "Memory error\n");
+		exit(1);
+	}
+	STATS_ADD(allocs, 1);
+
+	/* count the entries of each row, then place them */
+	for (i=0; i<h->lab.nb; i++) {
+		hit_label_rows(h, &h->lab.lab[i], &r0, &r1);
+		for (r=r0; r<=r1; r++)
+			h->lab_row[r + 1]++;
+	}
+	for (r=0; r<h->nrow; r++)
+		h->lab_row[r + 1] += h->lab_row[r];
+	h->lab_idx = malloc(sizeof(int) * ( h->lab_row[h->nrow] + 1 ));
+	if (h->lab_idx == NULL) {
+		fprintf(stderr, "Memory error\n");
+		exit(1);
+	}
+	STATS_ADD(allocs, 1);
+	for (i=0; i<h->lab.nb; i++) {
+		hit_label_rows(h, &h->lab.lab[i], &r0, &r1);
+		for (r=r0; r<=r1; r++)
+			h->lab_idx[h->lab_row[r]++] = i;
+	}
+	for (r=h->nrow; r>0; r--)
+		h->lab_row[r] = h->lab_row[r - 1];
+	h->lab_row[0] = 0;
+}
+
+struct pie_hit *pie_hit_new(struct conf *co)
+{
+	struct pie_hit *h;
+	struct scene sc;
+	int nb;
+	int i;
+
+	h = malloc(sizeof(struct pie_hit));
+	if (h == NULL)
+		return NULL;
+	STATS_ADD(allocs, 1);
+
+	scene_measure(co, &sc);
+	memcpy(&h->co, co, sizeof(struct conf));
+	nb = co->nb;
+
+	h->rank = malloc(sizeof(int) * 3 * ( nb > 0 ? nb : 1 ));
+	if (h->rank == NULL) {
+		fprintf(stderr, "Memory error\n");
+		exit(1);
+	}
+	STATS_ADD(allocs, 1);
+	for (i=0; i<3*nb; i++)
+		h->rank[i] = -1;
+	for (i=0; i<sc.nstart; i++)
+		h->rank[sc.start[i] - sc.p] = i;
+	for (i=0; i<sc.nstop; i++)
+		h->rank[nb + ( sc.stop[i] - sc.p )] = i;
+	for (i=0; i<sc.nround; i++)
+		h->rank[( 2 * nb ) + ( sc.round[i] - sc.p )] = i;
+
+	h->big = -1;
+	for (i=0; i<nb; i++)
+		if (sc.p[i].ang_stop - sc.p[i].ang_strt > M_PI)
+			h->big = i;
+
+	/* the portions, the legend and the labels are kept */
+	h->p = sc.p;
+	sc.p = NULL;
+	h->leg = sc.leg;
+	sc.leg.line = NULL;
+	h->lab = sc.lab;
+	sc.lab.lab = NULL;
+	scene_free(&sc);
+
+	hit_label_index(h);
+	return h;
+}
+
+void pie_hit_free(struct pie_hit *h)
+{
+	free(h->p);
+	free(h->rank);
+	free(h->leg.line);
+	free(h->lab.lab);
+	free(h->lab_row);
+	free(h->lab_idx);
+	free(h);
+}
+
+/* distance from the point to the segment <a> <b> */
+static inline
+double segment_dist(struct coord *a, struct coord *b, double x, double y)
+{
+	double dx = b->x - a->x;
+	double dy = b->y - a->y;
+	double l = ( dx * dx ) + ( dy * dy );
+	double u;
+
+	u = l > 0 ? ( ( ( x - a->x ) * dx ) + ( ( y - a->y ) * dy ) ) / l : 0;
+	if (u < 0)
+		u = 0;
+	if (u > 1)
+		u = 1;
+	dx = x - ( a->x + ( u * dx ) );
+	dy = y - ( a->y + ( u * dy ) );
+	return sqrt(( dx * dx ) + ( dy * dy ));
+}
+
+/* the point is on the side face <a> <b>, down to <depth> */
+static inline
+int side_covers(struct coord *a, struct coord *b, double depth, double x,
+                double y)
+{
+	double u;
+	double v;
+
+	if (b->x == a->x || depth <= 0)
+		return 0;
+	u = ( x - a->x ) / ( b->x - a->x );
+	if (u < 0 || u > 1)
+		return 0;
+	v = ( y - ( a->y + ( u * ( b->y - a->y ) ) ) ) / depth;
+	return v >= 0 && v <= 1;
+}
+
+/* angle of the point from the centre of the pie, 0 to 2 PI */
+static inline
+double hit_angle(struct conf *co, double x, double y)
+{
+	double a;
+
+	a = atan2((y - co->cy) / co->ry, (x - co->cx) / co->rx);
+	if (a < 0)
+		a += 2.0 * M_PI;
+	return a;
+}
+
+/* Returns the slice painted at <x> <y>, the legend lines and the labels
+ * included, or -1.
+ *
+ * A point of a top is in the angles of its portion, seen from the
+ * centre of the pie: the top is its sector moved along its middle
+ * angle. So a binary search finds it, except for the portion of more
+ * than a half turn, tested apart. The rounded and side faces are under
+ * the border of their top: their portion is in the angles covered by
+ * the segment from the point to one depth higher. The cost is a binary
+ * search, plus the portions in these angles for the points off the
+ * tops.
+ */
+int pie_hit_test(struct pie_hit *h, double x, double y)
+{
+	struct legend_box *lb;
+	struct label *l;
+	struct conf *co = &h->co;
+	struct portion *p = h->p;
+	double depth;
+	double a0;
+	double a1;
+	double t;
+	int best;
+	int rank;
+	int nb = co->nb;
+	int n;
+	int s;
+	int i;
+	int j;
+	int k;
+
+	if (nb == 0 || x < 0 || y < 0 || x >= co->img_w || y >= co->img_h)
+		return -1;
+
+	/* labels, painted last: the texts over the leader lines */
+	if (h->nrow > 0) {
+		j = (int)( y / h->lab.dec );
+		if (j > h->nrow - 1)
+			j = h->nrow - 1;
+		for (i=h->lab_row[j]; i<h->lab_row[j + 1]; i++) {
+			l = &h->lab.lab[h->lab_idx[i]];
+			if (x >= l->bx && x < l->bx + l->bw &&
+			    y >= l->by && y < l->by + l->bh)
+				return l->slice;
+		}
+		for (i=h->lab_row[j]; i<h->lab_row[j + 1]; i++) {
+			l = &h->lab.lab[h->lab_idx[i]];
+			if (!l->inside &&
+			    ( segment_dist(&l->anchor, &l->elbow, x, y) <= LAB_HIT ||
+			      segment_dist(&l->elbow, &l->end, x, y) <= LAB_HIT ))
+				return l->slice;
+		}
+	}
+
+	/* legend, a column is its lines then a gap */
+	lb = &h->leg;
+	if (lb->nb > 0 && lb->dec > 0 && x >= lb->x && y >= lb->y) {
+		i = (int)( ( x - lb->x ) / lb->w );
+		j = (int)( ( y - lb->y ) / lb->dec );
+		k = ( i * lb->rows ) + j;
+		if (j < lb->rows && k < lb->nb &&
+		    x < lb->x + ( i * lb->w ) + lb->w - lb->dec)
+			return lb->line[k].slice;
+	}
+
+	if (co->rx <= 0 || co->ry <= 0)
+		return -1;
+
+	/* the tops, drawn in the slices order */
+	best = -1;
+	j = portion_at(p, nb, hit_angle(co, x, y));
+	for (i=-1; i<=1; i++) {
+		k = ( j + i + nb ) % nb;
+		if (k > best && top_covers(co, &p[k], x, y, 0))
+			best = k;
+	}
+	if (h->big > best && top_covers(co, &p[h->big], x, y, 0))
+		best = h->big;
+	if (best >= 0)
+		return best;
+
+	/* The angles seen along the segment increase downward right of
+	 * the centre, upward left of it.
+	 */
+	depth = co->height * co->ry;
+	a0 = hit_angle(co, x, y - depth);
+	a1 = hit_angle(co, x, y);
+	if (x < co->cx) {
+		t = a0;
+		a0 = a1;
+		a1 = t;
+	}
+	j = portion_at(p, nb, a0);
+	n = portion_at(p, nb, a1) - j;
+	if (n < 0 || ( n == 0 && a1 < a0 ))
+		n += nb;
+	n += 3;
+	if (n > nb)
+		n = nb;
+	j = j - 1 + nb;
+
+	/* the rounded faces, then the stop and the start faces, each in
+	 * their painter order
+	 */
+	for (k=2; k>=0; k--) {
+		rank = -1;
+		best = -1;
+		for (i=0; i<n; i++) {
+			s = ( j + i ) % nb;
+			if (h->rank[( k * nb ) + s] <= rank)
+				continue;
+			if (( k == 2 && rounded_covers(co, &p[s], x, y, 0) ) ||
+			    ( k == 1 && side_covers(&p[s].t_cent, &p[s].t_stop,
+			                            depth, x, y) ) ||
+			    ( k == 0 && side_covers(&p[s].t_cent, &p[s].t_strt,
+			                            depth, x, y) )) {
+				rank = h->rank[( k * nb ) + s];
+				best = s;
+			}
+		}
+		if (best >= 0)
+			return best;
+	}
+	return -1;
+}
+
+/* HTML image map of the chart: one area per visible face, legend line,
+ * label text and leader segment, the arcs simplified to about one
+ * pixel. The first area which contains a point wins, so they are
+ * written in the reverse painter order.
+ */
+static
+void map_attr(FILE *out, const char *txt)
+{
+	for (; *txt != '\0'; txt++) {
+		switch (*txt) {
+		case '&': fputs("&amp;", out); break;
+		case '<': fputs("&lt;", out); break;
+		case '>': fputs("&gt;", out); break;
+		case '"': fputs("&quot;", out); break;
+		default:  fputc(*txt, out); break;
+		}
+	}
+}
+
+static inline
+void map_pt(FILE *out, double x, double y, int *first)
+{
+	fprintf(out, *first ? "%d,%d" : ",%d,%d", (int)floor(x + 0.5),
+	        (int)floor(y + 0.5));
+	*first = 0;
+}
+
+static
+void map_arc(FILE *out, struct conf *co, double cx, double cy, double a0,
+             double a1, double step, int *first)
+{
+	double a;
+
+	if (a1 >= a0) {
+		for (a=a0; a<a1; a+=step)
+			map_pt(out, cx + ( co->rx * cos(a) ), cy + ( co->ry * sin(a) ),
+			       first);
+	}
+	else {
+		for (a=a0; a>a1; a-=step)
+			map_pt(out, cx + ( co->rx * cos(a) ), cy + ( co->ry * sin(a) ),
+			       first);
+	}
+	map_pt(out, cx + ( co->rx * cos(a1) ), cy + ( co->ry * sin(a1) ), first);
+}
+
+static
+void map_area(FILE *out, struct conf *co, int i)
+{
+	fprintf(out, "\" href=\"#slice-%d\" data-slice=\"%d\" alt=\"", i, i);
+	map_attr(out, co->name[i]);
+	fputs("\" title=\"", out);
+	map_attr(out, co->name[i]);
+	fputs("\">\n", out);
+}
+
+static
+void map_side(FILE *out, struct conf *co, struct portion *p, int i,
+              struct coord *t, struct coord *b)
+{
+	int first = 1;
+
+	fputs("<area shape=\"poly\" coords=\"", out);
+	map_pt(out, p->t_cent.x, p->t_cent.y, &first);
+	map_pt(out, t->x, t->y, &first);
+	map_pt(out, b->x, b->y, &first);
+	map_pt(out, p->b_cent.x, p->b_cent.y, &first);
+	map_area(out, co, i);
+}
+
+/* the segment <a> <b> of a leader line, LAB_HIT wide on each side */
+static
+void map_leader(FILE *out, struct conf *co, struct coord *a, struct coord *b,
+                int i)
+{
+	double dx = b->x - a->x;
+	double dy = b->y - a->y;
+	double l = sqrt(( dx * dx ) + ( dy * dy ));
+	int first = 1;
+
+	if (l <= 0)
+		return;
+	dx *= LAB_HIT / l;
+	dy *= LAB_HIT / l;
+
+	fputs("<area shape=\"poly\" coords=\"", out);
+	map_pt(out, a->x - dx + dy, a->y - dy - dx, &first);
+	map_pt(out, b->x + dx + dy, b->y + dy - dx, &first);
+	map_pt(out, b->x + dx - dy, b->y + dy + dx, &first);
+	map_pt(out, a->x - dx - dy, a->y - dy + dx, &first);
+	map_area(out, co, i);
+}
+
+void pie_draw_map(struct conf *co, const char *name, const char *file_out)
+{
+	struct scene sc;
+	struct portion *p;
+	struct coord tstrt;
+	struct coord bstop;
+	double strt;
+	double stop;
+	struct legend *l;
+	struct label *lab;
+	double step;
+	FILE *out;
+	int first;
+	int i;
+
+	scene_measure(co, &sc);
+	p = sc.p;
+
+	/* chord error rx * step^2 / 8 of one pixel */
+	step = co->rx > 0 ? sqrt(8.0 / co->rx) : 0.5;
+	if (step > 0.5)
+		step = 0.5;
+
+	out = open_output(file_out);
+	fputs("<map name=\"", out);
+	map_attr(out, name);
+	fputs("\">\n", out);
+
+	/* the labels are painted last, the texts over the leader lines */
+	for (i=0; i<sc.lab.nb; i++) {
+		lab = &sc.lab.lab[i];
+		fprintf(out, "<area shape=\"rect\" coords=\"%d,%d,%d,%d",
+		        (int)floor(lab->bx + 0.5), (int)floor(lab->by + 0.5),
+		        (int)floor(lab->bx + lab->bw + 0.5),
+		        (int)floor(lab->by + lab->bh + 0.5));
+		map_area(out, co, lab->slice);
+	}
+	for (i=0; i<sc.lab.nb; i++) {
+		lab = &sc.lab.lab[i];
+		if (lab->inside)
+			continue;
+		map_leader(out, co, &lab->anchor, &lab->elbow, lab->slice);
+		map_leader(out, co, &lab->elbow, &lab->end, lab->slice);
+	}
+
+	for (i=0; i<sc.leg.nb; i++) {
+		l = &sc.leg.line[i];
+		if (l->slice < 0)
+			continue;
+		fprintf(out, "<area shape=\"rect\" coords=\"%d,%d,%d,%d",
+		        (int)floor(l->x + 0.5), (int)floor(l->y + 0.5),
+		        (int)floor(l->x + sc.leg.w - sc.leg.dec + 0.5),
+		        (int)floor(l->y + sc.leg.dec + 0.5));
+		map_area(out, co, l->slice);
+	}
+
+	for (i=co->nb-1; i>=0; i--) {
+		first = 1;
+		fputs("<area shape=\"poly\" coords=\"", out);
+		map_pt(out, p[i].t_cent.x, p[i].t_cent.y, &first);
+		map_arc(out, co, p[i].t_cent.x, p[i].t_cent.y, p[i].ang_strt,
+		        p[i].ang_stop, step, &first);
+		map_area(out, co, i);
+	}
+
+	for (i=sc.nround-1; i>=0; i--) {
+		rounded_ends(co, sc.round[i], &strt, &stop, &tstrt, &bstop);
+		first = 1;
+		fputs("<area shape=\"poly\" coords=\"", out);
+		map_arc(out, co, sc.round[i]->t_cent.x, sc.round[i]->t_cent.y,
+		        strt, stop, step, &first);
+		map_arc(out, co, sc.round[i]->b_cent.x, sc.round[i]->b_cent.y,
+		        stop, strt, step, &first);
+		map_area(out, co, sc.round[i] - p);
+	}
+
+	for (i=sc.nstop-1; i>=0; i--)
+		map_side(out, co, sc.stop[i], sc.stop[i] - p, &sc.stop[i]->t_stop,
+		         &sc.stop[i]->b_stop);
+
+	for (i=sc.nstart-1; i>=0; i--)
+		map_side(out, co, sc.start[i], sc.start[i] - p,
+		         &sc.start[i]->t_strt, &sc.start[i]->b_strt);
+
+	fputs("</map>\n", out);
+	if (out != stdout)
+		fclose(out);
+	else
+		fflush(out);
+	scene_free(&sc);
+}
+
+/* Band mode: the PNG is drawn by horizontal bands. Each thread draws
+ * the block of lines it compresses into its own small surface, so the
+ * memory used doesn't depend on the image height.
+ */
+#define PIE_BAND_BYTES 1048576
+
+struct band {
+	struct scene sc;
+	cairo_surface_t **s; /* one surface per thread */
+	int *y0; /* first line drawn in the surface */
+};
+
+static
+void band_draw(struct png_src *src, int tid, int y0, int y1)
+{
+	struct band *b = src->arg;
+	cairo_t *c;
+
+	if (b->s[tid] == NULL ||
+	    cairo_image_surface_get_height(b->s[tid]) < y1 - y0) {
+		if (b->s[tid] != NULL)
+			cairo_surface_destroy(b->s[tid]);
+		b->s[tid] = cairo_image_surface_create(b->sc.co->format,
+		                                       src->w, y1 - y0);
+	}
+
+	c = cairo_create(b->s[tid]);
+	cairo_set_operator(c, CAIRO_OPERATOR_CLEAR);
+	cairo_paint(c);
+	cairo_set_operator(c, CAIRO_OPERATOR_OVER);
+	cairo_translate(c, 0, -y0);
+	scene_draw(c, &b->sc);
+	cairo_destroy(c);
+	cairo_surface_flush(b->s[tid]);
+
+	b->y0[tid] = y0;
+}
+
+static
+void band_row(struct png_src *src, int tid, int y, unsigned char *out)
+{
+	struct band *b = src->arg;
+	cairo_surface_t *s = b->s[tid];
+
+	format_row(b->sc.co->format, cairo_image_surface_get_data(s) +
+	           ( ( y - b->y0[tid] ) * cairo_image_surface_get_stride(s) ),
+	           src->w, out);
+}
+
+static
+void pie_draw_band(struct conf *co, FILE *out)
+{
+	struct png_src src;
+	struct band b;
+	cairo_surface_t *s;
+	cairo_t *c;
+	int threads;
+	int i;
+	unsigned long long t;
+
+	threads = co->threads < 1 ? 1 : co->threads;
+
+	/* the texts are measured with a cairo context */
+	s = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, 1, 1);
+	c = cairo_create(s);
+	scene_build(c, co, &b.sc);
+	cairo_destroy(c);
+	cairo_surface_destroy(s);
+
+	b.s = calloc(threads, sizeof(cairo_surface_t *));
+	b.y0 = calloc(threads, sizeof(int));
+	if (b.s == NULL || b.y0 == NULL) {
+		fprintf(stderr, "Memory error\n");
+		exit(1);
+	}
+	STATS_ADD(allocs, 2);
+
+	src.w = co->img_w;
+	src.h = co->img_h;
+	src.bpp = format_channels(co->format);
+	src.rows = co->band;
+	if (src.rows == PIE_BAND_AUTO)
+		src.rows = PIE_BAND_BYTES / ( src.w * format_bpp(co->format) );
+	if (src.rows < 1)
+		src.rows = 1;
+	src.row = band_row;
+	src.band = band_draw;
+	src.arg = &b;
+
+	/* the bands are painted while encoding, the paint time is also
+	 * counted in the encode time.
+	 */
+	t = stats_start();
+	encode_png_src(&src, co->z_level, co->z_filter, threads, cairo_wr, out);
+	STATS_PHASE(PIE_PHASE_ENCODE, t);
+
+	for (i=0; i<threads; i++)
+		if (b.s[i] != NULL)
+			cairo_surface_destroy(b.s[i]);
+	free(b.s);
+	free(b.y0);
+	scene_free(&b.sc);
+}
+
+static
+void pie_anim_out(struct conf **co, int nb, int tween, int delay, FILE *out);
+
+static
+void pie_draw_out(struct conf *co, int mode, FILE *out)
+{
+	cairo_surface_t *s;
+	cairo_t *c;
+
+	if (mode == PIE_APNG) {
+		pie_anim_out(&co, 1, 0, PIE_DELAY, out);
+		return;
+	}
+
+	if (mode == PIE_SVG) {
+		pie_svg_draw(co, out);
+		fflush(out);
+		fclose(out);
+		return;
+	}
+
+	if (mode == PIE_GEOM || mode == PIE_GEOM_BIN) {
+		pie_geom_draw(co, mode, out);
+		fflush(out);
+		fclose(out);
+		return;
+	}
+
+	if (mode == PIE_PNG && co->band != 0) {
+		pie_draw_band(co, out);
+		fflush(out);
+		fclose(out);
+		return;
+	}
+
+	/* create image */
+	s = create_surface(mode, co->format, out, co->img_w, co->img_h);
+
+	/* create cairo */
+	c = cairo_create(s);
+
+	/* trace path */
+	pie_cairo_draw(c, co);
+	cairo_close_path(c);
+	cairo_show_page(c);
+
+	write_surface(co, s, c, mode, out);
+}
+
+static inline
+void cache_hash_col(struct cache_hash *h, const struct color *col)
+{
+	cache_hash_double(h, col->r);
+	cache_hash_double(h, col->g);
+	cache_hash_double(h, col->b);
+	cache_hash_double(h, col->a);
+}
+
+/* The key of a chart in the render cache: everything which changes the
+ * output, once the defaults are applied. The colours are hashed once
+ * converted, so "#FF0000" and "#ff0000" are the same chart. The threads
+ * and the bands only change how the image is made, a chart drawn with
+ * other -j or -B is the same entry.
+ */
+static
+void cache_key(struct conf *co, int mode, char *key)
+{
+	struct cache_hash h;
+	struct color col;
+	int i;
+
+	cache_hash_init(&h);
+	cache_hash_str(&h, "pie-cache-2");
+
+	/* output */
+	cache_hash_int(&h, mode);
+	cache_hash_int(&h, co->format);
+	cache_hash_int(&h, co->z_level);
+	cache_hash_int(&h, co->z_filter);
+	cache_hash_int(&h, co->quality);
+
+	/* options */
+	cache_hash_int(&h, co->do_back);
+	if (co->do_back)
+		cache_hash_col(&h, &co->back);
+	cache_hash_double(&h, co->ratio);
+	cache_hash_double(&h, co->decal);
+	cache_hash_double(&h, co->height);
+	cache_hash_double(&h, co->margin);
+	cache_hash_double(&h, co->img_w);
+	cache_hash_double(&h, co->img_h);
+	cache_hash_double(&h, co->line_width);
+	cache_hash_col(&h, &co->line_color);
+	cache_hash_double(&h, co->title_size);
+	cache_hash_str(&h, co->title);
+	cache_hash_col(&h, &co->title_color);
+	cache_hash_int(&h, co->draw_leg);
+	cache_hash_int(&h, co->leg_page);
+	cache_hash_int(&h, co->draw_lab);
+	cache_hash_double(&h, co->leg_size);
+	cache_hash_col(&h, &co->leg_color);
+
+	/* slices */
+	cache_hash_int(&h, co->nb);
+	for (i=0; i<co->nb; i++) {
+		convert_rgba_hex(co->color[i], 0xff, &col);
+		cache_hash_double(&h, co->part[i]);
+		cache_hash_col(&h, &col);
+		cache_hash_double(&h, co->extract[i]);
+		cache_hash_str(&h, co->name[i]);
+	}
+
+	cache_hash_hex(&h, key);
+}
+
+/* With a cache directory, a chart already drawn is copied from the
+ * cache without cairo. Else it is drawn in a temporary file of the
+ * cache, which becomes the entry.
+ */
+static
+void pie_draw_cached(struct conf *co, int mode, FILE *out)
+{
+	char key[CACHE_KEY_LEN + 1];
+	char tmp[4096];
+	FILE *f;
+
+	cache_key(co, mode, key);
+	if (cache_send(co->cache_dir, key, out)) {
+		fflush(out);
+		fclose(out);
+		return;
+	}
+
+	f = cache_tmp(co->cache_dir, tmp, sizeof(tmp));
+	if (f == NULL) {
+		fprintf(stderr, "can't use the cache directory %s\n", co->cache_dir);
+		pie_draw_out(co, mode, out);
+		return;
+	}
+	pie_draw_out(co, mode, f);
+	cache_put(co->cache_dir, key, tmp, co->cache_max, out);
+	fflush(out);
+	fclose(out);
+}
+
+void pie_draw(struct conf *co, int mode, const char *file_out)
+{
+	FILE *out;
+
+	pie_defaults(co);
+	STATS_ADD(charts, 1);
+
+	/* open output file */
+	out = open_output(file_out);
+
+	if (co->cache_dir != NULL)
+		pie_draw_cached(co, mode, out);
+	else
+		pie_draw_out(co, mode, out);
+}
+
+/* bytes of the raw pixels of <co>, in its surface format */
+size_t pie_raw_size(struct conf *co)
+{
+	pie_defaults(co);
+	return (size_t)cairo_format_stride_for_width(co->format, co->img_w) *
+	       (size_t)co->img_h;
+}
+
+/* Draw <co> in the next frame of the ring <r>: the image surface is
+ * created on the shared memory, the reader maps the pixels without any
+ * copy. Returns the frame number, or 0 if the chart is larger than a
+ * slot.
+ */
+unsigned long long pie_draw_ring(struct conf *co, struct pie_ring *r)
+{
+	cairo_surface_t *s;
+	cairo_t *c;
+	unsigned char *data;
+	size_t len;
+	int stride;
+
+	pie_defaults(co);
+	STATS_ADD(charts, 1);
+
+	stride = cairo_format_stride_for_width(co->format, co->img_w);
+	len = (size_t)stride * (size_t)co->img_h;
+	data = pie_ring_begin(r, len);
+	if (data == NULL) {
+		fprintf(stderr, "chart larger than the ring slots\n");
+		return 0;
+	}
+
+	/* the surface doesn't clear the memory */
+	memset(data, 0, len);
+	s = cairo_image_surface_create_for_data(data, co->format, co->img_w,
+	                                        co->img_h, stride);
+	c = cairo_create(s);
+	pie_cairo_draw(c, co);
+	cairo_destroy(c);
+	cairo_surface_flush(s);
+	cairo_surface_destroy(s);
+
+	return pie_ring_publish(r, co->img_w, co->img_h, stride, co->format, len);
+}
+
+/* Draw <nb> charts on one sheet, <cols> charts per row. The cell size
+ * is the size of the first chart, the others are scaled to fit.
+ */
+void pie_draw_grid(struct conf **co, int nb, int cols, int mode,
+                   const char *file_out)
+{
+	cairo_surface_t *s;
+	cairo_t *c;
+	FILE *out;
+	double cw;
+	double ch;
+	double scale;
+	int rows;
+	int i;
+
+	if (nb < 1)
+		return;
+	if (cols < 1 || cols > nb)
+		cols = nb;
+	rows = (nb + cols - 1) / cols;
+
+	for (i=0; i<nb; i++)
+		pie_defaults(co[i]);
+	STATS_ADD(charts, nb);
+	cw = co[0]->img_w;
+	ch = co[0]->img_h;
+
+	out = open_output(file_out);
+	s = create_surface(mode, co[0]->format, out, cw * cols, ch * rows);
+	c = cairo_create(s);
+
+	for (i=0; i<nb; i++) {
+		cairo_save(c);
+
+		/* cell */
+		cairo_translate(c, (i % cols) * cw, (i / cols) * ch);
+		cairo_new_path(c);
+		cairo_rectangle(c, 0, 0, cw, ch);
+		cairo_clip(c);
+
+		/* chart centered in the cell */
+		scale = cw / co[i]->img_w;
+		if (ch / co[i]->img_h < scale)
+			scale = ch / co[i]->img_h;
+		cairo_translate(c, ( cw - ( co[i]->img_w * scale ) ) / 2.0,
+		                   ( ch - ( co[i]->img_h * scale ) ) / 2.0);
+		cairo_scale(c, scale, scale);
+
+		pie_cairo_draw(c, co[i]);
+		cairo_restore(c);
+	}
+	cairo_show_page(c);
+
+	write_surface(co[0], s, c, mode, out);
+}
+
+/* Draw <nb> charts, one per page of the same PDF or PS document. The
+ * fonts and the other resources are shared by all the pages.
+ */
+void pie_draw_report(struct conf **co, int nb, int mode, const char *file_out)
+{
+	cairo_surface_t *s;
+	cairo_t *c;
+	FILE *out;
+	int i;
+
+	if (mode != PIE_PDF && mode != PIE_PS) {
+		fprintf(stderr, "report mode needs PDF or PS output\n");
+		exit(1);
+	}
+	if (nb < 1)
+		return;
+
+	for (i=0; i<nb; i++)
+		pie_defaults(co[i]);
+	STATS_ADD(charts, nb);
+
+	out = open_output(file_out);
+	s = create_surface(mode, co[0]->format, out, co[0]->img_w, co[0]->img_h);
+	c = cairo_create(s);
+
+	for (i=0; i<nb; i++) {
+
+		/* page size, must be set before drawing on the page */
+		if (mode == PIE_PDF)
+			cairo_pdf_surface_set_size(s, co[i]->img_w, co[i]->img_h);
+		else
+			cairo_ps_surface_set_size(s, co[i]->img_w, co[i]->img_h);
+
+		cairo_save(c);
+		pie_cairo_draw(c, co[i]);
+		cairo_restore(c);
+		cairo_show_page(c);
+	}
+
+	write_surface(co[0], s, c, mode, out);
+}
+
+/* Animation. The charts are the key frames, with <tween> frames
+ * interpolated between two of them. The frames are drawn by waves of
+ * one frame per thread, each in its own surface, then added in order
+ * to the APNG: the memory used doesn't depend on the frame count.
+ */
+
+/* a frame of the wave */
+struct frame {
+	struct conf *co;
+	int own; /* <co> is an interpolated chart */
+	cairo_surface_t *s;
+};
+
+/* The chart at <u> (0 to 1) of the way from <a> to <b>, with the
+ * options of <a>. The slices are matched by position, a slice missing
+ * in a chart has a null value there.
+ */
+static
+struct conf *pie_tween(struct conf *a, struct conf *b, double u)
+{
+	struct conf *co;
+	struct color ca;
+	struct color cb;
+	char col[10];
+	char *name;
+	double va;
+	double vb;
+	double ea;
+	double eb;
+	int n;
+	int i;
+
+	co = pie_new_from(a);
+	if (co == NULL) {
+		fprintf(stderr, "Memory error\n");
+		exit(1);
+	}
+
+	n = a->nb > b->nb ? a->nb : b->nb;
+	for (i=0; i<n; i++) {
+		va = i < a->nb ? a->part[i] : 0;
+		vb = i < b->nb ? b->part[i] : 0;
+		ea = i < a->nb ? a->extract[i] : 0;
+		eb = i < b->nb ? b->extract[i] : 0;
+		convert_rgba_hex(i < a->nb ? a->color[i] : b->color[i], 0xff, &ca);
+		convert_rgba_hex(i < b->nb ? b->color[i] : a->color[i], 0xff, &cb);
+		snprintf(col, sizeof(col), "#%02x%02x%02x%02x",
+		         (int)( ( ( ca.r + ( ( cb.r - ca.r ) * u ) ) * 255 ) + 0.5 ),
+		         (int)( ( ( ca.g + ( ( cb.g - ca.g ) * u ) ) * 255 ) + 0.5 ),
+		         (int)( ( ( ca.b + ( ( cb.b - ca.b ) * u ) ) * 255 ) + 0.5 ),
+		         (int)( ( ( ca.a + ( ( cb.a - ca.a ) * u ) ) * 255 ) + 0.5 ));
+		if (i >= b->nb || ( u < 0.5 && i < a->nb ))
+			name = a->name[i];
+		else
+			name = b->name[i];
+		pie_add(co, va + ( ( vb - va ) * u ), col, ea + ( ( eb - ea ) * u ),
+		        name);
+	}
+	return co;
+}
+
+static
+void *frame_draw(void *arg)
+{
+	struct frame *f = arg;
+	cairo_t *c;
+	double w;
+	double h;
+	double scale;
+
+	w = cairo_image_surface_get_width(f->s);
+	h = cairo_image_surface_get_height(f->s);
+
+	c = cairo_create(f->s);
+	cairo_set_operator(c, CAIRO_OPERATOR_CLEAR);
+	cairo_paint(c);
+	cairo_set_operator(c, CAIRO_OPERATOR_OVER);
+
+	/* charts of an other size are scaled to fit, as in the grid mode */
+	if (f->co->img_w != w || f->co->img_h != h) {
+		scale = w / f->co->img_w;
+		if (h / f->co->img_h < scale)
+			scale = h / f->co->img_h;
+		cairo_translate(c, ( w - ( f->co->img_w * scale ) ) / 2.0,
+		                   ( h - ( f->co->img_h * scale ) ) / 2.0);
+		cairo_scale(c, scale, scale);
+	}
+
+	pie_cairo_draw(c, f->co);
+	cairo_destroy(c);
+	return NULL;
+}
+
+static
+void pie_anim_out(struct conf **co, int nb, int tween, int delay, FILE *out)
+{
+	struct frame *fr;
+	struct apng a;
+	pthread_t *th;
+	unsigned long long t;
+	double u;
+	int threads;
+	int frames;
+	int f0;
+	int k;
+	int n;
+	int i;
+
+	if (tween < 0)
+		tween = 0;
+	if (delay < 0)
+		delay = 0;
+	if (delay > PIE_DELAY_MAX)
+		delay = PIE_DELAY_MAX;
+	frames = ( ( nb - 1 ) * ( tween + 1 ) ) + 1;
+	threads = co[0]->threads < 1 ? 1 : co[0]->threads;
+	if (threads > frames)
+		threads = frames;
+
+	fr = malloc(threads * sizeof(struct frame));
+	th = malloc(threads * sizeof(pthread_t));
+	if (fr == NULL || th == NULL) {
+		fprintf(stderr, "Memory error\n");
+		exit(1);
+	}
+	STATS_ADD(allocs, 2);
+	for (i=0; i<threads; i++)
+		fr[i].s = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+		                                     co[0]->img_w, co[0]->img_h);
+
+	apng_begin(&a, co[0]->img_w, co[0]->img_h, frames, co[0]->z_level,
+	           co[0]->z_filter, co[0]->threads, cairo_wr, out);
+
+	for (f0=0; f0<frames; f0+=threads) {
+		n = frames - f0;
+		if (n > threads)
+			n = threads;
+
+		/* the interpolated charts are built before the threads start,
+		 * the key frames are only read by their own thread
+		 */
+		for (i=0; i<n; i++) {
+			k = ( f0 + i ) / ( tween + 1 );
+			u = (double)( ( f0 + i ) % ( tween + 1 ) ) / ( tween + 1 );
+			fr[i].own = u > 0;
+			fr[i].co = u > 0 ? pie_tween(co[k], co[k + 1], u) : co[k];
+		}
+
+		/* the current thread draws the first frame */
+		for (i=1; i<n; i++) {
+			if (pthread_create(&th[i], NULL, frame_draw, &fr[i]) != 0) {
+				fprintf(stderr, "can't create thread\n");
+				exit(1);
+			}
+		}
+		frame_draw(&fr[0]);
+		for (i=1; i<n; i++)
+			pthread_join(th[i], NULL);
+
+		t = stats_start();
+		for (i=0; i<n; i++) {
+			apng_frame(&a, fr[i].s, delay);
+			if (fr[i].own)
+				pie_free(fr[i].co);
+		}
+		STATS_PHASE(PIE_PHASE_ENCODE, t);
+	}
+
+	t = stats_start();
+	apng_end(&a);
+	for (i=0; i<threads; i++)
+		cairo_surface_destroy(fr[i].s);
+	free(fr);
+	free(th);
+
+	fflush(out);
+	fclose(out);
+	STATS_PHASE(PIE_PHASE_ENCODE, t);
+}
+
+/* Draw the <nb> charts as the frames of an APNG, <delay> ms each, with
+ * <tween> interpolated frames between two charts. The frames have the
+ * size of the first chart.
+ */
+void pie_draw_anim(struct conf **co, int nb, int tween, int delay,
+                   const char *file_out)
+{
+	int i;
+
+	if (nb < 1)
+		return;
+
+	for (i=0; i<nb; i++)
+		pie_defaults(co[i]);
+	STATS_ADD(charts, nb);
+
+	pie_anim_out(co, nb, tween, delay, open_output(file_out));
 }
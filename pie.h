@@ -9,13 +9,137 @@
 #ifndef __PIE_H__
 #define __PIE_H__
 
+#include <stdint.h>
+
 #include <cairo.h>
 
 struct conf;
 
+/* output formats */
+#define PIE_PNG 1
+#define PIE_EPS 2
+#define PIE_SVG 3
+#define PIE_PDF 4
+#define PIE_PS  5
+#define PIE_RAW 6 /* native endian premultiplied ARGB32, no header */
+#define PIE_PPM 7
+#define PIE_PAM 8
+#define PIE_QOI 9
+#define PIE_PNG8 10 /* indexed colours */
+#define PIE_APNG 11 /* animation, one frame per chart */
+#define PIE_GEOM 12 /* layout and painter order, JSON */
+#define PIE_GEOM_BIN 13 /* the same, binary */
+#define PIE_RING 14 /* raw pixels in a shared memory ring, see below */
+
+/* charts in a ring */
+#define PIE_RING_SLOTS 4
+
+/* animation, delay of a frame in ms */
+#define PIE_DELAY     100
+#define PIE_DELAY_MAX 65535
+
+/* PNG filters */
+#define PIE_FILTER_NONE     0
+#define PIE_FILTER_SUB      1
+#define PIE_FILTER_UP       2
+#define PIE_FILTER_AVG      3
+#define PIE_FILTER_PAETH    4
+#define PIE_FILTER_ADAPTIVE 5
+
+/* qualities */
+#define PIE_QUALITY_FAST    0
+#define PIE_QUALITY_DEFAULT 1
+#define PIE_QUALITY_BEST    2
+
+/* slice labels */
+#define PIE_LABELS_NONE    0
+#define PIE_LABELS_OUTSIDE 1 /* beside the pie, with a leader line */
+#define PIE_LABELS_INSIDE  2 /* on the slice if the name fits in */
+
+/* band mode, lines per band chosen for about 1MB */
+#define PIE_BAND_AUTO -1
+
+/* render cache, default size in bytes */
+#define PIE_CACHE_SIZE ( 64LL * 1024 * 1024 )
+
+/* phases timed by the stats */
+#define PIE_PHASE_PARSE   0 /* input, done by the caller */
+#define PIE_PHASE_MEASURE 1 /* texts */
+#define PIE_PHASE_LAYOUT  2
+#define PIE_PHASE_SORT    3 /* sorting and culling of the faces */
+#define PIE_PHASE_PAINT   4
+#define PIE_PHASE_ENCODE  5
+#define PIE_PHASES        6
+
+struct pie_stats {
+	unsigned long long ns[PIE_PHASES];
+	unsigned long long charts;
+	unsigned long long slices;
+	unsigned long long segments; /* path segments given to cairo */
+	unsigned long long bytes;    /* bytes written */
+	unsigned long long allocs;
+};
+
+/* sliding window of timestamped values, see window.c */
+struct pie_window;
+
+/* shared options of several charts, see style.c */
+struct pie_style;
+
+/* hit test index of a chart */
+struct pie_hit;
+
+/* Shared memory ring of drawn charts, for a reader which maps the same
+ * file or memfd. The memory is a header then <nslots> slots, a slot is
+ * a frame header then the pixels, in the native endian:
+ *
+ *   header, 64 bytes:  "PIER" u32 version nslots slot_size, u64 seq
+ *   slot:              frame header, 64 bytes: u64 seq, u32 w h stride
+ *                      format len; then the pixels
+ *
+ * <slot_size> is the size of a slot with its header, <format> is a
+ * cairo_format_t and <len> the bytes of pixels. The frame <n>, from 1,
+ * is in the slot n % nslots. Its seq is 0 while it is drawn and <n>
+ * once complete, then the header seq becomes <n>.
+ *
+ * A reader takes the header seq <n>, uses the pixels of the slot if its
+ * seq is <n>, then checks that it is still <n>: else the writer went
+ * round the ring meanwhile, and it takes the newer frame.
+ */
+#define PIE_RING_VERSION 1
+#define PIE_RING_HEAD    64
+
+struct pie_ring_head {
+	char magic[4];
+	uint32_t version;
+	uint32_t nslots;
+	uint32_t slot_size;
+	uint64_t seq;
+	unsigned char pad[40];
+};
+
+struct pie_ring_frame {
+	uint64_t seq;
+	uint32_t w;
+	uint32_t h;
+	uint32_t stride;
+	uint32_t format;
+	uint32_t len;
+	unsigned char pad[36];
+};
+
+/* the writer of a ring, see ring.c */
+struct pie_ring;
+
 typedef size_t (*pie_write_cb)(void *arg, const unsigned char *data, unsigned int len);
 
 struct conf *pie_new(void);
+struct conf *pie_new_from(struct conf *model);
+void pie_free(struct conf *co);
+struct pie_style *pie_style_from(struct conf *co);
+struct pie_style *pie_style_load(const char *file);
+struct conf *pie_new_style(struct pie_style *st);
+void pie_style_free(struct pie_style *st);
 void pie_set_do_back(struct conf *co, int do_back);
 void pie_set_back_color(struct conf *co, char *color);
 void pie_set_line_width(struct conf *co, double width);
@@ -27,13 +151,48 @@ void pie_set_img_w(struct conf *co, int img_w);
 void pie_set_do_legend(struct conf *co, int do_legend);
 void pie_set_legend_color(struct conf *co, char *color);
 void pie_set_legend_size(struct conf *co, double size);
+void pie_set_legend_page(struct conf *co, int page);
+void pie_set_do_labels(struct conf *co, int mode);
 void pie_set_margin(struct conf *co, int size);
 void pie_set_ratio(struct conf *co, double size);
 void pie_set_title_size(struct conf *co, int size);
 void pie_set_title(struct conf *co, char *title);
 void pie_set_title_color(struct conf *co, char *color);
+void pie_set_compression(struct conf *co, int level);
+void pie_set_filter(struct conf *co, int filter);
+void pie_set_threads(struct conf *co, int threads);
+void pie_set_band(struct conf *co, int lines);
+void pie_set_format(struct conf *co, cairo_format_t format);
+void pie_set_quality(struct conf *co, int quality);
+void pie_set_cache(struct conf *co, char *dir, long long max);
+void pie_stats_enable(int enable);
+void pie_stats_reset(void);
+const struct pie_stats *pie_get_stats(void);
+unsigned long long pie_stats_clock(void);
+void pie_stats_phase(int phase, unsigned long long start);
 int pie_add(struct conf *co, double value, char *color, double extrude, char *name);
 void pie_cairo_draw(cairo_t *c, struct conf *co);
 void pie_draw(struct conf *co, int mode, const char *file_out);
+void pie_draw_grid(struct conf **co, int nb, int cols, int mode,
+                   const char *file_out);
+void pie_draw_report(struct conf **co, int nb, int mode, const char *file_out);
+void pie_draw_anim(struct conf **co, int nb, int tween, int delay,
+                   const char *file_out);
+struct pie_window *pie_window_new(struct conf *model, double span);
+void pie_window_free(struct pie_window *w);
+void pie_window_add(struct pie_window *w, double t, double value,
+                    char *color, double extrude, char *name);
+int pie_window_expire(struct pie_window *w, double now);
+int pie_window_events(struct pie_window *w);
+struct conf *pie_window_chart(struct pie_window *w);
+struct pie_hit *pie_hit_new(struct conf *co);
+void pie_hit_free(struct pie_hit *h);
+int pie_hit_test(struct pie_hit *h, double x, double y);
+void pie_draw_map(struct conf *co, const char *name, const char *file_out);
+size_t pie_raw_size(struct conf *co);
+struct pie_ring *pie_ring_fd(int fd, int nslots, size_t room);
+struct pie_ring *pie_ring_open(const char *path, int nslots, size_t room);
+void pie_ring_close(struct pie_ring *r);
+unsigned long long pie_draw_ring(struct conf *co, struct pie_ring *r);
 
 #endif /* __PIE_H__ */
@@ -0,0 +1,709 @@
+/*
+ * Copyright 2010-2019 Thierry FOURNIER
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License.
+ */
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <zlib.h>
+#include <cairo.h>
+
+#include "pie.h"
+#include "encode.h"
+#include "png.h"
+#include "quant.h"
+
+/* Each block of lines is compressed alone, so the blocks can go to
+ * different threads. A block ends with a sync flush so the raw deflate
+ * streams can be put end to end, and starts with the 32k of filtered
+ * data before it as dictionary, so the ratio is nearly the one of a
+ * single stream.
+ */
+#define PNG_BLOCK 262144
+#define PNG_WINDOW 32768
+
+struct png_job {
+	struct png_src *src;
+	int level;
+	int filter;
+	int tid;
+	int y0;
+	int y1;
+	int last;
+
+	/* compressed data */
+	unsigned char *out;
+	unsigned int len;
+
+	/* adler32 of the uncompressed data */
+	uLong adler;
+	uLong raw;
+};
+
+static inline
+void *png_alloc(size_t len)
+{
+	void *b;
+
+	b = malloc(len);
+	if (b == NULL) {
+		fprintf(stderr, "Memory error\n");
+		exit(1);
+	}
+	return b;
+}
+
+static inline
+void be32(unsigned char *p, uint32_t v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+void png_chunk(cairo_write_func_t wr, void *arg, const char *type,
+               const unsigned char *data, unsigned int len)
+{
+	unsigned char b[8];
+	uLong crc;
+
+	be32(b, len);
+	memcpy(b + 4, type, 4);
+	wr(arg, b, 8);
+	if (len > 0)
+		wr(arg, data, len);
+
+	crc = crc32(0, (const Bytef *)type, 4);
+	if (len > 0)
+		crc = crc32(crc, data, len);
+	be32(b, crc);
+	wr(arg, b, 4);
+}
+
+void png_header(cairo_write_func_t wr, void *arg, int w, int h,
+                int depth, int color)
+{
+	static const unsigned char sig[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+	unsigned char ihdr[13];
+
+	wr(arg, sig, 8);
+	be32(ihdr, w);
+	be32(ihdr + 4, h);
+	ihdr[8] = depth;
+	ihdr[9] = color;
+	ihdr[10] = 0; /* deflate */
+	ihdr[11] = 0; /* adaptive filtering */
+	ihdr[12] = 0; /* no interlace */
+	png_chunk(wr, arg, "IHDR", ihdr, 13);
+}
+
+static inline
+unsigned char paeth(int a, int b, int c)
+{
+	int p;
+	int pa;
+	int pb;
+	int pc;
+
+	p = a + b - c;
+	pa = abs(p - a);
+	pb = abs(p - b);
+	pc = abs(p - c);
+	if (pa <= pb && pa <= pc)
+		return a;
+	if (pb <= pc)
+		return b;
+	return c;
+}
+
+/* filter <cur> with the method <f>, <prev> is the line above. The
+ * filtered line in <out> starts with the method byte.
+ */
+static inline
+void filter_row(int f, int bpp, const unsigned char *cur,
+                const unsigned char *prev, int len, unsigned char *out)
+{
+	int i;
+
+	out[0] = f;
+	out++;
+
+	switch (f) {
+
+	case PIE_FILTER_NONE:
+		memcpy(out, cur, len);
+		break;
+
+	case PIE_FILTER_SUB:
+		for (i=0; i<bpp; i++)
+			out[i] = cur[i];
+		for (; i<len; i++)
+			out[i] = cur[i] - cur[i - bpp];
+		break;
+
+	case PIE_FILTER_UP:
+		for (i=0; i<len; i++)
+			out[i] = cur[i] - prev[i];
+		break;
+
+	case PIE_FILTER_AVG:
+		for (i=0; i<bpp; i++)
+			out[i] = cur[i] - ( prev[i] >> 1 );
+		for (; i<len; i++)
+			out[i] = cur[i] - ( ( cur[i - bpp] + prev[i] ) >> 1 );
+		break;
+
+	case PIE_FILTER_PAETH:
+		for (i=0; i<bpp; i++)
+			out[i] = cur[i] - prev[i];
+		for (; i<len; i++)
+			out[i] = cur[i] - paeth(cur[i - bpp], prev[i], prev[i - bpp]);
+		break;
+	}
+}
+
+/* The usual heuristic: the method giving the smallest sum of the bytes
+ * taken as signed values.
+ */
+static inline
+void filter_row_adaptive(int bpp, const unsigned char *cur,
+                         const unsigned char *prev, int len,
+                         unsigned char *out, unsigned char *tmp)
+{
+	unsigned long best = (unsigned long)-1;
+	unsigned long sum;
+	int f;
+	int i;
+
+	for (f=PIE_FILTER_NONE; f<=PIE_FILTER_PAETH; f++) {
+		filter_row(f, bpp, cur, prev, len, tmp);
+		sum = 0;
+		for (i=1; i<=len; i++)
+			sum += tmp[i] < 128 ? tmp[i] : 256 - tmp[i];
+		if (sum < best) {
+			best = sum;
+			memcpy(out, tmp, len + 1);
+		}
+	}
+}
+
+/* read and filter the lines [y0, y1) into <out> */
+static
+void filter_rows(struct png_job *j, int y0, int y1, unsigned char *out)
+{
+	struct png_src *src = j->src;
+	unsigned char *cur;
+	unsigned char *prev;
+	unsigned char *tmp;
+	unsigned char *swap;
+	int len;
+	int y;
+
+	len = src->w * src->bpp;
+	cur = png_alloc(len);
+	prev = calloc(1, len);
+	tmp = png_alloc(len + 1);
+	if (prev == NULL) {
+		fprintf(stderr, "Memory error\n");
+		exit(1);
+	}
+
+	if (y0 > 0)
+		src->row(src, j->tid, y0 - 1, prev);
+
+	for (y=y0; y<y1; y++) {
+		src->row(src, j->tid, y, cur);
+		if (j->filter == PIE_FILTER_ADAPTIVE)
+			filter_row_adaptive(src->bpp, cur, prev, len, out, tmp);
+		else
+			filter_row(j->filter, src->bpp, cur, prev, len, out);
+		out += len + 1;
+		swap = prev;
+		prev = cur;
+		cur = swap;
+	}
+
+	free(cur);
+	free(prev);
+	free(tmp);
+}
+
+static
+void *compress_block(void *arg)
+{
+	struct png_job *j = arg;
+	struct png_src *src = j->src;
+	z_stream z;
+	unsigned char *raw;
+	uLong bound;
+	int len;
+	int dy;
+
+	len = ( src->w * src->bpp ) + 1;
+
+	/* lines of the dictionary */
+	dy = ( PNG_WINDOW + len - 1 ) / len;
+	if (dy > j->y0)
+		dy = j->y0;
+
+	/* the filters read the line above the first one */
+	if (src->band != NULL)
+		src->band(src, j->tid, j->y0 - dy > 0 ? j->y0 - dy - 1 : 0, j->y1);
+
+	raw = png_alloc((size_t)len * ( j->y1 - j->y0 + dy ));
+	filter_rows(j, j->y0 - dy, j->y1, raw);
+	j->raw = (uLong)len * ( j->y1 - j->y0 );
+	j->adler = adler32(adler32(0, NULL, 0), raw + ( (size_t)len * dy ), j->raw);
+
+	memset(&z, 0, sizeof(z));
+	if (deflateInit2(&z, j->level, Z_DEFLATED, -15, 8,
+	                 Z_DEFAULT_STRATEGY) != Z_OK) {
+		fprintf(stderr, "zlib error\n");
+		exit(1);
+	}
+	if (dy > 0) {
+		if ((size_t)len * dy > PNG_WINDOW)
+			deflateSetDictionary(&z, raw + ( (size_t)len * dy ) - PNG_WINDOW,
+			                     PNG_WINDOW);
+		else
+			deflateSetDictionary(&z, raw, (size_t)len * dy);
+	}
+
+	/* room for the sync flush marker and the zlib trailer */
+	bound = deflateBound(&z, j->raw) + 16;
+	j->out = png_alloc(bound + 4);
+	z.next_in = raw + ( (size_t)len * dy );
+	z.avail_in = j->raw;
+	z.next_out = j->out;
+	z.avail_out = bound;
+	if (deflate(&z, j->last ? Z_FINISH : Z_SYNC_FLUSH) == Z_STREAM_ERROR ||
+	    z.avail_in != 0) {
+		fprintf(stderr, "zlib error\n");
+		exit(1);
+	}
+	j->len = z.next_out - j->out;
+	deflateEnd(&z);
+
+	free(raw);
+	return NULL;
+}
+
+/* Filter and compress all the lines of <src> as one zlib stream. The
+ * stream goes to <out> block by block, in order. The blocks of one
+ * wave are compressed by <threads> threads, so the memory used does
+ * not depend of the image height.
+ */
+void png_compress(struct png_src *src, int level, int filter, int threads,
+                  png_out_cb out, void *arg)
+{
+	struct png_job *jobs;
+	pthread_t *th;
+	unsigned char head[2];
+	uLong adler;
+	int rows;
+	int nblocks;
+	int b0;
+	int n;
+	int i;
+
+	if (threads < 1)
+		threads = 1;
+
+	rows = src->rows;
+	if (rows < 1)
+		rows = PNG_BLOCK / ( ( src->w * src->bpp ) + 1 );
+	if (rows < 1)
+		rows = 1;
+	nblocks = ( src->h + rows - 1 ) / rows;
+
+	jobs = png_alloc(threads * sizeof(struct png_job));
+	th = png_alloc(threads * sizeof(pthread_t));
+
+	/* zlib header, 32k window */
+	head[0] = 0x78;
+	head[1] = ( level < 2 ? 0 : level < 6 ? 1 : level == 6 ? 2 : 3 ) << 6;
+	head[1] += 31 - ( ( ( head[0] << 8 ) + head[1] ) % 31 );
+	out(arg, head, 2);
+
+	adler = adler32(0, NULL, 0);
+	for (b0=0; b0<nblocks; b0+=threads) {
+		n = nblocks - b0;
+		if (n > threads)
+			n = threads;
+
+		for (i=0; i<n; i++) {
+			jobs[i].src = src;
+			jobs[i].level = level;
+			jobs[i].filter = filter;
+			jobs[i].tid = i;
+			jobs[i].y0 = ( b0 + i ) * rows;
+			jobs[i].y1 = jobs[i].y0 + rows;
+			if (jobs[i].y1 > src->h)
+				jobs[i].y1 = src->h;
+			jobs[i].last = ( b0 + i == nblocks - 1 );
+		}
+
+		/* the current thread takes the first block */
+		for (i=1; i<n; i++) {
+			if (pthread_create(&th[i], NULL, compress_block, &jobs[i]) != 0) {
+				fprintf(stderr, "can't create thread\n");
+				exit(1);
+			}
+		}
+		compress_block(&jobs[0]);
+		for (i=1; i<n; i++)
+			pthread_join(th[i], NULL);
+
+		for (i=0; i<n; i++) {
+			adler = adler32_combine(adler, jobs[i].adler, jobs[i].raw);
+			if (jobs[i].last) {
+				be32(jobs[i].out + jobs[i].len, adler);
+				jobs[i].len += 4;
+			}
+			out(arg, jobs[i].out, jobs[i].len);
+			free(jobs[i].out);
+		}
+	}
+
+	free(jobs);
+	free(th);
+}
+
+struct png_stream {
+	cairo_write_func_t wr;
+	void *arg;
+};
+
+/* one IDAT chunk per compressed piece */
+static
+void png_idat(void *arg, const unsigned char *data, unsigned int len)
+{
+	struct png_stream *st = arg;
+
+	png_chunk(st->wr, st->arg, "IDAT", data, len);
+}
+
+/* 8 bits PNG, lines from <src>. 4, 3 or 1 bytes per pixel are RGBA,
+ * RGB or gray.
+ */
+void encode_png_src(struct png_src *src, int level, int filter, int threads,
+                    cairo_write_func_t wr, void *arg)
+{
+	struct png_stream st;
+	int color;
+
+	st.wr = wr;
+	st.arg = arg;
+
+	color = src->bpp == 4 ? PNG_RGBA : src->bpp == 3 ? PNG_RGB : PNG_GRAY;
+	png_header(wr, arg, src->w, src->h, 8, color);
+	png_compress(src, level, filter, threads, png_idat, &st);
+	png_chunk(wr, arg, "IEND", NULL, 0);
+}
+
+static
+void row_surface(struct png_src *src, int tid, int y, unsigned char *out)
+{
+	cairo_surface_t *s = src->arg;
+
+	(void)tid;
+	format_row(cairo_image_surface_get_format(s),
+	           cairo_image_surface_get_data(s) +
+	           ( y * cairo_image_surface_get_stride(s) ), src->w, out);
+}
+
+void encode_png(cairo_surface_t *s, int level, int filter, int threads,
+                cairo_write_func_t wr, void *arg)
+{
+	struct png_src src;
+
+	cairo_surface_flush(s);
+
+	src.w = cairo_image_surface_get_width(s);
+	src.h = cairo_image_surface_get_height(s);
+	src.bpp = format_channels(cairo_image_surface_get_format(s));
+	src.rows = 0;
+	src.row = row_surface;
+	src.band = NULL;
+	src.arg = s;
+
+	encode_png_src(&src, level, filter, threads, wr, arg);
+}
+
+struct png8 {
+	unsigned char *idx;
+	int w;
+	int depth;
+};
+
+/* the indexes packed on <depth> bits, most significant bits first */
+static
+void row_index(struct png_src *src, int tid, int y, unsigned char *out)
+{
+	struct png8 *p = src->arg;
+	unsigned char *in;
+	int ppb;
+	int x;
+
+	(void)tid;
+	in = p->idx + ( (size_t)y * p->w );
+	if (p->depth == 8) {
+		memcpy(out, in, p->w);
+		return;
+	}
+
+	ppb = 8 / p->depth;
+	memset(out, 0, src->w);
+	for (x=0; x<p->w; x++)
+		out[x / ppb] |= in[x] << ( 8 - ( ( ( x % ppb ) + 1 ) * p->depth ) );
+}
+
+/* Indexed colours PNG. The <seeds> are the colours drawn, kept exact in
+ * the palette, the antialiasing and the gradients share the remaining
+ * entries. The lines are not filtered: the filters don't work on
+ * indexes.
+ */
+void encode_png8(cairo_surface_t *s, const unsigned char (*seeds)[4],
+                 int nseeds, int level, int threads,
+                 cairo_write_func_t wr, void *arg)
+{
+	struct palette pal;
+	struct png_stream st;
+	struct png_src src;
+	struct png8 p;
+	unsigned char plte[256 * 3];
+	unsigned char trns[256];
+	int i;
+
+	cairo_surface_flush(s);
+
+	p.w = cairo_image_surface_get_width(s);
+	p.idx = quantize(cairo_image_surface_get_data(s), p.w,
+	                 cairo_image_surface_get_height(s),
+	                 cairo_image_surface_get_stride(s),
+	                 seeds, nseeds, 256, &pal);
+
+	if (pal.nb <= 2)
+		p.depth = 1;
+	else if (pal.nb <= 4)
+		p.depth = 2;
+	else if (pal.nb <= 16)
+		p.depth = 4;
+	else
+		p.depth = 8;
+
+	src.w = ( ( p.w * p.depth ) + 7 ) / 8;
+	src.h = cairo_image_surface_get_height(s);
+	src.bpp = 1;
+	src.rows = 0;
+	src.row = row_index;
+	src.band = NULL;
+	src.arg = &p;
+
+	st.wr = wr;
+	st.arg = arg;
+
+	png_header(wr, arg, p.w, src.h, p.depth, PNG_PALETTE);
+	for (i=0; i<pal.nb; i++) {
+		plte[( i * 3 )] = pal.col[i][0];
+		plte[( i * 3 ) + 1] = pal.col[i][1];
+		plte[( i * 3 ) + 2] = pal.col[i][2];
+		trns[i] = pal.col[i][3];
+	}
+	png_chunk(wr, arg, "PLTE", plte, pal.nb * 3);
+	if (pal.nb_alpha > 0)
+		png_chunk(wr, arg, "tRNS", trns, pal.nb_alpha);
+	png_compress(&src, level, PIE_FILTER_NONE, threads, png_idat, &st);
+	png_chunk(wr, arg, "IEND", NULL, 0);
+
+	free(p.idx);
+}
+
+/* Animated PNG. The frames are straight RGBA images of the same size.
+ * After the first one, a frame only stores the box of the pixels which
+ * changed, drawn over the previous frame.
+ */
+
+/* fdAT chunks: the compressed data after the sequence number */
+static
+void png_fdat(void *arg, const unsigned char *data, unsigned int len)
+{
+	struct apng *a = arg;
+	unsigned char *b;
+
+	b = png_alloc(len + 4);
+	be32(b, a->seq++);
+	memcpy(b + 4, data, len);
+	png_chunk(a->wr, a->arg, "fdAT", b, len + 4);
+	free(b);
+}
+
+static
+void png_fidat(void *arg, const unsigned char *data, unsigned int len)
+{
+	struct apng *a = arg;
+
+	png_chunk(a->wr, a->arg, "IDAT", data, len);
+}
+
+/* lines of the box of the current frame */
+static
+void row_box(struct png_src *src, int tid, int y, unsigned char *out)
+{
+	struct apng *a = src->arg;
+
+	(void)tid;
+	memcpy(out, a->cur + ( ( ( (size_t)( a->by + y ) * a->w ) + a->bx ) * 4 ),
+	       (size_t)src->w * 4);
+}
+
+void apng_begin(struct apng *a, int w, int h, int frames, int level,
+                int filter, int threads, cairo_write_func_t wr, void *arg)
+{
+	unsigned char actl[8];
+
+	a->w = w;
+	a->h = h;
+	a->level = level;
+	a->filter = filter;
+	a->threads = threads;
+	a->wr = wr;
+	a->arg = arg;
+	a->seq = 0;
+	a->nb = 0;
+	a->cur = png_alloc((size_t)w * h * 4);
+	a->prev = png_alloc((size_t)w * h * 4);
+
+	png_header(wr, arg, w, h, 8, PNG_RGBA);
+	be32(actl, frames);
+	be32(actl + 4, 0); /* loop forever */
+	png_chunk(wr, arg, "acTL", actl, 8);
+}
+
+/* the box of the pixels of <cur> which differ from <prev> */
+static
+void apng_box(struct apng *a)
+{
+	const uint32_t *c;
+	const uint32_t *p;
+	size_t line;
+	int x0;
+	int x1;
+	int y0;
+	int y1;
+	int x;
+	int y;
+
+	line = (size_t)a->w * 4;
+
+	for (y0=0; y0<a->h; y0++)
+		if (memcmp(a->cur + ( y0 * line ), a->prev + ( y0 * line ), line) != 0)
+			break;
+
+	/* same image, one pixel rewritten as is */
+	if (y0 == a->h) {
+		a->bx = 0;
+		a->by = 0;
+		a->bw = 1;
+		a->bh = 1;
+		return;
+	}
+
+	for (y1=a->h-1; y1>y0; y1--)
+		if (memcmp(a->cur + ( y1 * line ), a->prev + ( y1 * line ), line) != 0)
+			break;
+
+	x0 = a->w;
+	x1 = 0;
+	for (y=y0; y<=y1; y++) {
+		c = (const uint32_t *)( a->cur + ( y * line ) );
+		p = (const uint32_t *)( a->prev + ( y * line ) );
+		for (x=0; x<x0; x++)
+			if (c[x] != p[x])
+				break;
+		if (x < x0)
+			x0 = x;
+		for (x=a->w-1; x>=x1 && x>=x0; x--)
+			if (c[x] != p[x])
+				break;
+		if (x > x1)
+			x1 = x;
+	}
+	if (x1 < x0)
+		x1 = x0;
+
+	a->bx = x0;
+	a->by = y0;
+	a->bw = x1 - x0 + 1;
+	a->bh = y1 - y0 + 1;
+}
+
+/* add the frame <s>, shown <delay> ms */
+void apng_frame(struct apng *a, cairo_surface_t *s, int delay)
+{
+	struct png_src src;
+	unsigned char fctl[26];
+	unsigned char *data;
+	unsigned char *swap;
+	int stride;
+	int y;
+
+	cairo_surface_flush(s);
+	data = cairo_image_surface_get_data(s);
+	stride = cairo_image_surface_get_stride(s);
+	for (y=0; y<a->h; y++)
+		format_row(cairo_image_surface_get_format(s), data + ( y * stride ),
+		           a->w, a->cur + ( (size_t)y * a->w * 4 ));
+
+	if (a->nb == 0) {
+		a->bx = 0;
+		a->by = 0;
+		a->bw = a->w;
+		a->bh = a->h;
+	}
+	else
+		apng_box(a);
+
+	be32(fctl, a->seq++);
+	be32(fctl + 4, a->bw);
+	be32(fctl + 8, a->bh);
+	be32(fctl + 12, a->bx);
+	be32(fctl + 16, a->by);
+	fctl[20] = delay >> 8; /* delay, in ms */
+	fctl[21] = delay;
+	fctl[22] = 1000 >> 8;
+	fctl[23] = 1000 & 0xff;
+	fctl[24] = 0; /* dispose: none, the next frame is drawn over */
+	fctl[25] = 0; /* blend: source, the box replaces the pixels */
+	png_chunk(a->wr, a->arg, "fcTL", fctl, 26);
+
+	src.w = a->bw;
+	src.h = a->bh;
+	src.bpp = 4;
+	src.rows = 0;
+	src.row = row_box;
+	src.band = NULL;
+	src.arg = a;
+	png_compress(&src, a->level, a->filter, a->threads,
+	             a->nb == 0 ? png_fidat : png_fdat, a);
+
+	swap = a->prev;
+	a->prev = a->cur;
+	a->cur = swap;
+	a->nb++;
+}
+
+void apng_end(struct apng *a)
+{
+	png_chunk(a->wr, a->arg, "IEND", NULL, 0);
+	free(a->cur);
+	free(a->prev);
+}
@@ -0,0 +1,79 @@
+/*
+ * Copyright 2010-2019 Thierry FOURNIER
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License.
+ */
+#ifndef __PNG_H__
+#define __PNG_H__
+
+#include <cairo.h>
+
+/* PNG colour types */
+#define PNG_GRAY       0
+#define PNG_RGB        2
+#define PNG_PALETTE    3
+#define PNG_GRAY_ALPHA 4
+#define PNG_RGBA       6
+
+/* Source of the scanlines. row() fills <out> with the pixels of the
+ * line <y> in the PNG layout. If band() is set, it is called before
+ * each block of lines [y0, y1) by the thread <tid> which reads them.
+ * <rows> forces the lines per block, 0 lets the encoder choose.
+ */
+struct png_src {
+	int w;
+	int h;
+	int bpp; /* bytes per pixel */
+	int rows;
+	void (*row)(struct png_src *src, int tid, int y, unsigned char *out);
+	void (*band)(struct png_src *src, int tid, int y0, int y1);
+	void *arg;
+};
+
+typedef void (*png_out_cb)(void *arg, const unsigned char *data, unsigned int len);
+
+void png_chunk(cairo_write_func_t wr, void *arg, const char *type,
+               const unsigned char *data, unsigned int len);
+void png_header(cairo_write_func_t wr, void *arg, int w, int h,
+                int depth, int color);
+void png_compress(struct png_src *src, int level, int filter, int threads,
+                  png_out_cb out, void *arg);
+void encode_png_src(struct png_src *src, int level, int filter, int threads,
+                    cairo_write_func_t wr, void *arg);
+void encode_png(cairo_surface_t *s, int level, int filter, int threads,
+                cairo_write_func_t wr, void *arg);
+void encode_png8(cairo_surface_t *s, const unsigned char (*seeds)[4],
+                 int nseeds, int level, int threads,
+                 cairo_write_func_t wr, void *arg);
+
+/* animated PNG writer, see apng_begin() */
+struct apng {
+	int w;
+	int h;
+	int level;
+	int filter;
+	int threads;
+	cairo_write_func_t wr;
+	void *arg;
+
+	unsigned int seq; /* sequence number of the fcTL and fdAT chunks */
+	int nb; /* frames written */
+	unsigned char *cur; /* straight RGBA of the frame */
+	unsigned char *prev;
+
+	/* box of the pixels which changed */
+	int bx;
+	int by;
+	int bw;
+	int bh;
+};
+
+void apng_begin(struct apng *a, int w, int h, int frames, int level,
+                int filter, int threads, cairo_write_func_t wr, void *arg);
+void apng_frame(struct apng *a, cairo_surface_t *s, int delay);
+void apng_end(struct apng *a);
+
+#endif /* __PNG_H__ */
@@ -0,0 +1,398 @@
+/*
+ * Copyright 2010-2019 Thierry FOURNIER
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "encode.h"
+#include "quant.h"
+
+/* one distinct colour of the image */
+struct qcol {
+	unsigned char c[4];
+	uint32_t count;
+	int idx;
+};
+
+/* open addressing hash of the distinct colours, the key is the RGBA
+ * colour, the value the position in the colour list.
+ */
+struct qhash {
+	uint32_t *key;
+	int *val;
+	unsigned int mask;
+	int nb;
+
+	struct qcol *cols;
+	int size;
+};
+
+static inline
+void *qalloc(size_t len)
+{
+	void *b;
+
+	b = malloc(len);
+	if (b == NULL) {
+		fprintf(stderr, "Memory error\n");
+		exit(1);
+	}
+	return b;
+}
+
+static inline
+unsigned int qslot(uint32_t key, unsigned int mask)
+{
+	key ^= key >> 16;
+	key *= 0x7feb352d;
+	key ^= key >> 15;
+	return key & mask;
+}
+
+static
+void qhash_init(struct qhash *h, unsigned int size)
+{
+	h->mask = size - 1;
+	h->nb = 0;
+	h->key = qalloc(size * sizeof(uint32_t));
+	h->val = qalloc(size * sizeof(int));
+	memset(h->val, 0xff, size * sizeof(int));
+	h->size = 256;
+	h->cols = qalloc(h->size * sizeof(struct qcol));
+}
+
+static
+void qhash_grow(struct qhash *h)
+{
+	uint32_t *key;
+	int *val;
+	unsigned int mask;
+	unsigned int i;
+	unsigned int k;
+
+	key = h->key;
+	val = h->val;
+	mask = h->mask;
+
+	h->mask = ( mask << 1 ) | 1;
+	h->key = qalloc(( h->mask + 1 ) * sizeof(uint32_t));
+	h->val = qalloc(( h->mask + 1 ) * sizeof(int));
+	memset(h->val, 0xff, ( h->mask + 1 ) * sizeof(int));
+
+	for (i=0; i<=mask; i++) {
+		if (val[i] < 0)
+			continue;
+		k = qslot(key[i], h->mask);
+		while (h->val[k] >= 0)
+			k = ( k + 1 ) & h->mask;
+		h->key[k] = key[i];
+		h->val[k] = val[i];
+	}
+	free(key);
+	free(val);
+}
+
+/* the colour entry, created if it doesn't exists */
+static inline
+struct qcol *qhash_get(struct qhash *h, const unsigned char *c)
+{
+	uint32_t key;
+	unsigned int k;
+
+	key = ( (uint32_t)c[0] << 24 ) | ( c[1] << 16 ) | ( c[2] << 8 ) | c[3];
+	k = qslot(key, h->mask);
+	while (h->val[k] >= 0) {
+		if (h->key[k] == key)
+			return &h->cols[h->val[k]];
+		k = ( k + 1 ) & h->mask;
+	}
+
+	if (h->nb == h->size) {
+		h->size *= 2;
+		h->cols = realloc(h->cols, h->size * sizeof(struct qcol));
+		if (h->cols == NULL) {
+			fprintf(stderr, "Memory error\n");
+			exit(1);
+		}
+	}
+	h->key[k] = key;
+	h->val[k] = h->nb;
+	memcpy(h->cols[h->nb].c, c, 4);
+	h->cols[h->nb].count = 0;
+	h->cols[h->nb].idx = -1;
+	h->nb++;
+
+	if ((unsigned int)h->nb * 2 > h->mask)
+		qhash_grow(h);
+
+	return &h->cols[h->nb - 1];
+}
+
+/* median cut: a box is a range of the colour list */
+struct qbox {
+	int lo;
+	int hi;
+	int chan;
+	int range;
+	uint32_t count;
+};
+
+static int cmp_c0(const void *a, const void *b) { return ((struct qcol *)a)->c[0] - ((struct qcol *)b)->c[0]; }
+static int cmp_c1(const void *a, const void *b) { return ((struct qcol *)a)->c[1] - ((struct qcol *)b)->c[1]; }
+static int cmp_c2(const void *a, const void *b) { return ((struct qcol *)a)->c[2] - ((struct qcol *)b)->c[2]; }
+static int cmp_c3(const void *a, const void *b) { return ((struct qcol *)a)->c[3] - ((struct qcol *)b)->c[3]; }
+
+static int (*cmp_chan[4])(const void *, const void *) = { cmp_c0, cmp_c1, cmp_c2, cmp_c3 };
+
+static
+void box_stat(struct qcol *cols, struct qbox *b)
+{
+	int min[4] = { 255, 255, 255, 255 };
+	int max[4] = { 0, 0, 0, 0 };
+	int i;
+	int k;
+
+	b->count = 0;
+	for (i=b->lo; i<b->hi; i++) {
+		b->count += cols[i].count;
+		for (k=0; k<4; k++) {
+			if (cols[i].c[k] < min[k])
+				min[k] = cols[i].c[k];
+			if (cols[i].c[k] > max[k])
+				max[k] = cols[i].c[k];
+		}
+	}
+	b->chan = 0;
+	b->range = 0;
+	for (k=0; k<4; k++) {
+		if (max[k] - min[k] > b->range) {
+			b->range = max[k] - min[k];
+			b->chan = k;
+		}
+	}
+}
+
+static
+int median_cut(struct qcol *cols, int nb, struct qbox *box, int max)
+{
+	int nbox;
+	int best;
+	double score;
+	double s;
+	uint32_t half;
+	uint32_t sum;
+	int i;
+	int m;
+
+	box[0].lo = 0;
+	box[0].hi = nb;
+	box_stat(cols, &box[0]);
+	nbox = 1;
+
+	while (nbox < max) {
+
+		/* the box with the largest spread, weighted by its pixels */
+		best = -1;
+		score = 0;
+		for (i=0; i<nbox; i++) {
+			if (box[i].hi - box[i].lo < 2)
+				continue;
+			s = (double)box[i].range * box[i].count;
+			if (s > score) {
+				score = s;
+				best = i;
+			}
+		}
+		if (best < 0)
+			break;
+
+		/* cut at the median pixel along its largest channel */
+		qsort(&cols[box[best].lo], box[best].hi - box[best].lo,
+		      sizeof(struct qcol), cmp_chan[box[best].chan]);
+		half = box[best].count / 2;
+		sum = 0;
+		for (m=box[best].lo; m<box[best].hi - 2; m++) {
+			sum += cols[m].count;
+			if (sum >= half)
+				break;
+		}
+		m++;
+
+		box[nbox].lo = m;
+		box[nbox].hi = box[best].hi;
+		box[best].hi = m;
+		box_stat(cols, &box[best]);
+		box_stat(cols, &box[nbox]);
+		nbox++;
+	}
+
+	return nbox;
+}
+
+static inline
+int nearest(struct palette *pal, const unsigned char *c)
+{
+	int best = 0;
+	int dbest = 0x7fffffff;
+	int d;
+	int e;
+	int i;
+
+	for (i=0; i<pal->nb; i++) {
+		e = (int)pal->col[i][0] - c[0];
+		d = e * e;
+		e = (int)pal->col[i][1] - c[1];
+		d += e * e;
+		e = (int)pal->col[i][2] - c[2];
+		d += e * e;
+		e = (int)pal->col[i][3] - c[3];
+		d += 2 * e * e;
+		if (d < dbest) {
+			dbest = d;
+			best = i;
+			if (d == 0)
+				break;
+		}
+	}
+	return best;
+}
+
+static inline
+int pal_add(struct palette *pal, const unsigned char *c)
+{
+	int i;
+
+	for (i=0; i<pal->nb; i++)
+		if (memcmp(pal->col[i], c, 4) == 0)
+			return 0;
+	memcpy(pal->col[pal->nb++], c, 4);
+	return 1;
+}
+
+/* Reduce the ARGB32 pixels to at most <max> colours (<= 256). If the
+ * image has no more colours, the palette is exact. Else the <seeds>,
+ * the colours known to be in the image, are kept as is and a median
+ * cut of the histogram gives the other ones. Returns one palette index
+ * per pixel.
+ */
+unsigned char *quantize(const unsigned char *data, int w, int h, int stride,
+                        const unsigned char (*seeds)[4], int nseeds,
+                        int max, struct palette *pal)
+{
+	struct qhash hs;
+	struct qbox *box;
+	struct qcol *e = NULL;
+	unsigned char *idx;
+	unsigned char c[4];
+	unsigned char tmp[4];
+	const uint32_t *px;
+	uint32_t last = 0;
+	uint64_t sum[4];
+	int nbox;
+	int x;
+	int y;
+	int i;
+	int k;
+
+	/* histogram */
+	qhash_init(&hs, 4096);
+	for (y=0; y<h; y++) {
+		px = (const uint32_t *)( data + ( y * stride ) );
+		for (x=0; x<w; x++) {
+			if (e == NULL || px[x] != last) {
+				last = px[x];
+				unpremultiply(last, c);
+				e = qhash_get(&hs, c);
+			}
+			e->count++;
+		}
+	}
+
+	pal->nb = 0;
+
+	/* exact */
+	if (hs.nb <= max) {
+		for (i=0; i<hs.nb; i++)
+			memcpy(pal->col[pal->nb++], hs.cols[i].c, 4);
+	}
+
+	/* seeds, then median cut */
+	else {
+		for (i=0; i<nseeds && pal->nb < max / 2; i++)
+			pal_add(pal, seeds[i]);
+
+		box = qalloc(( max - pal->nb ) * sizeof(struct qbox));
+		nbox = median_cut(hs.cols, hs.nb, box, max - pal->nb);
+		for (i=0; i<nbox; i++) {
+			memset(sum, 0, sizeof(sum));
+			for (x=box[i].lo; x<box[i].hi; x++)
+				for (k=0; k<4; k++)
+					sum[k] += (uint64_t)hs.cols[x].c[k] * hs.cols[x].count;
+			for (k=0; k<4; k++)
+				c[k] = ( sum[k] + ( box[i].count / 2 ) ) / box[i].count;
+			pal_add(pal, c);
+		}
+		free(box);
+	}
+
+	/* the transparent colours first, so the tRNS chunk is short */
+	pal->nb_alpha = 0;
+	for (i=0; i<pal->nb; i++) {
+		if (pal->col[i][3] == 0xff)
+			continue;
+		memcpy(tmp, pal->col[pal->nb_alpha], 4);
+		memcpy(pal->col[pal->nb_alpha], pal->col[i], 4);
+		memcpy(pal->col[i], tmp, 4);
+		pal->nb_alpha++;
+	}
+
+	/* each distinct colour gets its palette entry */
+	for (i=0; i<hs.nb; i++)
+		hs.cols[i].idx = nearest(pal, hs.cols[i].c);
+
+	/* the median cut sorted the colour list, the hash is rebuilt */
+	free(hs.key);
+	free(hs.val);
+	hs.mask = 4095;
+	while ((unsigned int)hs.nb * 2 > hs.mask)
+		hs.mask = ( hs.mask << 1 ) | 1;
+	hs.key = qalloc(( hs.mask + 1 ) * sizeof(uint32_t));
+	hs.val = qalloc(( hs.mask + 1 ) * sizeof(int));
+	memset(hs.val, 0xff, ( hs.mask + 1 ) * sizeof(int));
+	for (i=0; i<hs.nb; i++) {
+		last = ( (uint32_t)hs.cols[i].c[0] << 24 ) | ( hs.cols[i].c[1] << 16 ) |
+		       ( hs.cols[i].c[2] << 8 ) | hs.cols[i].c[3];
+		k = qslot(last, hs.mask);
+		while (hs.val[k] >= 0)
+			k = ( k + 1 ) & hs.mask;
+		hs.key[k] = last;
+		hs.val[k] = i;
+	}
+
+	/* indexes */
+	idx = qalloc((size_t)w * h);
+	e = NULL;
+	for (y=0; y<h; y++) {
+		px = (const uint32_t *)( data + ( y * stride ) );
+		for (x=0; x<w; x++) {
+			if (e == NULL || px[x] != last) {
+				last = px[x];
+				unpremultiply(last, c);
+				e = qhash_get(&hs, c);
+			}
+			idx[( y * w ) + x] = e->idx;
+		}
+	}
+
+	free(hs.key);
+	free(hs.val);
+	free(hs.cols);
+	return idx;
+}
@@ -0,0 +1,23 @@
+/*
+ * Copyright 2010-2019 Thierry FOURNIER
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License.
+ */
+#ifndef __QUANT_H__
+#define __QUANT_H__
+
+/* straight RGBA colours, the ones with alpha first */
+struct palette {
+	int nb;
+	int nb_alpha;
+	unsigned char col[256][4];
+};
+
+unsigned char *quantize(const unsigned char *data, int w, int h, int stride,
+                        const unsigned char (*seeds)[4], int nseeds,
+                        int max, struct palette *pal);
+
+#endif /* __QUANT_H__ */
@@ -0,0 +1,152 @@
+/*
+ * Copyright 2010-2019 Thierry FOURNIER
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License.
+ */
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "pie.h"
+#include "ring.h"
+#include "stats.h"
+
+struct pie_ring {
+	int fd;
+	unsigned char *map;
+	size_t size;
+	uint32_t nslots;
+	uint32_t slot_size;
+	uint64_t seq; /* last frame published */
+};
+
+static inline
+struct pie_ring_frame *ring_frame(struct pie_ring *r, uint64_t n)
+{
+	return (struct pie_ring_frame *)( r->map + PIE_RING_HEAD +
+	                              ( ( n % r->nslots ) * r->slot_size ) );
+}
+
+/* Ring of <nslots> charts of at most <room> bytes of pixels on the file
+ * or memfd <fd>, which is closed with the ring. The memory is sized and
+ * cleared: the frames of a previous writer are dropped.
+ */
+struct pie_ring *pie_ring_fd(int fd, int nslots, size_t room)
+{
+	struct pie_ring_head *head;
+	struct pie_ring *r;
+	size_t slot;
+	int i;
+
+	/* the pixels of the slots stay 64 bytes aligned */
+	slot = sizeof(struct pie_ring_frame) + ( ( room + 63 ) & ~(size_t)63 );
+	if (nslots < 1 || slot > UINT32_MAX) {
+		fprintf(stderr, "bad ring size\n");
+		close(fd);
+		return NULL;
+	}
+
+	r = calloc(1, sizeof(struct pie_ring));
+	if (r == NULL) {
+		close(fd);
+		return NULL;
+	}
+	STATS_ADD(allocs, 1);
+	r->fd = fd;
+	r->nslots = nslots;
+	r->slot_size = slot;
+	r->size = PIE_RING_HEAD + ( slot * nslots );
+
+	if (ftruncate(fd, r->size) != 0) {
+		fprintf(stderr, "can't size the ring\n");
+		close(fd);
+		free(r);
+		return NULL;
+	}
+	r->map = mmap(NULL, r->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (r->map == MAP_FAILED) {
+		fprintf(stderr, "can't map the ring\n");
+		close(fd);
+		free(r);
+		return NULL;
+	}
+
+	head = (struct pie_ring_head *)r->map;
+	memset(head, 0, PIE_RING_HEAD);
+	for (i=0; i<nslots; i++)
+		memset(ring_frame(r, i), 0, sizeof(struct pie_ring_frame));
+	memcpy(head->magic, "PIER", 4);
+	head->version = PIE_RING_VERSION;
+	head->nslots = nslots;
+	head->slot_size = slot;
+	return r;
+}
+
+/* the same on the file <path>, created if needed, /dev/shm is memory */
+struct pie_ring *pie_ring_open(const char *path, int nslots, size_t room)
+{
+	int fd;
+
+	fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (fd < 0) {
+		fprintf(stderr, "can't open ring %s\n", path);
+		return NULL;
+	}
+	return pie_ring_fd(fd, nslots, room);
+}
+
+void pie_ring_close(struct pie_ring *r)
+{
+	munmap(r->map, r->size);
+	close(r->fd);
+	free(r);
+}
+
+/* The pixels of the next frame, for <len> bytes, or NULL if they don't
+ * fit in a slot. The slot is then marked as being drawn, a reader of
+ * its previous frame sees it changed.
+ */
+unsigned char *pie_ring_begin(struct pie_ring *r, size_t len)
+{
+	struct pie_ring_frame *f;
+
+	if (len > r->slot_size - sizeof(struct pie_ring_frame))
+		return NULL;
+
+	f = ring_frame(r, r->seq + 1);
+	f->seq = 0;
+	__sync_synchronize();
+	return (unsigned char *)( f + 1 );
+}
+
+/* the frame of pie_ring_begin() is complete, returns its number */
+unsigned long long pie_ring_publish(struct pie_ring *r, uint32_t w,
+                                    uint32_t h, uint32_t stride,
+                                    uint32_t format, uint32_t len)
+{
+	struct pie_ring_head *head = (struct pie_ring_head *)r->map;
+	struct pie_ring_frame *f;
+	uint64_t n = r->seq + 1;
+
+	f = ring_frame(r, n);
+	f->w = w;
+	f->h = h;
+	f->stride = stride;
+	f->format = format;
+	f->len = len;
+
+	/* the pixels and the header before the numbers */
+	__sync_synchronize();
+	f->seq = n;
+	__sync_synchronize();
+	head->seq = n;
+	r->seq = n;
+	STATS_ADD(bytes, len);
+	return n;
+}
@@ -0,0 +1,23 @@
+/*
+ * Copyright 2010-2019 Thierry FOURNIER
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License.
+ */
+#ifndef __RING_H__
+#define __RING_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "pie.h"
+
+/* the writer side, the layout of the ring is in pie.h */
+unsigned char *pie_ring_begin(struct pie_ring *r, size_t len);
+unsigned long long pie_ring_publish(struct pie_ring *r, uint32_t w,
+                                    uint32_t h, uint32_t stride,
+                                    uint32_t format, uint32_t len);
+
+#endif /* __RING_H__ */
@@ -0,0 +1,46 @@
+/*
+ * Copyright 2010-2019 Thierry FOURNIER
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License.
+ */
+#include <string.h>
+#include <time.h>
+
+#include "pie.h"
+#include "stats.h"
+
+int pie_stats_on = 0;
+struct pie_stats pie_stats_data;
+
+void pie_stats_enable(int enable)
+{
+	pie_stats_on = enable;
+}
+
+void pie_stats_reset(void)
+{
+	memset(&pie_stats_data, 0, sizeof(pie_stats_data));
+}
+
+const struct pie_stats *pie_get_stats(void)
+{
+	return &pie_stats_data;
+}
+
+/* monotonic clock in nanoseconds */
+unsigned long long pie_stats_clock(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ( (unsigned long long)ts.tv_sec * 1000000000ULL ) + ts.tv_nsec;
+}
+
+/* add the time elapsed since <start> to <phase> */
+void pie_stats_phase(int phase, unsigned long long start)
+{
+	__sync_fetch_and_add(&pie_stats_data.ns[phase], pie_stats_clock() - start);
+}
@@ -0,0 +1,38 @@
+/*
+ * Copyright 2010-2019 Thierry FOURNIER
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License.
+ */
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include "pie.h"
+
+extern int pie_stats_on;
+extern struct pie_stats pie_stats_data;
+
+/* The counters are updated by the band threads too. When the stats
+ * are disabled, each point costs one test.
+ */
+#define STATS_ADD(field, n) \
+	do { \
+		if (pie_stats_on) \
+			__sync_fetch_and_add(&pie_stats_data.field, (n)); \
+	} while (0)
+
+#define STATS_PHASE(phase, start) \
+	do { \
+		if (pie_stats_on) \
+			pie_stats_phase((phase), (start)); \
+	} while (0)
+
+static inline
+unsigned long long stats_start(void)
+{
+	return pie_stats_on ? pie_stats_clock() : 0;
+}
+
+#endif /* __STATS_H__ */
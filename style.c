@@ -0,0 +1,245 @@
+/*
+ * Copyright 2010-2019 Thierry FOURNIER
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License.
+ */
+#include <ctype.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pie.h"
+
+/* Style files. A line is '<key> <value>', the lines starting with '#'
+ * are comments:
+ *
+ *   width 400
+ *   background #ffffff
+ *   legend under
+ *
+ * The whole file is checked before the style is made, a style is
+ * either complete or not loaded.
+ */
+
+#define STYLE_LINE 4096
+
+/* kinds of values */
+#define STYLE_INT   0
+#define STYLE_REAL  1
+#define STYLE_COLOR 2
+#define STYLE_TEXT  3
+#define STYLE_WORD  4 /* the index of the word is the value */
+
+struct style_key {
+	const char *name;
+	int kind;
+	double min;
+	double max;
+	const char *words[4];
+};
+
+static const struct style_key keys[] = {
+	{ .name = "width",        .kind = STYLE_INT,  .min = 1, .max = 100000 },
+	{ .name = "height",       .kind = STYLE_INT,  .min = 1, .max = 100000 },
+	{ .name = "margin",       .kind = STYLE_INT,  .min = 0, .max = 100000 },
+	{ .name = "background",   .kind = STYLE_COLOR },
+	{ .name = "line-width",   .kind = STYLE_REAL, .min = 0, .max = 1000 },
+	{ .name = "line-color",   .kind = STYLE_COLOR },
+	{ .name = "explode",      .kind = STYLE_REAL, .min = 0, .max = 1 },
+	{ .name = "extrusion",    .kind = STYLE_REAL, .min = 0, .max = 1 },
+	{ .name = "ratio",        .kind = STYLE_REAL, .min = 0, .max = 1 },
+	{ .name = "title",        .kind = STYLE_TEXT },
+	{ .name = "title-size",   .kind = STYLE_INT,  .min = 1, .max = 1000 },
+	{ .name = "title-color",  .kind = STYLE_COLOR },
+	{ .name = "legend",       .kind = STYLE_WORD, .words = { "none", "under", "right", NULL } },
+	{ .name = "legend-size",  .kind = STYLE_REAL, .min = 0.1, .max = 1000 },
+	{ .name = "legend-color", .kind = STYLE_COLOR },
+	{ .name = "labels",       .kind = STYLE_WORD, .words = { "none", "outside", "inside", NULL } },
+	{ .name = "quality",      .kind = STYLE_WORD, .words = { "fast", "default", "best", NULL } },
+};
+#define NB_KEYS (int)( sizeof(keys) / sizeof(keys[0]) )
+
+/* '#rrggbb' or 'rrggbb', with an optional alpha 'aa' */
+static int style_color(const char *v)
+{
+	int i;
+
+	if (*v == '#')
+		v++;
+	for (i=0; isxdigit((unsigned char)v[i]); i++)
+		;
+	return v[i] == '\0' && ( i == 6 || i == 8 );
+}
+
+static void style_apply(struct conf *co, const char *name, double num,
+                        char *str)
+{
+	/**/ if (strcmp(name, "width") == 0)
+		pie_set_img_w(co, (int)num);
+	else if (strcmp(name, "height") == 0)
+		pie_set_img_h(co, (int)num);
+	else if (strcmp(name, "margin") == 0)
+		pie_set_margin(co, (int)num);
+	else if (strcmp(name, "background") == 0) {
+		pie_set_do_back(co, 1);
+		pie_set_back_color(co, str);
+	}
+	else if (strcmp(name, "line-width") == 0)
+		pie_set_line_width(co, num);
+	else if (strcmp(name, "line-color") == 0)
+		pie_set_line_color(co, str);
+	else if (strcmp(name, "explode") == 0)
+		pie_set_decal(co, num);
+	else if (strcmp(name, "extrusion") == 0)
+		pie_set_height(co, num);
+	else if (strcmp(name, "ratio") == 0)
+		pie_set_ratio(co, num);
+	else if (strcmp(name, "title") == 0)
+		pie_set_title(co, str);
+	else if (strcmp(name, "title-size") == 0)
+		pie_set_title_size(co, (int)num);
+	else if (strcmp(name, "title-color") == 0)
+		pie_set_title_color(co, str);
+	else if (strcmp(name, "legend") == 0)
+		pie_set_do_legend(co, (int)num);
+	else if (strcmp(name, "legend-size") == 0)
+		pie_set_legend_size(co, num);
+	else if (strcmp(name, "legend-color") == 0)
+		pie_set_legend_color(co, str);
+	else if (strcmp(name, "labels") == 0)
+		pie_set_do_labels(co, (int)num);
+	else if (strcmp(name, "quality") == 0)
+		pie_set_quality(co, (int)num);
+}
+
+/* Check the value <v> of the key <k> and write it in <num>. Returns an
+ * error message or NULL.
+ */
+static const char *style_value(const struct style_key *k, char *v,
+                               double *num)
+{
+	char *end;
+	int i;
+
+	switch (k->kind) {
+	case STYLE_INT:
+	case STYLE_REAL:
+		*num = strtod(v, &end);
+		if (end == v || *end != '\0')
+			return "not a number";
+		if (k->kind == STYLE_INT && *num != floor(*num))
+			return "not an integer";
+		if (*num < k->min || *num > k->max)
+			return "out of range";
+		return NULL;
+	case STYLE_COLOR:
+		return style_color(v) ? NULL : "not a colour #rrggbb or #rrggbbaa";
+	case STYLE_WORD:
+		for (i=0; k->words[i] != NULL; i++) {
+			if (strcmp(v, k->words[i]) == 0) {
+				*num = i;
+				return NULL;
+			}
+		}
+		return "unknown word";
+	default:
+		return NULL;
+	}
+}
+
+/* Load the style file <file>. Returns NULL, after a message, if it
+ * can't be read or is not valid.
+ */
+struct pie_style *pie_style_load(const char *file)
+{
+	struct pie_style *st;
+	struct conf *co;
+	const char *err;
+	char b[STYLE_LINE];
+	char *start = NULL;
+	char *v;
+	char *p;
+	double num;
+	int line = 0;
+	int i;
+	FILE *f;
+
+	f = fopen(file, "r");
+	if (f == NULL) {
+		fprintf(stderr, "can't open style file %s\n", file);
+		return NULL;
+	}
+	co = pie_new();
+	if (co == NULL) {
+		fprintf(stderr, "Memory error\n");
+		exit(1);
+	}
+
+	while (fgets(b, sizeof(b), f) != NULL) {
+		line++;
+		start = NULL;
+		if (strchr(b, '\n') == NULL && !feof(f)) {
+			err = "line too long";
+			goto error;
+		}
+
+		/* strip spaces, skip comments and empty lines */
+		start = b;
+		while (*start == ' ' || *start == '\t')
+			start++;
+		p = start + strlen(start);
+		while (p > start && isspace((unsigned char)p[-1]))
+			p--;
+		*p = '\0';
+		if (*start == '#' || *start == '\0')
+			continue;
+
+		/* key and value */
+		v = start;
+		while (*v != '\0' && *v != ' ' && *v != '\t')
+			v++;
+		if (*v != '\0')
+			*v++ = '\0';
+		while (*v == ' ' || *v == '\t')
+			v++;
+
+		for (i=0; i<NB_KEYS; i++)
+			if (strcmp(start, keys[i].name) == 0)
+				break;
+		if (i == NB_KEYS) {
+			err = "unknown key";
+			goto error;
+		}
+		if (*v == '\0') {
+			err = "missing value";
+			goto error;
+		}
+		num = 0;
+		err = style_value(&keys[i], v, &num);
+		if (err != NULL)
+			goto error;
+		style_apply(co, keys[i].name, num, v);
+	}
+	fclose(f);
+
+	st = pie_style_from(co);
+	pie_free(co);
+	if (st == NULL) {
+		fprintf(stderr, "Memory error\n");
+		exit(1);
+	}
+	return st;
+
+error:
+	if (start != NULL)
+		fprintf(stderr, "%s:%d: %s: %s\n", file, line, start, err);
+	else
+		fprintf(stderr, "%s:%d: %s\n", file, line, err);
+	fclose(f);
+	pie_free(co);
+	return NULL;
+}
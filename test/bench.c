@@ -0,0 +1,362 @@
+/*
+ * Copyright 2010-2019 Thierry FOURNIER
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "pie.h"
+
+/* Benchmark of the library entry points on synthetic charts from 1 to
+ * 1M slices. Each case runs until its time budget is spent and reports
+ * the time, the path segments and the output bytes per chart.
+ */
+
+#define BENCH_OUT "bench.out"
+
+/* value distributions */
+#define DIST_EQUAL    0
+#define DIST_UNIFORM  1
+#define DIST_ZIPF     2 /* 1/k, a few large slices and a long tail */
+#define DIST_DOMINANT 3 /* one slice of 90% */
+
+struct dataset {
+	const char *name;
+	int dist;
+	int explode; /* one slice out of <explode> is extruded, 0 for none */
+	int legend;
+};
+
+static const struct dataset datasets[] = {
+	{ "equal",    DIST_EQUAL,    0, 0 },
+	{ "uniform",  DIST_UNIFORM,  0, 1 },
+	{ "zipf",     DIST_ZIPF,     4, 1 },
+	{ "dominant", DIST_DOMINANT, 1, 2 },
+};
+#define NB_DATASETS (int)( sizeof(datasets) / sizeof(datasets[0]) )
+
+struct format {
+	const char *name;
+	int mode;
+};
+
+static const struct format formats[] = {
+	{ "PNG",  PIE_PNG },
+	{ "PNG8", PIE_PNG8 },
+	{ "APNG", PIE_APNG },
+	{ "SVG",  PIE_SVG },
+	{ "PDF",  PIE_PDF },
+	{ "PS",   PIE_PS },
+	{ "EPS",  PIE_EPS },
+	{ "RAW",  PIE_RAW },
+	{ "PPM",  PIE_PPM },
+	{ "PAM",  PIE_PAM },
+	{ "QOI",  PIE_QOI },
+	{ "GEOM", PIE_GEOM },
+};
+#define NB_FORMATS (int)( sizeof(formats) / sizeof(formats[0]) )
+
+/* entries: pie_add, pie_cairo_draw then pie_draw for each format */
+#define ENTRY_ADD   0
+#define ENTRY_CAIRO 1
+#define NB_ENTRIES  ( 2 + NB_FORMATS )
+
+/* the slices of a generated chart */
+struct data {
+	int nb;
+	double *value;
+	double *extrude;
+	char **color;
+	char **name;
+};
+
+static int img_size = 400;
+static double budget = 0.2;
+
+static void *xalloc(size_t len)
+{
+	void *b;
+
+	b = malloc(len);
+	if (b == NULL) {
+		fprintf(stderr, "Memory error\n");
+		exit(1);
+	}
+	return b;
+}
+
+/* xorshift, the datasets are the same from one run to the other */
+static unsigned int seed;
+
+static inline unsigned int rnd(void)
+{
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+	return seed;
+}
+
+static void gen_data(const struct dataset *ds, int nb, struct data *d)
+{
+	unsigned int c;
+	int i;
+
+	d->nb = nb;
+	d->value = xalloc(nb * sizeof(double));
+	d->extrude = xalloc(nb * sizeof(double));
+	d->color = xalloc(nb * sizeof(char *));
+	d->name = xalloc(nb * sizeof(char *));
+
+	seed = 2463534242U;
+	for (i=0; i<nb; i++) {
+
+		switch (ds->dist) {
+		case DIST_UNIFORM:
+			d->value[i] = 1 + ( rnd() % 1000 );
+			break;
+		case DIST_ZIPF:
+			d->value[i] = 1000.0 / ( i + 1 );
+			break;
+		case DIST_DOMINANT:
+			d->value[i] = i == 0 && nb > 1 ? 9.0 * ( nb - 1 ) : 1;
+			break;
+		default:
+			d->value[i] = 1;
+			break;
+		}
+
+		if (ds->explode > 0 && ( i % ds->explode ) == 0)
+			d->extrude[i] = 0.1;
+		else
+			d->extrude[i] = 0;
+
+		c = rnd() & 0xffffff;
+		d->color[i] = xalloc(8);
+		snprintf(d->color[i], 8, "#%06x", c);
+		d->name[i] = xalloc(20);
+		snprintf(d->name[i], 20, "slice %d", i);
+	}
+}
+
+static void free_data(struct data *d)
+{
+	int i;
+
+	for (i=0; i<d->nb; i++) {
+		free(d->color[i]);
+		free(d->name[i]);
+	}
+	free(d->value);
+	free(d->extrude);
+	free(d->color);
+	free(d->name);
+}
+
+static struct conf *new_chart(const struct dataset *ds, struct data *d)
+{
+	struct conf *co;
+	int i;
+
+	co = pie_new();
+	if (co == NULL) {
+		fprintf(stderr, "Memory error\n");
+		exit(1);
+	}
+	pie_set_img_w(co, img_size);
+	pie_set_img_h(co, img_size);
+	pie_set_do_back(co, 1);
+	pie_set_back_color(co, "#ffffff");
+	pie_set_title(co, "bench");
+	pie_set_do_legend(co, ds->legend);
+	for (i=0; i<d->nb; i++)
+		pie_add(co, d->value[i], d->color[i], d->extrude[i], d->name[i]);
+	return co;
+}
+
+static long long file_size(const char *fn)
+{
+	struct stat st;
+
+	if (stat(fn, &st) != 0)
+		return 0;
+	return st.st_size;
+}
+
+/* run one entry until the budget is spent, returns ns per chart */
+static double run(int entry, const struct dataset *ds, struct data *d,
+                  struct conf *co, cairo_t *c, int *iter,
+                  double *segments, long long *bytes)
+{
+	const struct pie_stats *st;
+	unsigned long long start;
+	unsigned long long now;
+	struct conf *tmp;
+	int n;
+
+	pie_stats_reset();
+	start = pie_stats_clock();
+	n = 0;
+	do {
+		switch (entry) {
+		case ENTRY_ADD:
+			tmp = new_chart(ds, d);
+			pie_free(tmp);
+			break;
+		case ENTRY_CAIRO:
+			pie_cairo_draw(c, co);
+			break;
+		default:
+			pie_draw(co, formats[entry - 2].mode, BENCH_OUT);
+			break;
+		}
+		n++;
+		now = pie_stats_clock();
+	} while (now - start < budget * 1e9);
+
+	st = pie_get_stats();
+	*iter = n;
+	*segments = (double)st->segments / n;
+	*bytes = entry >= 2 ? file_size(BENCH_OUT) : 0;
+	return (double)( now - start ) / n;
+}
+
+static const char *entry_name(int entry)
+{
+	static char buf[32];
+
+	if (entry == ENTRY_ADD)
+		return "pie_add";
+	if (entry == ENTRY_CAIRO)
+		return "pie_cairo_draw";
+	snprintf(buf, sizeof(buf), "pie_draw %s", formats[entry - 2].name);
+	return buf;
+}
+
+static void usage(void)
+{
+	printf(
+		"\n"
+		"Syntax: bench [-n <integer>] [-d <dataset>] [-e <entry>]\n"
+		"              [-t <float>] [-w <integer>]\n"
+		"\n"
+		" -n <integer>         : Largest chart in slices, the sizes are the\n"
+		"                        powers of 10 up to it. Default is 1000000\n"
+		" -d <dataset>         : Only this dataset: equal, uniform, zipf or\n"
+		"                        dominant\n"
+		" -e <entry>           : Only the entries containing this string,\n"
+		"                        ex: 'PNG' or 'pie_add'\n"
+		" -t <float>           : Time budget of each case in seconds.\n"
+		"                        Default is 0.2\n"
+		" -w <integer>         : Image size in pixel. Default is 400\n"
+		"\n"
+		"A case expected to run more than 10 times its budget, from the\n"
+		"time of the previous size, is skipped.\n"
+		"\n"
+	);
+	exit(0);
+}
+
+int main(int argc, char *argv[])
+{
+	const struct dataset *ds;
+	const char *only_ds = NULL;
+	const char *only_entry = NULL;
+	cairo_surface_t *s;
+	cairo_t *c;
+	struct conf *co;
+	struct data d;
+	double last_ns[NB_ENTRIES];
+	int last_nb[NB_ENTRIES];
+	double ns;
+	double predict;
+	double segments;
+	long long bytes;
+	int max = 1000000;
+	int nb;
+	int iter;
+	int i;
+	int e;
+
+	for (i=1; i<argc; i++) {
+		if (argv[i][0] != '-' || argv[i][1] == '\0' || argv[i][2] != '\0' ||
+		    i + 1 >= argc)
+			usage();
+		switch (argv[i][1]) {
+		case 'n':
+			max = atoi(argv[++i]);
+			break;
+		case 'd':
+			only_ds = argv[++i];
+			break;
+		case 'e':
+			only_entry = argv[++i];
+			break;
+		case 't':
+			budget = atof(argv[++i]);
+			break;
+		case 'w':
+			img_size = atoi(argv[++i]);
+			break;
+		default:
+			usage();
+		}
+	}
+
+	pie_stats_enable(1);
+	s = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, img_size, img_size);
+	c = cairo_create(s);
+
+	printf("%-8s %-9s %-16s %8s %14s %12s %10s\n", "slices", "dataset",
+	       "entry", "iter", "ns/chart", "segs/chart", "bytes");
+
+	for (i=0; i<NB_DATASETS; i++) {
+		ds = &datasets[i];
+		if (only_ds != NULL && strcmp(only_ds, ds->name) != 0)
+			continue;
+
+		for (e=0; e<NB_ENTRIES; e++)
+			last_nb[e] = 0;
+
+		for (nb=1; nb<=max; nb*=10) {
+			gen_data(ds, nb, &d);
+			co = new_chart(ds, &d);
+
+			for (e=0; e<NB_ENTRIES; e++) {
+				if (only_entry != NULL &&
+				    strstr(entry_name(e), only_entry) == NULL)
+					continue;
+
+				/* the time grows at least with the slices */
+				if (last_nb[e] > 0) {
+					predict = last_ns[e] * ( (double)nb / last_nb[e] );
+					if (predict > budget * 1e10) {
+						printf("%-8d %-9s %-16s %8s\n", nb, ds->name,
+						       entry_name(e), "skipped");
+						continue;
+					}
+				}
+
+				ns = run(e, ds, &d, co, c, &iter, &segments, &bytes);
+				last_ns[e] = ns;
+				last_nb[e] = nb;
+				printf("%-8d %-9s %-16s %8d %14.0f %12.0f %10lld\n", nb,
+				       ds->name, entry_name(e), iter, ns, segments, bytes);
+				fflush(stdout);
+			}
+
+			pie_free(co);
+			free_data(&d);
+		}
+	}
+
+	cairo_destroy(c);
+	cairo_surface_destroy(s);
+	remove(BENCH_OUT);
+	return 0;
+}
@@ -0,0 +1,1299 @@
+/*
+ * Copyright 2010-2019 Thierry FOURNIER
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License.
+ */
+#include <fcntl.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <zlib.h>
+
+#include "pie.h"
+
+/* Pixel diff of the render paths. Each chart of the corpus is drawn by
+ * pie_cairo_draw() in an ARGB32 surface, the reference, then by each
+ * path through pie_draw(). The output is decoded and compared pixel by
+ * pixel in premultiplied RGBA: a path fails if too many pixels differ
+ * by more than its tolerance or if the PSNR is under its threshold.
+ * The failures are written as images: reference, path and diff map
+ * side by side. The ring path reads its frame back from the mapped
+ * file, as a reader of the ring does, see render_ring().
+ *
+ * pie_cairo_draw() itself is compared to the baseline renderer below,
+ * on the charts without title, legend nor labels: the geometry of the pie as
+ * it was drawn before the optimizations of pie.c and ellipse.c.
+ *
+ * The hit test is checked on the faces of the baseline renderer and on
+ * the legend lines and the labels of the GEOMBIN layout, see
+ * hit_faces() and hit_layout().
+ */
+
+#define GOLDEN_OUT "golden.out"
+
+/* charts of the corpus */
+struct config {
+	const char *name;
+	int nb;
+	int legend;
+	int title;
+	int labels; /* PIE_LABELS_* */
+	int back;
+	double line;
+	double explode; /* every other slice */
+	int alpha; /* of every third slice, 0 is opaque */
+	double decal;
+	double ratio;
+	double height;
+	int w;
+	int h;
+};
+
+static const struct config configs[] = {
+	/* name        nb  leg tit lab back line expl alpha decal ratio height w    h */
+	{ "basic",      4, 0,  0,  0,  1,   0,   0,   0,    -1,   -1,   -1,    400, 400 },
+	{ "legend",    11, 1,  1,  0,  1,   1,   0.1, 0,    -1,   -1,   -1,    400, 400 },
+	{ "legend2",    6, 2,  1,  0,  0,   0,   0,   0,    -1,   -1,   -1,    500, 300 },
+	{ "explode",    5, 0,  0,  0,  0,   2,   0.3, 0,    -1,   -1,   -1,    300, 300 },
+	{ "flat",       7, 0,  1,  0,  1,   1,   0,   0,    -1,   0.3,  0,     400, 250 },
+	{ "tall",       3, 1,  0,  0,  1,   0,   0.2, 0,    -1,   0.9,  0.8,   250, 400 },
+	{ "single",     1, 0,  0,  0,  0,   0,   0,   0,    -1,   -1,   -1,    200, 200 },
+	{ "many",     200, 0,  0,  0,  1,   0,   0,   0,    -1,   -1,   -1,    400, 400 },
+	{ "seams",     12, 0,  0,  0,  1,   0,   0,   0,    0,    -1,   -1,    400, 400 },
+	{ "deep",       9, 0,  0,  0,  0,   0,   0.2, 0,    0.05, 0.8,  0.9,   300, 400 },
+	{ "labels",     8, 0,  0,  1,  1,   0,   0.1, 0,    -1,   -1,   -1,    500, 400 },
+	{ "inside",     6, 0,  1,  2,  0,   1,   0,   0,    -1,   -1,   -1,    400, 400 },
+	{ "glass",     12, 0,  0,  0,  1,   1,   0.2, 0x80, -1,   -1,   -1,    400, 400 },
+};
+#define NB_CONFIGS (int)( sizeof(configs) / sizeof(configs[0]) )
+
+/* render paths compared to the reference */
+struct path {
+	const char *name;
+	int mode;
+	int band;
+	int threads;
+	int filter;
+	cairo_format_t format;
+	int quality;
+	int opaque; /* only for the charts with a background */
+
+	int tol;     /* largest channel difference of a good pixel */
+	double bad;  /* percent of pixels allowed over the tolerance */
+	double psnr; /* dB */
+};
+
+static const struct path paths[] = {
+	/* unpremultiplied then premultiplied again, 1 of rounding */
+	{ "png",      PIE_PNG,  0,  1, PIE_FILTER_ADAPTIVE, CAIRO_FORMAT_ARGB32,    PIE_QUALITY_DEFAULT, 0,   1, 0,    50 },
+	{ "png-mt",   PIE_PNG,  0,  3, PIE_FILTER_PAETH,    CAIRO_FORMAT_ARGB32,    PIE_QUALITY_DEFAULT, 0,   1, 0,    50 },
+	{ "band",     PIE_PNG,  7,  3, PIE_FILTER_ADAPTIVE, CAIRO_FORMAT_ARGB32,    PIE_QUALITY_DEFAULT, 0,   1, 0,    50 },
+	{ "band-auto",PIE_PNG,  PIE_BAND_AUTO, 1, PIE_FILTER_ADAPTIVE, CAIRO_FORMAT_ARGB32, PIE_QUALITY_DEFAULT, 0, 1, 0, 50 },
+	{ "raw",      PIE_RAW,  0,  1, PIE_FILTER_ADAPTIVE, CAIRO_FORMAT_ARGB32,    PIE_QUALITY_DEFAULT, 0,   0, 0,    99 },
+	{ "ring",     PIE_RING, 0,  1, PIE_FILTER_ADAPTIVE, CAIRO_FORMAT_ARGB32,    PIE_QUALITY_DEFAULT, 0,   0, 0,    99 },
+	{ "rgb24",    PIE_PNG,  0,  1, PIE_FILTER_ADAPTIVE, CAIRO_FORMAT_RGB24,     PIE_QUALITY_DEFAULT, 1,   1, 0,    50 },
+	{ "rgb565",   PIE_PNG,  0,  1, PIE_FILTER_ADAPTIVE, CAIRO_FORMAT_RGB16_565, PIE_QUALITY_DEFAULT, 1,   8, 0,    35 },
+	{ "png8",     PIE_PNG8, 0,  2, PIE_FILTER_ADAPTIVE, CAIRO_FORMAT_ARGB32,    PIE_QUALITY_DEFAULT, 0,  48, 1,    28 },
+	{ "best",     PIE_PNG,  0,  1, PIE_FILTER_ADAPTIVE, CAIRO_FORMAT_ARGB32,    PIE_QUALITY_BEST,    0,  64, 1,    28 },
+};
+#define NB_PATHS (int)( sizeof(paths) / sizeof(paths[0]) )
+
+/* pie_cairo_draw() compared to the baseline renderer */
+static const struct path geometry =
+	{ "geometry", 0,        0,  1, PIE_FILTER_ADAPTIVE, CAIRO_FORMAT_ARGB32,    PIE_QUALITY_DEFAULT, 0,   4, 0.1,  50 };
+
+static const char *colors[] = {
+	"#ffbe00", "#ff0000", "#00ff00", "#0000ff", "#00ffff", "#ff00ff",
+	"#808080", "#804000", "#ffffff", "#000000", "#40c080",
+};
+#define NB_COLORS (int)( sizeof(colors) / sizeof(colors[0]) )
+
+/* an image as premultiplied RGBA bytes */
+struct image {
+	int w;
+	int h;
+	unsigned char *px;
+};
+
+static void *xalloc(size_t len)
+{
+	void *b;
+
+	b = malloc(len);
+	if (b == NULL) {
+		fprintf(stderr, "Memory error\n");
+		exit(1);
+	}
+	return b;
+}
+
+static inline double slice_value(int i)
+{
+	return 1 + ( ( i * 7 ) % 11 );
+}
+
+static inline double slice_explode(const struct config *cf, int i)
+{
+	return ( i % 2 ) == 0 ? cf->explode : 0;
+}
+
+/* the colour of the slice <i>, in <buf> if translucent */
+static const char *slice_color(const struct config *cf, int i, char *buf)
+{
+	if (cf->alpha == 0 || ( i % 3 ) != 1)
+		return colors[i % NB_COLORS];
+	snprintf(buf, 10, "%s%02x", colors[i % NB_COLORS], cf->alpha);
+	return buf;
+}
+
+static struct conf *new_chart(const struct config *cf, const struct path *pa)
+{
+	struct conf *co;
+	char name[32];
+	char col[10];
+	int i;
+
+	co = pie_new();
+	if (co == NULL) {
+		fprintf(stderr, "Memory error\n");
+		exit(1);
+	}
+	pie_set_img_w(co, cf->w);
+	pie_set_img_h(co, cf->h);
+	pie_set_do_legend(co, cf->legend);
+	pie_set_do_labels(co, cf->labels);
+	if (cf->title)
+		pie_set_title(co, "the title");
+	if (cf->back) {
+		pie_set_do_back(co, 1);
+		pie_set_back_color(co, "#ffffff");
+	}
+	pie_set_line_width(co, cf->line);
+	if (cf->decal >= 0)
+		pie_set_decal(co, cf->decal);
+	if (cf->ratio >= 0)
+		pie_set_ratio(co, cf->ratio);
+	if (cf->height >= 0)
+		pie_set_height(co, cf->height);
+
+	if (pa != NULL) {
+		pie_set_band(co, pa->band);
+		pie_set_threads(co, pa->threads);
+		pie_set_filter(co, pa->filter);
+		pie_set_format(co, pa->format);
+		pie_set_quality(co, pa->quality);
+	}
+
+	for (i=0; i<cf->nb; i++) {
+		snprintf(name, sizeof(name), "slice %d", i);
+		pie_add(co, slice_value(i), (char *)slice_color(cf, i, col),
+		        slice_explode(cf, i), name);
+	}
+	return co;
+}
+
+static void new_image(struct image *im, int w, int h)
+{
+	im->w = w;
+	im->h = h;
+	im->px = xalloc((size_t)w * h * 4);
+}
+
+/* cairo ARGB32, native endian words */
+static void from_argb32(struct image *im, const unsigned char *data,
+                        int stride)
+{
+	const uint32_t *line;
+	unsigned char *o;
+	int x;
+	int y;
+
+	for (y=0; y<im->h; y++) {
+		line = (const uint32_t *)( data + ( y * stride ) );
+		for (x=0; x<im->w; x++) {
+			o = &im->px[( ( y * im->w ) + x ) * 4];
+			o[0] = line[x] >> 16;
+			o[1] = line[x] >> 8;
+			o[2] = line[x];
+			o[3] = line[x] >> 24;
+		}
+	}
+}
+
+/* The baseline renderer: the pie of pie_cairo_draw() without title nor
+ * legend, drawn as before the optimizations. Each point of the arcs is
+ * a cos and a sin, every face of every slice is drawn in painter order,
+ * none is culled, and the rounded face is the top arc and the bottom arc
+ * as two open subpaths.
+ */
+
+#define BASE_MARGIN 10.0
+#define BASE_DECAL  0.1
+#define BASE_RATIO  0.5
+#define BASE_HEIGHT 0.4
+
+struct base_portion {
+	double light[4];
+	double dark[4];
+	double dark_deg[4];
+
+	double t_cent[2];
+	double t_strt[2];
+	double t_stop[2];
+	double b_cent[2];
+	double b_stop[2];
+
+	double ang_strt;
+	double ang_stop;
+	double ca_strt;
+	double ca_stop;
+	double tmp;
+};
+
+/* kinds of the faces, the red of their code in the hit test */
+enum {
+	HIT_NONE = 0,
+	HIT_TOP,
+	HIT_ROUNDED,
+	HIT_STOP,
+	HIT_START,
+	HIT_LEGEND,
+	HIT_LABEL,
+	HIT_KINDS
+};
+
+struct base {
+	struct base_portion *p;
+	int nb;
+	int code; /* the faces are flat and coded, see base_fill() */
+	double line;
+	double pie_w;
+	double rx;
+	double ry;
+	double height;
+};
+
+static void base_ellipse(cairo_t *c, double x, double y, double a, double b,
+                         double start, double stop)
+{
+	double i;
+
+	while (stop < start)
+		stop += 2.0f * M_PI;
+
+	cairo_line_to(c, x+(a*cos(start)), y+(b*sin(start)));
+	for (i=start; i<stop; i += 0.01f)
+		cairo_line_to(c, x+(a*cos(i)), y+(b*sin(i)));
+	cairo_line_to(c, x+(a*cos(stop)), y+(b*sin(stop)));
+}
+
+static void base_ellipse_negative(cairo_t *c, double x, double y, double a,
+                                  double b, double start, double stop)
+{
+	double i;
+
+	while (stop > start)
+		stop -= 2.0f * M_PI;
+
+	cairo_move_to(c, x+(a*cos(start)), y+(b*sin(start)));
+	for (i=start; i>stop; i -= 0.01f)
+		cairo_line_to(c, x+(a*cos(i)), y+(b*sin(i)));
+	cairo_line_to(c, x+(a*cos(stop)), y+(b*sin(stop)));
+}
+
+/* "#rrggbb" or "#rrggbbaa" */
+static void base_color(const char *hex, double *out)
+{
+	unsigned int v;
+	unsigned int a = 0xff;
+
+	sscanf(hex + 1, "%06x", &v);
+	if (strlen(hex) == 9)
+		sscanf(hex + 7, "%02x", &a);
+	out[0] = ( ( v >> 16 ) & 0xff ) / 255.0;
+	out[1] = ( ( v >> 8 ) & 0xff ) / 255.0;
+	out[2] = ( v & 0xff ) / 255.0;
+	out[3] = a / 255.0;
+}
+
+/* In the coded mode, a face is its kind in red and its slice + 1 in
+ * green and blue, without line.
+ */
+static void base_fill(cairo_t *c, struct base *b, struct base_portion *p,
+                      int kind, const double *col)
+{
+	int s = ( p - b->p ) + 1;
+
+	if (b->code) {
+		cairo_set_source_rgba(c, kind / 255.0, ( s >> 8 ) / 255.0,
+		                      ( s & 0xff ) / 255.0, 1);
+		cairo_fill(c);
+		return;
+	}
+
+	cairo_set_source_rgba(c, col[0], col[1], col[2], col[3]);
+	cairo_fill_preserve(c);
+	cairo_set_line_width(c, b->line);
+	cairo_set_source_rgba(c, 0, 0, 0, 1);
+	cairo_stroke(c);
+}
+
+/* side face from the centre to the border at <t>, <dy> lower */
+static void base_face_side(cairo_t *c, struct base *b, struct base_portion *p,
+                           double *t, int kind)
+{
+	double dy = b->height * b->ry;
+
+	cairo_new_path(c);
+	cairo_move_to(c, p->t_cent[0], p->t_cent[1]);
+	cairo_line_to(c, t[0], t[1]);
+	cairo_line_to(c, t[0], t[1] + dy);
+	cairo_line_to(c, p->b_cent[0], p->b_cent[1]);
+	cairo_line_to(c, p->t_cent[0], p->t_cent[1]);
+	base_fill(c, b, p, kind, p->dark);
+}
+
+static void base_face_rounded(cairo_t *c, struct base *b,
+                              struct base_portion *p)
+{
+	cairo_pattern_t *pat;
+	double tstrt[2];
+	double bstop[2];
+	double strt;
+	double stop;
+
+	if (p->ca_strt >= M_PI && p->ca_strt < 2.0 * M_PI) {
+		strt = 2.0 * M_PI;
+		tstrt[0] = ( b->rx * cos(strt) ) + p->t_cent[0];
+		tstrt[1] = ( b->ry * sin(strt) ) + p->t_cent[1];
+	}
+	else {
+		strt = p->ang_strt;
+		tstrt[0] = p->t_strt[0];
+		tstrt[1] = p->t_strt[1];
+	}
+	if (p->ca_stop > M_PI) {
+		stop = M_PI;
+		bstop[0] = ( b->rx * cos(M_PI) ) + p->t_cent[0];
+		bstop[1] = ( b->rx * sin(M_PI) ) + p->t_cent[1] + ( b->height * b->ry );
+	}
+	else {
+		stop = p->ang_stop;
+		bstop[0] = p->b_stop[0];
+		bstop[1] = p->b_stop[1];
+	}
+
+	cairo_new_path(c);
+	cairo_move_to(c, tstrt[0], tstrt[1]);
+	base_ellipse(c, p->t_cent[0], p->t_cent[1], b->rx, b->ry, strt, stop);
+	cairo_line_to(c, bstop[0], bstop[1]);
+	base_ellipse_negative(c, p->b_cent[0], p->b_cent[1], b->rx, b->ry, stop,
+	                      strt);
+	cairo_line_to(c, tstrt[0], tstrt[1]);
+
+	if (b->code) {
+		base_fill(c, b, p, HIT_ROUNDED, NULL);
+		return;
+	}
+
+	pat = cairo_pattern_create_linear(BASE_MARGIN, 0.0,
+	                                  BASE_MARGIN + b->pie_w, 256.0);
+	cairo_pattern_add_color_stop_rgba(pat, 1, p->light[0], p->light[1],
+	                                  p->light[2], p->light[3]);
+	cairo_pattern_add_color_stop_rgba(pat, 0, p->dark_deg[0], p->dark_deg[1],
+	                                  p->dark_deg[2], p->dark_deg[3]);
+	cairo_set_source(c, pat);
+	cairo_pattern_destroy(pat);
+	cairo_fill_preserve(c);
+	cairo_set_line_width(c, b->line);
+	cairo_set_source_rgba(c, 0, 0, 0, 1);
+	cairo_stroke(c);
+}
+
+static void base_face_top(cairo_t *c, struct base *b, struct base_portion *p)
+{
+	cairo_new_path(c);
+	cairo_move_to(c, p->t_cent[0], p->t_cent[1]);
+	base_ellipse(c, p->t_cent[0], p->t_cent[1], b->rx, b->ry, p->ang_strt,
+	             p->ang_stop);
+	cairo_line_to(c, p->t_cent[0], p->t_cent[1]);
+	base_fill(c, b, p, HIT_TOP, p->light);
+}
+
+/* the painter order of the faces, sorted by insertion */
+static int base_sort(struct base *b, struct base_portion **ps, int face)
+{
+	struct base_portion *p;
+	struct base_portion *swap;
+	int inter = 0;
+	int n = 0;
+	int i;
+	int j;
+
+	for (i=0; i<b->nb; i++) {
+		p = &b->p[i];
+		switch (face) {
+		case 0: /* start: from the largest angle */
+			if (p->ca_strt > M_PI/2.0f && p->ca_strt < (3.0f*M_PI)/2.0f) {
+				p->tmp = -p->ca_strt;
+				ps[n++] = p;
+			}
+			break;
+		case 1: /* stop */
+			if (p->ca_stop > (3.0f*M_PI)/2.0f && p->ca_stop <= 2.0f*M_PI) {
+				p->tmp = p->ca_stop;
+				ps[n++] = p;
+			}
+			if (p->ca_stop >= 0.0f && p->ca_stop < M_PI/2.0f) {
+				p->tmp = p->ca_stop + 2.0f*M_PI;
+				ps[n++] = p;
+			}
+			break;
+		default: /* rounded ending in the front half */
+			if (p->ca_stop > 0.0f && p->ca_stop <= M_PI/2.0f) {
+				p->tmp = p->ca_stop;
+				ps[n++] = p;
+			}
+			break;
+		}
+	}
+
+	/* then the rounded starting in the front half, largest first */
+	if (face == 2) {
+		inter = n;
+		for (i=0; i<b->nb; i++) {
+			p = &b->p[i];
+			if (p->ca_strt >= 0.0f && p->ca_strt < M_PI &&
+			    p->ca_stop > M_PI/2.0f) {
+				p->tmp = -p->ca_strt;
+				ps[n++] = p;
+			}
+		}
+	}
+
+	for (i=1; i<n; i++) {
+		for (j=i; j>0 && ( face != 2 || j != inter ) &&
+		          ps[j]->tmp < ps[j-1]->tmp; j--) {
+			swap = ps[j];
+			ps[j] = ps[j-1];
+			ps[j-1] = swap;
+		}
+	}
+	return n;
+}
+
+static void baseline(const struct config *cf, struct image *im, int code)
+{
+	cairo_surface_t *s;
+	cairo_t *c;
+	struct base_portion **ps;
+	struct base_portion *p;
+	struct base b;
+	double decal;
+	double ratio;
+	double total = 0;
+	double last = 0;
+	double ex = 0;
+	double pie_h;
+	double hauteur;
+	double cx;
+	double cy;
+	double d;
+	double m;
+	int n;
+	char col[10];
+	int i;
+
+	decal = cf->decal >= 0 ? cf->decal : BASE_DECAL;
+	ratio = cf->ratio >= 0 ? cf->ratio : BASE_RATIO;
+	b.height = cf->height >= 0 ? cf->height : BASE_HEIGHT;
+	b.line = cf->line;
+	b.nb = cf->nb;
+	b.code = code;
+	b.p = xalloc(cf->nb * sizeof(struct base_portion));
+	ps = xalloc(cf->nb * 2 * sizeof(struct base_portion *));
+
+	for (i=0; i<cf->nb; i++) {
+		total += slice_value(i);
+		if (slice_explode(cf, i) > ex)
+			ex = slice_explode(cf, i);
+	}
+
+	b.pie_w = cf->w - ( 2.0 * BASE_MARGIN );
+	pie_h = cf->h - ( 2.0 * BASE_MARGIN );
+	b.rx = b.pie_w / ( 2.0f * ( ex + decal + 1.0f ) );
+	b.ry = b.rx * ratio;
+	hauteur = ( b.ry * 2.0f ) + ( b.height * b.ry ) + ( ex * b.ry * 2.0f );
+	if (hauteur > pie_h) {
+		b.rx *= pie_h / hauteur;
+		b.ry *= pie_h / hauteur;
+	}
+	cx = ( b.pie_w / 2.0f ) + BASE_MARGIN;
+	cy = ( ( pie_h - ( b.height * b.ry ) ) / 2.0f ) + BASE_MARGIN;
+
+	for (i=0; i<cf->nb; i++) {
+		p = &b.p[i];
+		p->ang_strt = last;
+		p->ang_stop = last + ( ( 2.0f * M_PI * slice_value(i) ) / total );
+		last = p->ang_stop;
+
+		p->ca_strt = p->ang_strt;
+		while (p->ca_strt > 2.0 * M_PI)
+			p->ca_strt -= 2.0 * M_PI;
+		p->ca_stop = p->ang_stop;
+		while (p->ca_stop > 2.0 * M_PI)
+			p->ca_stop -= 2.0 * M_PI;
+
+		d = decal + slice_explode(cf, i);
+		m = ( p->ang_strt + p->ang_stop ) / 2;
+		p->t_cent[0] = ( d * b.rx * cos(m) ) + cx;
+		p->t_cent[1] = ( d * b.ry * sin(m) ) + cy;
+		p->t_strt[0] = ( b.rx * cos(p->ang_strt) ) + p->t_cent[0];
+		p->t_strt[1] = ( b.ry * sin(p->ang_strt) ) + p->t_cent[1];
+		p->t_stop[0] = ( b.rx * cos(p->ang_stop) ) + p->t_cent[0];
+		p->t_stop[1] = ( b.ry * sin(p->ang_stop) ) + p->t_cent[1];
+		p->b_cent[0] = p->t_cent[0];
+		p->b_cent[1] = p->t_cent[1] + ( b.height * b.ry );
+		p->b_stop[0] = p->t_stop[0];
+		p->b_stop[1] = p->t_stop[1] + ( b.height * b.ry );
+
+		base_color(slice_color(cf, i, col), p->light);
+		for (n=0; n<3; n++) {
+			p->dark_deg[n] = p->light[n] * 0.1;
+			p->dark[n] = p->light[n] * 0.5;
+		}
+		p->dark_deg[3] = p->light[3];
+		p->dark[3] = p->light[3];
+	}
+
+	s = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, cf->w, cf->h);
+	c = cairo_create(s);
+	if (cf->back && !code) {
+		cairo_new_path(c);
+		cairo_rectangle(c, -1, -1, cf->w+1, cf->h+1);
+		cairo_set_source_rgba(c, 1, 1, 1, 1);
+		cairo_fill(c);
+	}
+
+	if (b.height > 0.0f) {
+		n = base_sort(&b, ps, 0);
+		for (i=0; i<n; i++)
+			base_face_side(c, &b, ps[i], ps[i]->t_strt, HIT_START);
+		n = base_sort(&b, ps, 1);
+		for (i=0; i<n; i++)
+			base_face_side(c, &b, ps[i], ps[i]->t_stop, HIT_STOP);
+		n = base_sort(&b, ps, 2);
+		for (i=0; i<n; i++)
+			base_face_rounded(c, &b, ps[i]);
+	}
+	for (i=0; i<cf->nb; i++)
+		base_face_top(c, &b, &b.p[i]);
+
+	cairo_destroy(c);
+	cairo_surface_flush(s);
+	new_image(im, cf->w, cf->h);
+	from_argb32(im, cairo_image_surface_get_data(s),
+	            cairo_image_surface_get_stride(s));
+	cairo_surface_destroy(s);
+	free(b.p);
+	free(ps);
+}
+
+static void reference(const struct config *cf, struct image *im)
+{
+	cairo_surface_t *s;
+	cairo_t *c;
+	struct conf *co;
+
+	co = new_chart(cf, NULL);
+	s = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, cf->w, cf->h);
+	c = cairo_create(s);
+	pie_cairo_draw(c, co);
+	cairo_destroy(c);
+	cairo_surface_flush(s);
+
+	new_image(im, cf->w, cf->h);
+	from_argb32(im, cairo_image_surface_get_data(s),
+	            cairo_image_surface_get_stride(s));
+	cairo_surface_destroy(s);
+	pie_free(co);
+}
+
+static unsigned char *read_file(const char *fn, long *len)
+{
+	unsigned char *b;
+	FILE *f;
+
+	f = fopen(fn, "r");
+	if (f == NULL) {
+		fprintf(stderr, "can't open %s\n", fn);
+		exit(1);
+	}
+	fseek(f, 0, SEEK_END);
+	*len = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	b = xalloc(*len + 1);
+	if (fread(b, 1, *len, f) != (size_t)*len) {
+		fprintf(stderr, "can't read %s\n", fn);
+		exit(1);
+	}
+	fclose(f);
+	return b;
+}
+
+static inline uint32_t be32(const unsigned char *p)
+{
+	return ( (uint32_t)p[0] << 24 ) | ( p[1] << 16 ) | ( p[2] << 8 ) | p[3];
+}
+
+static inline uint32_t le32(const unsigned char *p)
+{
+	return ( (uint32_t)p[3] << 24 ) | ( p[2] << 16 ) | ( p[1] << 8 ) | p[0];
+}
+
+static inline float lef32(const unsigned char *p)
+{
+	uint32_t u = le32(p);
+	float f;
+
+	memcpy(&f, &u, 4);
+	return f;
+}
+
+static inline int paeth(int a, int b, int c)
+{
+	int p = a + b - c;
+	int pa = abs(p - a);
+	int pb = abs(p - b);
+	int pc = abs(p - c);
+
+	if (pa <= pb && pa <= pc)
+		return a;
+	if (pb <= pc)
+		return b;
+	return c;
+}
+
+/* The PNG written by pie: 8 bits RGBA, RGB or gray, or a palette of 1
+ * to 8 bits. Returns 0 on error.
+ */
+static int decode_png(const unsigned char *b, long len, struct image *im)
+{
+	static const unsigned char sig[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+	static const int channels[7] = { 1, 0, 3, 1, 2, 0, 4 };
+	unsigned char plte[256][4];
+	unsigned char *idat = NULL;
+	unsigned char *raw;
+	unsigned char *line;
+	unsigned char *prev;
+	unsigned char *o;
+	unsigned char c[4];
+	unsigned long rawlen;
+	long nidat = 0;
+	long pos;
+	uint32_t clen;
+	int w = 0;
+	int h = 0;
+	int depth = 0;
+	int ctype = 0;
+	int rowlen;
+	int bpp;
+	int x;
+	int y;
+	int i;
+	int v;
+	int a;
+	int up;
+	int left;
+	int ul;
+
+	if (len < 8 || memcmp(b, sig, 8) != 0)
+		return 0;
+
+	for (i=0; i<256; i++) {
+		plte[i][0] = 0;
+		plte[i][1] = 0;
+		plte[i][2] = 0;
+		plte[i][3] = 0xff;
+	}
+
+	idat = xalloc(len);
+	for (pos=8; pos+12<=len; pos+=12+clen) {
+		clen = be32(b + pos);
+		if (pos + 12 + (long)clen > len)
+			break;
+		if (memcmp(b + pos + 4, "IHDR", 4) == 0) {
+			w = be32(b + pos + 8);
+			h = be32(b + pos + 12);
+			depth = b[pos + 16];
+			ctype = b[pos + 17];
+		}
+		else if (memcmp(b + pos + 4, "PLTE", 4) == 0) {
+			for (i=0; i<(int)clen/3 && i<256; i++)
+				memcpy(plte[i], b + pos + 8 + ( i * 3 ), 3);
+		}
+		else if (memcmp(b + pos + 4, "tRNS", 4) == 0) {
+			for (i=0; i<(int)clen && i<256; i++)
+				plte[i][3] = b[pos + 8 + i];
+		}
+		else if (memcmp(b + pos + 4, "IDAT", 4) == 0) {
+			memcpy(idat + nidat, b + pos + 8, clen);
+			nidat += clen;
+		}
+	}
+	if (w <= 0 || h <= 0 || ctype > 6 || channels[ctype] == 0 ||
+	    ( ctype != 3 && depth != 8 )) {
+		free(idat);
+		return 0;
+	}
+
+	rowlen = ( ( w * channels[ctype] * depth ) + 7 ) / 8;
+	bpp = ( channels[ctype] * depth ) / 8;
+	if (bpp < 1)
+		bpp = 1;
+	rawlen = (unsigned long)( rowlen + 1 ) * h;
+	raw = xalloc(rawlen);
+	if (uncompress(raw, &rawlen, idat, nidat) != Z_OK ||
+	    rawlen != (unsigned long)( rowlen + 1 ) * h) {
+		free(idat);
+		free(raw);
+		return 0;
+	}
+	free(idat);
+
+	new_image(im, w, h);
+	prev = NULL;
+	for (y=0; y<h; y++) {
+		line = raw + ( y * ( rowlen + 1 ) ) + 1;
+
+		/* unfilter */
+		for (x=0; x<rowlen; x++) {
+			left = x >= bpp ? line[x - bpp] : 0;
+			up = prev != NULL ? prev[x] : 0;
+			ul = prev != NULL && x >= bpp ? prev[x - bpp] : 0;
+			switch (line[-1]) {
+			case 1: line[x] += left; break;
+			case 2: line[x] += up; break;
+			case 3: line[x] += ( left + up ) / 2; break;
+			case 4: line[x] += paeth(left, up, ul); break;
+			}
+		}
+		prev = line;
+
+		/* premultiplied RGBA */
+		for (x=0; x<w; x++) {
+			switch (ctype) {
+			case 0:
+				c[0] = c[1] = c[2] = line[x];
+				c[3] = 0xff;
+				break;
+			case 2:
+				memcpy(c, line + ( x * 3 ), 3);
+				c[3] = 0xff;
+				break;
+			case 3:
+				v = ( line[( x * depth ) / 8] >> ( 8 - depth - ( ( x * depth ) % 8 ) ) ) &
+				    ( ( 1 << depth ) - 1 );
+				memcpy(c, plte[v], 4);
+				break;
+			default:
+				memcpy(c, line + ( x * 4 ), 4);
+				break;
+			}
+			a = c[3];
+			o = &im->px[( ( y * w ) + x ) * 4];
+			o[0] = ( ( c[0] * a ) + 127 ) / 255;
+			o[1] = ( ( c[1] * a ) + 127 ) / 255;
+			o[2] = ( ( c[2] * a ) + 127 ) / 255;
+			o[3] = a;
+		}
+	}
+	free(raw);
+	return 1;
+}
+
+/* Draw <co> 3 times in a ring of 2 slots on GOLDEN_OUT, so the last
+ * frame went round the ring, and map the file as a reader does. The
+ * headers must describe the frame 3, its pixels become <im>. Returns 0
+ * and says why if the ring is wrong.
+ */
+#define RING_SLOTS  2
+#define RING_FRAMES 3
+
+static int render_ring(const struct config *cf, struct conf *co,
+                       struct image *im)
+{
+	const struct pie_ring_head *head;
+	const struct pie_ring_frame *f;
+	const struct pie_ring_frame *prev;
+	struct pie_ring *r;
+	unsigned char *map;
+	unsigned long long n;
+	size_t size;
+	int stride;
+	int fd;
+	int ok;
+	int i;
+
+	r = pie_ring_open(GOLDEN_OUT, RING_SLOTS, pie_raw_size(co));
+	if (r == NULL)
+		return 0;
+	for (i=1; i<=RING_FRAMES; i++) {
+		n = pie_draw_ring(co, r);
+		if (n != (unsigned long long)i) {
+			printf("%-8s ring       frame %llu instead of %d  FAIL\n",
+			       cf->name, n, i);
+			pie_ring_close(r);
+			return 0;
+		}
+	}
+
+	/* an other mapping of the file, the writer still holds its own */
+	fd = open(GOLDEN_OUT, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "can't open %s\n", GOLDEN_OUT);
+		exit(1);
+	}
+	size = lseek(fd, 0, SEEK_END);
+	map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		fprintf(stderr, "can't map %s\n", GOLDEN_OUT);
+		exit(1);
+	}
+
+	stride = cairo_format_stride_for_width(CAIRO_FORMAT_ARGB32, cf->w);
+	head = (const struct pie_ring_head *)map;
+	ok = size >= PIE_RING_HEAD &&
+	     memcmp(head->magic, "PIER", 4) == 0 &&
+	     head->version == PIE_RING_VERSION &&
+	     head->nslots == RING_SLOTS &&
+	     head->slot_size >= sizeof(struct pie_ring_frame) +
+	                        ( (size_t)stride * cf->h ) &&
+	     size == PIE_RING_HEAD + ( (size_t)head->slot_size * RING_SLOTS ) &&
+	     head->seq == RING_FRAMES;
+	if (!ok) {
+		printf("%-8s ring       bad ring header  FAIL\n", cf->name);
+		munmap(map, size);
+		pie_ring_close(r);
+		return 0;
+	}
+
+	f = (const struct pie_ring_frame *)( map + PIE_RING_HEAD +
+	    ( ( RING_FRAMES % RING_SLOTS ) * head->slot_size ) );
+	prev = (const struct pie_ring_frame *)( map + PIE_RING_HEAD +
+	       ( ( ( RING_FRAMES - 1 ) % RING_SLOTS ) * head->slot_size ) );
+	ok = f->seq == RING_FRAMES && prev->seq == RING_FRAMES - 1 &&
+	     f->w == (uint32_t)cf->w && f->h == (uint32_t)cf->h &&
+	     f->stride == (uint32_t)stride &&
+	     f->format == CAIRO_FORMAT_ARGB32 &&
+	     f->len == (uint32_t)stride * cf->h;
+	if (ok) {
+		new_image(im, cf->w, cf->h);
+		from_argb32(im, (const unsigned char *)( f + 1 ), f->stride);
+	}
+	else
+		printf("%-8s ring       bad frame header  FAIL\n", cf->name);
+
+	munmap(map, size);
+	pie_ring_close(r);
+	return ok;
+}
+
+static int render(const struct config *cf, const struct path *pa,
+                  struct image *im)
+{
+	struct conf *co;
+	unsigned char *b;
+	long len;
+	int ok;
+
+	co = new_chart(cf, pa);
+	if (pa->mode == PIE_RING) {
+		ok = render_ring(cf, co, im);
+		pie_free(co);
+		return ok;
+	}
+	pie_draw(co, pa->mode, GOLDEN_OUT);
+	pie_free(co);
+
+	b = read_file(GOLDEN_OUT, &len);
+	if (pa->mode == PIE_RAW) {
+		ok = len == (long)cf->w * cf->h * 4;
+		if (ok) {
+			new_image(im, cf->w, cf->h);
+			from_argb32(im, b, cf->w * 4);
+		}
+	}
+	else
+		ok = decode_png(b, len, im);
+	free(b);
+	return ok;
+}
+
+/* reference, path and the differences in red over the dimmed
+ * reference, side by side
+ */
+static void write_diff(const char *dir, const struct config *cf,
+                       const struct path *pa, struct image *ref,
+                       struct image *im)
+{
+	cairo_surface_t *s;
+	unsigned char *data;
+	uint32_t *line;
+	unsigned char *r;
+	unsigned char *p;
+	char fn[256];
+	int stride;
+	int d;
+	int m;
+	int x;
+	int y;
+	int k;
+
+	s = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, ref->w * 3, ref->h);
+	cairo_surface_flush(s);
+	data = cairo_image_surface_get_data(s);
+	stride = cairo_image_surface_get_stride(s);
+
+	for (y=0; y<ref->h; y++) {
+		line = (uint32_t *)( data + ( y * stride ) );
+		for (x=0; x<ref->w; x++) {
+			r = &ref->px[( ( y * ref->w ) + x ) * 4];
+			p = &im->px[( ( y * ref->w ) + x ) * 4];
+			line[x] = ( (uint32_t)r[3] << 24 ) | ( r[0] << 16 ) | ( r[1] << 8 ) | r[2];
+			line[ref->w + x] = ( (uint32_t)p[3] << 24 ) | ( p[0] << 16 ) | ( p[1] << 8 ) | p[2];
+			m = 0;
+			for (k=0; k<4; k++) {
+				d = abs(r[k] - p[k]);
+				if (d > m)
+					m = d;
+			}
+			if (m > 0) {
+				m = m * 4 > 255 ? 255 : ( m * 4 < 64 ? 64 : m * 4 );
+				line[( ref->w * 2 ) + x] = 0xff000000 | ( m << 16 );
+			}
+			else {
+				d = ( ( r[0] + r[1] + r[2] ) / 3 + ( 255 - r[3] ) ) / 4 + 0xc0;
+				line[( ref->w * 2 ) + x] = 0xff000000 | ( d << 16 ) | ( d << 8 ) | d;
+			}
+		}
+	}
+	cairo_surface_mark_dirty(s);
+
+	snprintf(fn, sizeof(fn), "%s/diff-%s-%s.png", dir, cf->name, pa->name);
+	cairo_surface_write_to_png(s, fn);
+	cairo_surface_destroy(s);
+	printf("    %s\n", fn);
+}
+
+/* returns 1 if the path passes */
+static int compare(const struct config *cf, const struct path *pa,
+                   struct image *ref, struct image *im, const char *dir,
+                   int all)
+{
+	double mse = 0;
+	double psnr;
+	double bad_pc;
+	long bad = 0;
+	long n;
+	int max = 0;
+	int m;
+	int d;
+	int k;
+	long i;
+	int ok;
+
+	n = (long)ref->w * ref->h;
+	for (i=0; i<n; i++) {
+		m = 0;
+		for (k=0; k<4; k++) {
+			d = abs(ref->px[( i * 4 ) + k] - im->px[( i * 4 ) + k]);
+			mse += d * d;
+			if (d > m)
+				m = d;
+		}
+		if (m > pa->tol)
+			bad++;
+		if (m > max)
+			max = m;
+	}
+	mse /= n * 4;
+	psnr = mse > 0 ? 10.0 * log10(( 255.0 * 255.0 ) / mse) : 99;
+	bad_pc = ( 100.0 * bad ) / n;
+
+	ok = bad_pc <= pa->bad && psnr >= pa->psnr;
+	printf("%-8s %-10s max %3d  over %3d: %7.3f%%  psnr %6.2f dB  %s\n",
+	       cf->name, pa->name, max, pa->tol, bad_pc, psnr, ok ? "ok" : "FAIL");
+	if (!ok || ( all && max > 0 ))
+		write_diff(dir, cf, pa, ref, im);
+	return ok;
+}
+
+/* The pixels of the coded baseline whose 8 neighbours have the same
+ * code, off the pie included, are hit tested. Returns the number of
+ * wrong slices, <n> counts the points by kind of face.
+ */
+static int hit_faces(const struct config *cf, struct pie_hit *h, int *n)
+{
+	struct image im;
+	const unsigned char *q;
+	int bad = 0;
+	int same;
+	int kind;
+	int s;
+	int x;
+	int y;
+	int i;
+	int j;
+
+	baseline(cf, &im, 1);
+	for (y=1; y<im.h-1; y++) {
+		for (x=1; x<im.w-1; x++) {
+			q = &im.px[( ( y * im.w ) + x ) * 4];
+			same = 1;
+			for (j=-1; j<=1; j++)
+				for (i=-1; i<=1; i++)
+					if (memcmp(q, q + ( ( ( j * im.w ) + i ) * 4 ), 4) != 0)
+						same = 0;
+			if (!same)
+				continue;
+
+			kind = q[3] == 0 ? HIT_NONE : q[0];
+			s = kind == HIT_NONE ? -1 : ( ( q[1] << 8 ) | q[2] ) - 1;
+			n[kind]++;
+			if (pie_hit_test(h, x + 0.5, y + 0.5) != s)
+				bad++;
+		}
+	}
+	free(im.px);
+	return bad;
+}
+
+/* The swatch and the text of each legend line of the GEOMBIN layout hit
+ * its slice, and the swatch has its colour in the reference. So do the
+ * text and the middle of the leader segments of each label.
+ */
+static int hit_layout(struct conf *co, struct pie_hit *h, struct image *ref,
+                      int *n)
+{
+	const unsigned char *q;
+	unsigned char *b;
+	unsigned char *p;
+	unsigned int col;
+	long len;
+	double dec;
+	double w;
+	double x;
+	double y;
+	int bad = 0;
+	int nleg;
+	int nlab;
+	int nb;
+	int s;
+	int i;
+
+	pie_draw(co, PIE_GEOM_BIN, GOLDEN_OUT);
+	b = read_file(GOLDEN_OUT, &len);
+	if (len < 60 || memcmp(b, "PIEG", 4) != 0 || le32(b + 4) != 3) {
+		free(b);
+		return 1;
+	}
+
+	/* header, slices, painter orders, title */
+	nb = le32(b + 16);
+	p = b + 60 + ( nb * 32 );
+	p += ( le32(b + 20) + le32(b + 24) + ( le32(b + 28) * 3 ) ) * 4;
+	p += 4 + le32(p) + 16;
+
+	nleg = le32(p);
+	dec = lef32(p + 8);
+	w = lef32(p + 12);
+	p += 20;
+	for (i=0; i<nleg; i++, p+=12) {
+		s = (int)le32(p);
+		x = lef32(p + 4);
+		y = lef32(p + 8);
+		n[HIT_LEGEND]++;
+		if (pie_hit_test(h, x + ( dec / 2 ), y + ( dec / 2 )) != s ||
+		    pie_hit_test(h, x + ( w / 2 ), y + ( dec / 2 )) != s)
+			bad++;
+		if (s < 0)
+			continue;
+		sscanf(colors[s % NB_COLORS] + 1, "%06x", &col);
+		q = &ref->px[( ( (int)( y + ( dec / 2 ) ) * ref->w ) +
+		               (int)( x + ( dec / 2 ) ) ) * 4];
+		if (q[0] != ( col >> 16 ) || q[1] != ( ( col >> 8 ) & 0xff ) ||
+		    q[2] != ( col & 0xff ) || q[3] != 0xff)
+			bad++;
+	}
+	p += 4 + le32(p);
+
+	/* text box at 16, leader points at 32 */
+	nlab = le32(p);
+	p += 12;
+	for (i=0; i<nlab; i++, p+=56) {
+		s = (int)le32(p);
+		n[HIT_LABEL]++;
+		if (pie_hit_test(h, lef32(p + 16) + ( lef32(p + 24) / 2 ),
+		                 lef32(p + 20) + ( lef32(p + 28) / 2 )) != s)
+			bad++;
+		if (le32(p + 4) == 0 &&
+		    ( pie_hit_test(h, ( lef32(p + 32) + lef32(p + 40) ) / 2,
+		                   ( lef32(p + 36) + lef32(p + 44) ) / 2) != s ||
+		      pie_hit_test(h, ( lef32(p + 40) + lef32(p + 48) ) / 2,
+		                   ( lef32(p + 44) + lef32(p + 52) ) / 2) != s ))
+			bad++;
+	}
+	free(b);
+	return bad;
+}
+
+/* the faces on the charts drawn by the baseline, the legend lines and
+ * the labels on the others. The points are added to <total> by kind.
+ */
+static int hit(const struct config *cf, struct image *ref, int *total)
+{
+	struct pie_hit *h;
+	struct conf *co;
+	int n[HIT_KINDS];
+	int bad = 0;
+	int i;
+
+	memset(n, 0, sizeof(n));
+	co = new_chart(cf, NULL);
+	h = pie_hit_new(co);
+	if (h == NULL) {
+		fprintf(stderr, "Memory error\n");
+		exit(1);
+	}
+	if (!cf->legend && !cf->title && !cf->labels)
+		bad += hit_faces(cf, h, n);
+	if (cf->legend || cf->labels)
+		bad += hit_layout(co, h, ref, n);
+	pie_hit_free(h);
+	pie_free(co);
+
+	for (i=0; i<HIT_KINDS; i++)
+		total[i] += n[i];
+	printf("%-8s %-10s top %d rounded %d side %d legend %d label %d "
+	       "off %d  wrong %d  %s\n", cf->name, "hit", n[HIT_TOP],
+	       n[HIT_ROUNDED], n[HIT_STOP] + n[HIT_START], n[HIT_LEGEND],
+	       n[HIT_LABEL], n[HIT_NONE], bad, bad == 0 ? "ok" : "FAIL");
+	return bad == 0;
+}
+
+static void usage(void)
+{
+	printf(
+		"\n"
+		"Syntax: golden [-a] [-d <dir>] [-c <chart>] [-p <path>]\n"
+		"\n"
+		" -a                   : Write the diff image of every path which\n"
+		"                        is not identical, not only the failures\n"
+		" -d <dir>             : Directory of the diff images. Default is .\n"
+		" -c <chart>           : Only this chart of the corpus\n"
+		" -p <path>            : Only this render path\n"
+		"\n"
+	);
+	exit(0);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *dir = ".";
+	const char *only_cf = NULL;
+	const char *only_pa = NULL;
+	struct image ref;
+	struct image im;
+	int total[HIT_KINDS];
+	int all = 0;
+	int fail = 0;
+	int i;
+	int j;
+
+	for (i=1; i<argc; i++) {
+		if (strcmp(argv[i], "-a") == 0)
+			all = 1;
+		else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc)
+			dir = argv[++i];
+		else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+			only_cf = argv[++i];
+		else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc)
+			only_pa = argv[++i];
+		else
+			usage();
+	}
+
+	memset(total, 0, sizeof(total));
+	for (i=0; i<NB_CONFIGS; i++) {
+		if (only_cf != NULL && strcmp(only_cf, configs[i].name) != 0)
+			continue;
+		reference(&configs[i], &ref);
+
+		/* pie_cairo_draw() against the baseline renderer */
+		if (!configs[i].legend && !configs[i].title &&
+		    !configs[i].labels &&
+		    ( only_pa == NULL || strcmp(only_pa, geometry.name) == 0 )) {
+			baseline(&configs[i], &im, 0);
+			if (!compare(&configs[i], &geometry, &im, &ref, dir, all))
+				fail++;
+			free(im.px);
+		}
+
+		/* pie_hit_test() against the baseline and the legend layout */
+		if (( only_pa == NULL || strcmp(only_pa, "hit") == 0 ) &&
+		    !hit(&configs[i], &ref, total))
+			fail++;
+
+		for (j=0; j<NB_PATHS; j++) {
+			if (only_pa != NULL && strcmp(only_pa, paths[j].name) != 0)
+				continue;
+			if (paths[j].opaque && !configs[i].back)
+				continue;
+
+			if (!render(&configs[i], &paths[j], &im)) {
+				/* render_ring() said why */
+				if (paths[j].mode != PIE_RING)
+					printf("%-8s %-10s can't decode the output  FAIL\n",
+					       configs[i].name, paths[j].name);
+				fail++;
+				continue;
+			}
+			if (im.w != ref.w || im.h != ref.h) {
+				printf("%-8s %-10s size %dx%d instead of %dx%d  FAIL\n",
+				       configs[i].name, paths[j].name, im.w, im.h,
+				       ref.w, ref.h);
+				fail++;
+			}
+			else if (!compare(&configs[i], &paths[j], &ref, &im, dir, all))
+				fail++;
+			free(im.px);
+		}
+		free(ref.px);
+	}
+
+	/* each kind of face is hit tested somewhere in the corpus */
+	if (only_cf == NULL && ( only_pa == NULL || strcmp(only_pa, "hit") == 0 ) &&
+	    ( total[HIT_TOP] == 0 || total[HIT_ROUNDED] == 0 ||
+	      total[HIT_STOP] == 0 || total[HIT_START] == 0 ||
+	      total[HIT_LEGEND] == 0 || total[HIT_LABEL] == 0 )) {
+		printf("hit: a kind of face is never tested  FAIL\n");
+		fail++;
+	}
+
+	remove(GOLDEN_OUT);
+	if (fail > 0) {
+		printf("%d failures\n", fail);
+		return 1;
+	}
+	return 0;
+}
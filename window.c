@@ -0,0 +1,343 @@
+/*
+ * Copyright 2010-2019 Thierry FOURNIER
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pie.h"
+#include "stats.h"
+
+/* Sliding window over a stream of timestamped values. Each label keeps
+ * the sum of its values in the window: an event is added to its label
+ * when it arrives and subtracted when it leaves the window. The events
+ * are kept in arrival order in a ring, so the expired ones are at its
+ * start. A label leaves with its last event, and its slot is reused
+ * by the next new label. The cost of an event is constant, a chart
+ * costs the number of labels in the window, whatever the number of
+ * events and of the labels seen before.
+ */
+
+struct label {
+	char *name;
+	char *color;
+	double extrude;
+	double sum;
+	int count; /* events in the window */
+	unsigned int hash;
+	int prev; /* live list, or -1 */
+	int next; /* live list or free list, or -1 */
+};
+
+struct event {
+	double t;
+	double value;
+	int label;
+};
+
+struct pie_window {
+	struct conf *model;
+	double span;
+	double last; /* time of the newest event */
+
+	/* slots of the labels, and their hash table of indexes + 1, 0 is
+	 * a free slot. The labels in the window are listed by order of
+	 * appearance, the free slots have a NULL name.
+	 */
+	struct label *label;
+	int nb_label; /* slots used */
+	int size_label;
+	int nb_live;
+	int first_live;
+	int last_live;
+	int free_label;
+	int *table;
+	int size_table; /* power of 2 */
+
+	/* ring of the events in the window */
+	struct event *ev;
+	int first;
+	int nb_ev;
+	int size_ev;
+};
+
+static void *xrealloc(void *p, size_t len)
+{
+	p = realloc(p, len);
+	if (p == NULL) {
+		fprintf(stderr, "Memory error\n");
+		exit(1);
+	}
+	STATS_ADD(allocs, 1);
+	return p;
+}
+
+/* FNV-1a */
+static unsigned int hash_str(const char *s)
+{
+	unsigned int h = 2166136261U;
+
+	while (*s != '\0') {
+		h ^= (unsigned char)*s++;
+		h *= 16777619U;
+	}
+	return h;
+}
+
+/* window of <span> seconds, the charts have the options of <model> */
+struct pie_window *pie_window_new(struct conf *model, double span)
+{
+	struct pie_window *w;
+
+	w = calloc(1, sizeof(struct pie_window));
+	if (w == NULL)
+		return NULL;
+	STATS_ADD(allocs, 1);
+
+	w->model = pie_new_from(model);
+	if (w->model == NULL) {
+		free(w);
+		return NULL;
+	}
+	w->span = span;
+	w->first_live = -1;
+	w->last_live = -1;
+	w->free_label = -1;
+	return w;
+}
+
+void pie_window_free(struct pie_window *w)
+{
+	int i;
+
+	for (i=0; i<w->nb_label; i++) {
+		free(w->label[i].name);
+		free(w->label[i].color);
+	}
+	free(w->label);
+	free(w->table);
+	free(w->ev);
+	pie_free(w->model);
+	free(w);
+}
+
+static void table_grow(struct pie_window *w)
+{
+	unsigned int m;
+	unsigned int j;
+	int i;
+
+	w->size_table = w->size_table == 0 ? 64 : w->size_table * 2;
+	free(w->table);
+	w->table = xrealloc(NULL, w->size_table * sizeof(int));
+	memset(w->table, 0, w->size_table * sizeof(int));
+
+	m = w->size_table - 1;
+	for (i=0; i<w->nb_label; i++) {
+		if (w->label[i].name == NULL)
+			continue;
+		for (j=w->label[i].hash & m; w->table[j] != 0; j=(j+1) & m);
+		w->table[j] = i + 1;
+	}
+}
+
+/* Remove the label <i> from the table. The following entries of its
+ * cluster move back when the hole is between them and their bucket.
+ */
+static void table_del(struct pie_window *w, int i)
+{
+	unsigned int m;
+	unsigned int j;
+	unsigned int k;
+	unsigned int b;
+
+	m = w->size_table - 1;
+	for (j=w->label[i].hash & m; w->table[j] != i + 1; j=(j+1) & m);
+
+	w->table[j] = 0;
+	for (k=(j+1) & m; w->table[k] != 0; k=(k+1) & m) {
+		b = w->label[w->table[k] - 1].hash & m;
+		if (( ( k - b ) & m ) < ( ( k - j ) & m ))
+			continue;
+		w->table[j] = w->table[k];
+		w->table[k] = 0;
+		j = k;
+	}
+}
+
+/* the label <i> has no event left in the window */
+static void label_retire(struct pie_window *w, int i)
+{
+	struct label *l = &w->label[i];
+
+	table_del(w, i);
+
+	if (l->prev < 0)
+		w->first_live = l->next;
+	else
+		w->label[l->prev].next = l->next;
+	if (l->next < 0)
+		w->last_live = l->prev;
+	else
+		w->label[l->next].prev = l->prev;
+
+	free(l->name);
+	free(l->color);
+	l->name = NULL;
+	l->color = NULL;
+	l->next = w->free_label;
+	w->free_label = i;
+	w->nb_live--;
+}
+
+/* index of the label <name>, created with <color> and <extrude> */
+static int label_get(struct pie_window *w, char *name, char *color,
+                     double extrude)
+{
+	struct label *l;
+	unsigned int h;
+	unsigned int m;
+	unsigned int j;
+	int i;
+
+	h = hash_str(name);
+	if (w->size_table > 0) {
+		m = w->size_table - 1;
+		for (j=h & m; w->table[j] != 0; j=(j+1) & m) {
+			l = &w->label[w->table[j] - 1];
+			if (l->hash == h && strcmp(l->name, name) == 0)
+				return w->table[j] - 1;
+		}
+	}
+
+	if (w->free_label >= 0) {
+		i = w->free_label;
+		w->free_label = w->label[i].next;
+	}
+	else {
+		if (w->nb_label == w->size_label) {
+			w->size_label = w->size_label == 0 ? 16 : w->size_label * 2;
+			w->label = xrealloc(w->label,
+			                    w->size_label * sizeof(struct label));
+		}
+		i = w->nb_label++;
+	}
+	l = &w->label[i];
+	l->name = strdup(name);
+	l->color = strdup(color);
+	if (l->name == NULL || l->color == NULL) {
+		fprintf(stderr, "Memory error\n");
+		exit(1);
+	}
+	STATS_ADD(allocs, 2);
+	l->extrude = extrude;
+	l->sum = 0;
+	l->count = 0;
+	l->hash = h;
+	l->prev = w->last_live;
+	l->next = -1;
+	if (w->last_live < 0)
+		w->first_live = i;
+	else
+		w->label[w->last_live].next = i;
+	w->last_live = i;
+	w->nb_live++;
+
+	/* at most half full */
+	if (w->nb_live * 2 > w->size_table)
+		table_grow(w);
+	else {
+		m = w->size_table - 1;
+		for (j=h & m; w->table[j] != 0; j=(j+1) & m);
+		w->table[j] = i + 1;
+	}
+	return i;
+}
+
+/* Add an event at the time <t>. The times must not decrease, an older
+ * event is counted at the time of the newest one. The colour and the
+ * explode of a label are the ones of its first event.
+ */
+void pie_window_add(struct pie_window *w, double t, double value,
+                    char *color, double extrude, char *name)
+{
+	struct event *e;
+	int size;
+
+	if (w->nb_ev > 0 && t < w->last)
+		t = w->last;
+	w->last = t;
+
+	/* the ring is full, the wrapped start goes after the old end */
+	if (w->nb_ev == w->size_ev) {
+		size = w->size_ev;
+		w->size_ev = size == 0 ? 256 : size * 2;
+		w->ev = xrealloc(w->ev, w->size_ev * sizeof(struct event));
+		if (w->first > 0)
+			memcpy(&w->ev[size], w->ev, w->first * sizeof(struct event));
+	}
+
+	e = &w->ev[( w->first + w->nb_ev ) & ( w->size_ev - 1 )];
+	e->t = t;
+	e->value = value;
+	e->label = label_get(w, name, color, extrude);
+	w->label[e->label].sum += value;
+	w->label[e->label].count++;
+	w->nb_ev++;
+}
+
+/* Remove the events older than <now> - span. Returns the number of
+ * events removed.
+ */
+int pie_window_expire(struct pie_window *w, double now)
+{
+	struct label *l;
+	struct event *e;
+	int n = 0;
+
+	while (w->nb_ev > 0) {
+		e = &w->ev[w->first];
+		if (e->t >= now - w->span)
+			break;
+		l = &w->label[e->label];
+		l->count--;
+		if (l->count == 0)
+			label_retire(w, e->label);
+		else
+			l->sum -= e->value;
+		w->first = ( w->first + 1 ) & ( w->size_ev - 1 );
+		w->nb_ev--;
+		n++;
+	}
+	return n;
+}
+
+/* number of events in the window */
+int pie_window_events(struct pie_window *w)
+{
+	return w->nb_ev;
+}
+
+/* A new chart of the sums of the labels present in the window, in
+ * their order of appearance in it. The caller frees it with pie_free().
+ */
+struct conf *pie_window_chart(struct pie_window *w)
+{
+	struct conf *co;
+	int i;
+
+	co = pie_new_from(w->model);
+	if (co == NULL)
+		return NULL;
+
+	for (i=w->first_live; i>=0; i=w->label[i].next)
+		if (w->label[i].sum > 0)
+			pie_add(co, w->label[i].sum, w->label[i].color,
+			        w->label[i].extrude, w->label[i].name);
+	return co;
+}